@@ -0,0 +1,493 @@
+/* Offline capture analyzer (Linux, POSIX threads), not part of the core.
+ * Reconstructs every ISO-TP message of capture (see iso_tp_capture.h).
+ *
+ * Usage: iso_tp_analyze [-j workers] [-x] capture out_prefix
+ *   -j  Number of worker threads (default: all cores)
+ *   -x  Extended addressing (N_TA byte before N_PCI)
+ * Capture is up to 4 GiB (see ISO_TP_CAP_SIZE_MAX).
+ *
+ * Sessions are independent per CAN ID, so capture is sharded by CAN ID:
+ * every worker walks the whole (memory mapped) capture, but decodes and
+ * reassembles frames of its own CAN IDs only, with its own instance.
+ *
+ * Output is columnar, one file per column, row per complete message,
+ * host byte order:
+ *   <out_prefix>.id    uint32_t  CAN ID of sender
+ *   <out_prefix>.time  uint64_t  Time of SF or FF, us since capture start
+ *   <out_prefix>.len   uint32_t  Message length
+ *   <out_prefix>.off   uint64_t  Offset of message in <out_prefix>.data
+ *   <out_prefix>.data  Messages, back to back
+ * Rows are grouped by worker, ordered by completion time within group. */
+#define _GNU_SOURCE
+
+/* Any CAN FD message in one piece, many concurrent receptions */
+#define ISO_TP_MAX_CAN_DL        64u
+#define ISO_TP_MAX_SESSIONS_LOG2 6u
+#define ISO_TP_POOL_BLOCK_SIZE   4096u
+
+#include "iso_tp_capture.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * DEFINITIONS
+ *****************************************************************************/
+#define ISO_TP_AN_MAX_WORKERS 64u
+
+/** Start times of receptions, by (CAN ID, N_AE) */
+#define ISO_TP_AN_START_LEN   1024u
+
+/** Column files */
+enum iso_tp_an_col {
+	ISO_TP_AN_COL_ID,
+	ISO_TP_AN_COL_TIME,
+	ISO_TP_AN_COL_LEN,
+	ISO_TP_AN_COL_OFF,
+	ISO_TP_AN_COL_DATA,
+	ISO_TP_AN_COLS
+};
+
+static const char *iso_tp_an_col_ext[ISO_TP_AN_COLS] = {
+	"id", "time", "len", "off", "data"
+};
+
+/** Start of reception */
+struct iso_tp_an_start {
+	uint32_t id;
+	uint8_t  n_ae;
+	bool     used;
+	uint64_t time_us;
+};
+
+/** Worker, owns shard of CAN IDs */
+struct iso_tp_an_worker {
+	pthread_t thread;
+	uint32_t  index;
+
+	struct iso_tp tp;
+	uint8_t       pool[ISO_TP_POOL_MAX_BLOCKS * ISO_TP_POOL_BLOCK_SIZE];
+
+	struct iso_tp_an_start start[ISO_TP_AN_START_LEN];
+
+	FILE    *col[ISO_TP_AN_COLS]; /**< Shard of output */
+	uint64_t data_len;
+
+	uint32_t frames;   /**< Frames of shard */
+	uint32_t messages; /**< Complete messages */
+	uint32_t failed;   /**< Messages failed (timeout, wrong SN, etc) */
+	bool     error;
+};
+
+/* Shared read-only by workers */
+static const uint8_t *iso_tp_an_cap;
+static uint32_t       iso_tp_an_cap_size;
+static uint32_t       iso_tp_an_n_workers;
+static bool           iso_tp_an_extended;
+static const char    *iso_tp_an_prefix;
+
+static struct iso_tp_an_worker iso_tp_an_workers[ISO_TP_AN_MAX_WORKERS];
+
+/******************************************************************************
+ * WORKER
+ *****************************************************************************/
+/** Worker of CAN ID */
+uint32_t iso_tp_an_shard(uint32_t id)
+{
+	return (uint32_t)(((uint64_t)(id * 2654435761u) *
+			   iso_tp_an_n_workers) >> 32u);
+}
+
+/** Start slot of reception, NULL if table is full */
+struct iso_tp_an_start *iso_tp_an_start_slot(struct iso_tp_an_worker *w,
+					     uint32_t id, uint8_t n_ae)
+{
+	struct iso_tp_an_start *result = NULL;
+
+	uint32_t slot = ((id * 2654435761u) ^ n_ae) % ISO_TP_AN_START_LEN;
+	uint32_t i;
+
+	for (i = 0u; (i < ISO_TP_AN_START_LEN) && (result == NULL); i++) {
+		struct iso_tp_an_start *s = &w->start[slot];
+
+		if (!s->used || ((s->id == id) && (s->n_ae == n_ae))) {
+			result = s;
+		}
+
+		slot = (slot + 1u) % ISO_TP_AN_START_LEN;
+	}
+
+	return result;
+}
+
+/** Path of column file, shard of worker or merged one */
+void iso_tp_an_path(char *path, size_t size, const struct iso_tp_an_worker *w,
+		    enum iso_tp_an_col col)
+{
+	if (w != NULL) {
+		(void)snprintf(path, size, "%s.%u.%s", iso_tp_an_prefix,
+			       (unsigned)w->index, iso_tp_an_col_ext[col]);
+	} else {
+		(void)snprintf(path, size, "%s.%s", iso_tp_an_prefix,
+			       iso_tp_an_col_ext[col]);
+	}
+}
+
+/** Handle event of step, id and time_us are of the last frame */
+void iso_tp_an_event(struct iso_tp_an_worker *w, enum iso_tp_event ev,
+		     uint32_t id, uint64_t time_us)
+{
+	const struct iso_tp_n_pci *n_pci = NULL;
+	struct iso_tp_an_start    *s;
+	struct iso_tp_n_usdata     ind;
+
+	bool     pdu   = iso_tp_peek_n_pdu(&w->tp, &n_pci, NULL, NULL);
+	uint64_t start = time_us;
+
+	if (pdu && (n_pci->n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_FF)) {
+		s = iso_tp_an_start_slot(w, id, n_pci->n_ae);
+
+		if (s != NULL) {
+			s->id      = id;
+			s->n_ae    = n_pci->n_ae;
+			s->used    = true;
+			s->time_us = time_us;
+		}
+	}
+
+	if ((ev != ISO_TP_EVENT_N_USDATA_IND) ||
+	    !iso_tp_get_n_usdata(&w->tp, &ind)) {
+		/* Not a message */
+	} else if (ind.n_result != (uint8_t)ISO_TP_N_RESULT_N_OK) {
+		w->failed++;
+	} else {
+		/* SF starts and ends at once */
+		if (!pdu ||
+		    (n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_SF)) {
+			s = iso_tp_an_start_slot(w, ind.id, ind.n_ae);
+
+			if ((s != NULL) && s->used) {
+				start = s->time_us;
+			}
+		}
+
+		(void)fwrite(&ind.id, sizeof(ind.id), 1u,
+			     w->col[ISO_TP_AN_COL_ID]);
+		(void)fwrite(&start, sizeof(start), 1u,
+			     w->col[ISO_TP_AN_COL_TIME]);
+		(void)fwrite(&ind.len, sizeof(ind.len), 1u,
+			     w->col[ISO_TP_AN_COL_LEN]);
+		(void)fwrite(&w->data_len, sizeof(w->data_len), 1u,
+			     w->col[ISO_TP_AN_COL_OFF]);
+
+		if (fwrite(ind.data, 1u, ind.len, w->col[ISO_TP_AN_COL_DATA]) !=
+		    ind.len) {
+			w->error = true;
+		}
+
+		w->data_len += ind.len;
+		w->messages++;
+	}
+}
+
+/** Walk the whole capture, process frames of own shard */
+void *iso_tp_an_work(void *arg)
+{
+	struct iso_tp_an_worker *w = (struct iso_tp_an_worker *)arg;
+
+	struct iso_tp_config     cfg;
+	struct iso_tp_cap_replay rp;
+	struct iso_tp_can_frame  f;
+	enum iso_tp_event        ev;
+
+	uint64_t time_us = 0u;
+	uint64_t idle_us = 0u; /**< Time since the last frame of shard */
+	uint32_t delta;
+	uint32_t i;
+
+	iso_tp_init(&w->tp);
+	iso_tp_get_config(&w->tp, &cfg);
+	cfg.tx_dl       = 8u;
+	cfg.addr_format = iso_tp_an_extended ?
+			  (uint8_t)ISO_TP_ADDR_FORMAT_EXTENDED :
+			  (uint8_t)ISO_TP_ADDR_FORMAT_NORMAL;
+	iso_tp_set_config(&w->tp, &cfg);
+	(void)iso_tp_set_rx_buffer(&w->tp, w->pool, sizeof(w->pool));
+
+	if (iso_tp_step(&w->tp, 0u) != ISO_TP_EVENT_NONE) {
+		w->error = true;
+	}
+
+	(void)iso_tp_cap_replay_init(&rp, iso_tp_an_cap, iso_tp_an_cap_size,
+				     ISO_TP_CAP_FULL_SPEED);
+
+	while (!w->error && iso_tp_cap_read(&rp, &f, &delta)) {
+		time_us += delta;
+		idle_us += delta;
+
+		if (iso_tp_an_shard(f.id) != w->index) {
+			continue;
+		}
+
+		w->frames++;
+
+		(void)iso_tp_push_frame(&w->tp, &f);
+		ev = iso_tp_step_us(&w->tp, (idle_us > 0xFFFFFFFFu) ?
+				    0xFFFFFFFFu : (uint32_t)idle_us);
+		idle_us = 0u;
+
+		iso_tp_an_event(w, ev, f.id, time_us);
+
+		/* Timed out receptions are reported one per step */
+		for (i = 0u; (i < ISO_TP_MAX_SESSIONS) &&
+			     (ev != ISO_TP_EVENT_NONE); i++) {
+			ev = iso_tp_step_us(&w->tp, 0u);
+			iso_tp_an_event(w, ev, f.id, time_us);
+		}
+	}
+
+	if (rp.error) {
+		w->error = true;
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+/** Open shard files of worker */
+bool iso_tp_an_open(struct iso_tp_an_worker *w)
+{
+	bool result = true;
+
+	char path[4096];
+	uint32_t i;
+
+	for (i = 0u; i < (uint32_t)ISO_TP_AN_COLS; i++) {
+		iso_tp_an_path(path, sizeof(path), w, (enum iso_tp_an_col)i);
+
+		w->col[i] = fopen(path, "w+b");
+
+		if (w->col[i] == NULL) {
+			perror(path);
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+/** Concatenate shards into merged columns, offsets are rebased */
+bool iso_tp_an_merge(void)
+{
+	bool result = true;
+
+	FILE *out[ISO_TP_AN_COLS];
+	char path[4096];
+	uint8_t buf[65536];
+	uint64_t base = 0u;
+	uint64_t off;
+	size_t n;
+	uint32_t i;
+	uint32_t c;
+
+	for (c = 0u; c < (uint32_t)ISO_TP_AN_COLS; c++) {
+		iso_tp_an_path(path, sizeof(path), NULL, (enum iso_tp_an_col)c);
+
+		out[c] = fopen(path, "wb");
+
+		if (out[c] == NULL) {
+			perror(path);
+			result = false;
+		}
+	}
+
+	for (i = 0u; (i < iso_tp_an_n_workers) && result; i++) {
+		struct iso_tp_an_worker *w = &iso_tp_an_workers[i];
+
+		for (c = 0u; c < (uint32_t)ISO_TP_AN_COLS; c++) {
+			rewind(w->col[c]);
+		}
+
+		while (fread(&off, sizeof(off), 1u,
+			     w->col[ISO_TP_AN_COL_OFF]) == 1u) {
+			off += base;
+			(void)fwrite(&off, sizeof(off), 1u,
+				     out[ISO_TP_AN_COL_OFF]);
+		}
+
+		for (c = 0u; c < (uint32_t)ISO_TP_AN_COLS; c++) {
+			if (c == (uint32_t)ISO_TP_AN_COL_OFF) {
+				continue;
+			}
+
+			while ((n = fread(buf, 1u, sizeof(buf),
+					  w->col[c])) > 0u) {
+				(void)fwrite(buf, 1u, n, out[c]);
+			}
+		}
+
+		base += w->data_len;
+	}
+
+	for (c = 0u; c < (uint32_t)ISO_TP_AN_COLS; c++) {
+		if ((out[c] != NULL) && (fclose(out[c]) != 0)) {
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+/** Map capture, run workers and merge their output */
+int iso_tp_an_run(const char *cap_path)
+{
+	int result = 1;
+
+	struct stat st;
+	struct iso_tp_cap_replay rp;
+	void *map = MAP_FAILED;
+	int fd = open(cap_path, O_RDONLY);
+	uint32_t messages = 0u;
+	uint32_t failed = 0u;
+	uint32_t frames = 0u;
+	uint32_t started = 0u;
+	uint32_t i;
+	uint32_t c;
+
+	if ((fd < 0) || (fstat(fd, &st) != 0)) {
+		perror(cap_path);
+	} else if ((st.st_size == 0) ||
+		   (st.st_size > (off_t)ISO_TP_CAP_SIZE_MAX)) {
+		/* Longer recordings are split into captures */
+		(void)fprintf(stderr, "%s: empty or over 4 GiB\n", cap_path);
+	} else {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+			   fd, 0);
+	}
+
+	if (map != MAP_FAILED) {
+		(void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+		iso_tp_an_cap      = (const uint8_t *)map;
+		iso_tp_an_cap_size = (uint32_t)st.st_size;
+
+		if (!iso_tp_cap_replay_init(&rp, iso_tp_an_cap,
+					    iso_tp_an_cap_size,
+					    ISO_TP_CAP_FULL_SPEED)) {
+			(void)fprintf(stderr, "%s: not a capture\n",
+				      cap_path);
+		} else {
+			result = 0;
+		}
+	}
+
+	for (i = 0u; (i < iso_tp_an_n_workers) && (result == 0); i++) {
+		struct iso_tp_an_worker *w = &iso_tp_an_workers[i];
+
+		w->index = i;
+
+		if (!iso_tp_an_open(w) ||
+		    (pthread_create(&w->thread, NULL, iso_tp_an_work,
+				    w) != 0)) {
+			result = 1;
+		} else {
+			started++;
+		}
+	}
+
+	for (i = 0u; i < started; i++) {
+		struct iso_tp_an_worker *w = &iso_tp_an_workers[i];
+
+		(void)pthread_join(w->thread, NULL);
+
+		frames   += w->frames;
+		messages += w->messages;
+		failed   += w->failed;
+
+		if (w->error) {
+			(void)fprintf(stderr, "worker %u: capture or output "
+				      "error\n", (unsigned)i);
+			result = 1;
+		}
+	}
+
+	if ((result == 0) && iso_tp_an_merge()) {
+		(void)fprintf(stderr, "frames %u, messages %u, failed %u, "
+			      "workers %u\n", (unsigned)frames,
+			      (unsigned)messages, (unsigned)failed,
+			      (unsigned)started);
+	} else {
+		result = 1;
+	}
+
+	/* Shards are merged or useless */
+	for (i = 0u; i < iso_tp_an_n_workers; i++) {
+		struct iso_tp_an_worker *w = &iso_tp_an_workers[i];
+		char path[4096];
+
+		for (c = 0u; c < (uint32_t)ISO_TP_AN_COLS; c++) {
+			if (w->col[c] != NULL) {
+				(void)fclose(w->col[c]);
+
+				iso_tp_an_path(path, sizeof(path), w,
+					       (enum iso_tp_an_col)c);
+				(void)remove(path);
+			}
+		}
+	}
+
+	if (map != MAP_FAILED) {
+		(void)munmap(map, (size_t)st.st_size);
+	}
+
+	if (fd >= 0) {
+		(void)close(fd);
+	}
+
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	int result = 2;
+
+	long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	bool ok = true;
+
+	iso_tp_an_n_workers = (n_cpu > 0) ? (uint32_t)n_cpu : 1u;
+
+	while ((opt = getopt(argc, argv, "j:x")) != -1) {
+		if (opt == 'j') {
+			iso_tp_an_n_workers = (uint32_t)atoi(optarg);
+		} else if (opt == 'x') {
+			iso_tp_an_extended = true;
+		} else {
+			ok = false;
+		}
+	}
+
+	if (iso_tp_an_n_workers == 0u) {
+		iso_tp_an_n_workers = 1u;
+	} else if (iso_tp_an_n_workers > ISO_TP_AN_MAX_WORKERS) {
+		iso_tp_an_n_workers = ISO_TP_AN_MAX_WORKERS;
+	} else {}
+
+	if (!ok || ((argc - optind) != 2)) {
+		(void)fprintf(stderr, "usage: %s [-j workers] [-x] "
+			      "capture out_prefix\n", argv[0]);
+	} else {
+		iso_tp_an_prefix = argv[optind + 1];
+
+		result = iso_tp_an_run(argv[optind]);
+	}
+
+	return result;
+}
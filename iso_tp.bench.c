@@ -0,0 +1,753 @@
+/* Cycle count benchmarks, not part of tests
+ * Build with and without ISO_TP_LUT_DECODER to compare decoders,
+ * with ISO_TP_FIXED_TX_DL/RX_DL to compare with pinned configuration */
+/* Throughput bench needs concurrent receptions of up to 4095 bytes */
+#define ISO_TP_MAX_SESSIONS_LOG2 4u
+#define ISO_TP_POOL_BLOCK_SIZE   1024u
+
+#include "iso_tp.h"
+#include "iso_tp_simd.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "example_log.h"
+
+/******************************************************************************
+ * CYCLE COUNTER
+ *****************************************************************************/
+/* On MCU provide cycle counter before build, e.g. Cortex-M DWT:
+ * #define ISO_TP_BENCH_CYCLES_INIT() (DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk)
+ * #define ISO_TP_BENCH_CYCLES() ((uint64_t)DWT->CYCCNT) */
+#ifndef ISO_TP_BENCH_CYCLES_INIT
+#define ISO_TP_BENCH_CYCLES_INIT()
+#endif
+
+#ifndef ISO_TP_BENCH_CYCLES
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/** Read x86 time stamp counter */
+uint64_t iso_tp_bench_rdtsc(void)
+{
+	uint32_t lo;
+	uint32_t hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+	return ((uint64_t)hi << 32u) | (uint64_t)lo;
+}
+
+#define ISO_TP_BENCH_CYCLES() iso_tp_bench_rdtsc()
+#else
+/** Fallback: processor clock ticks, coarse */
+#define ISO_TP_BENCH_CYCLES() ((uint64_t)clock())
+#endif
+#endif
+
+#if defined(ISO_TP_LUT_DECODER) && defined(ISO_TP_FIXED_TX_DL)
+#define ISO_TP_BENCH_DECODER "lut,fixed"
+#elif defined(ISO_TP_LUT_DECODER)
+#define ISO_TP_BENCH_DECODER "lut"
+#elif defined(ISO_TP_FIXED_TX_DL)
+#define ISO_TP_BENCH_DECODER "cascade,fixed"
+#else
+#define ISO_TP_BENCH_DECODER "cascade"
+#endif
+
+#define ISO_TP_BENCH_ROUNDS 100000u
+
+/** Rounds of every WCET scenario */
+#define ISO_TP_BENCH_WCET_ROUNDS 2000u
+
+/** Worst case cycles per iso_tp_step allowed, bench fails above.
+ *  Host default, set per target (make bench WCET_MAX=...) */
+#ifndef ISO_TP_BENCH_WCET_MAX
+#define ISO_TP_BENCH_WCET_MAX 2000u
+#endif
+
+/** Max steps of single WCET scenario */
+#define ISO_TP_BENCH_MAX_STEPS 10u
+
+/** Max FF-to-completion latency samples per run */
+#define ISO_TP_BENCH_MAX_SAMPLES 4096u
+
+/** Log replays at max rate */
+#define ISO_TP_BENCH_LOG_ROUNDS 100u
+
+/** Messages sent by every synthetic transfer */
+#define ISO_TP_BENCH_SYNTH_MSGS 32u
+
+/** Max concurrent synthetic transfers (N ECUs x M transfers) */
+#define ISO_TP_BENCH_MAX_XFERS 8u
+
+/** Frame time of classic CAN at 500 kbit/s (8 bytes, no stuffing) */
+#define ISO_TP_BENCH_FRAME_US 222u
+
+/******************************************************************************
+ * BENCHMARKS
+ *****************************************************************************/
+/** Frames of every N_PCItype, including invalid ones */
+const struct iso_tp_can_frame iso_tp_bench_mix[] = {
+	{0x7BBu, 8u, {0x02u, 0x61u, 0x01u, 0u, 0u, 0u, 0u, 0u}}, /* SF    */
+	{0x7BBu, 8u, {0x10u, 0x29u, 0x61u, 0x01u, 1u, 2u, 3u, 4u}}, /* FF */
+	{0x7BBu, 8u, {0x21u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}},       /* CF    */
+	{0x79Bu, 3u, {0x30u, 0x00u, 0x00u}},                     /* FC    */
+	{0x7BBu, 8u, {0x40u, 0u, 0u, 0u, 0u, 0u, 0u, 0u}},       /* Bad   */
+	{0x7BBu, 1u, {0x10u}},                                   /* Short */
+	{0x7BBu, 4u, {0x08u, 1u, 2u, 3u}}                        /* SF_DL */
+};
+
+/** Time single decoder call per frame type */
+void iso_tp_bench_decode(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	uint32_t i;
+	uint8_t  j;
+
+	static uint8_t buf[64];
+
+	const uint8_t n = (uint8_t)(sizeof(iso_tp_bench_mix) /
+				    sizeof(iso_tp_bench_mix[0]));
+
+	uint64_t min[sizeof(iso_tp_bench_mix) / sizeof(iso_tp_bench_mix[0])];
+	uint64_t sum[sizeof(iso_tp_bench_mix) / sizeof(iso_tp_bench_mix[0])];
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	(void)iso_tp_set_rx_buffer(&tp, buf, sizeof(buf));
+	(void)iso_tp_step(&tp, 0u);
+
+	for (j = 0u; j < n; j++) {
+		min[j] = ~(uint64_t)0u;
+		sum[j] = 0u;
+	}
+
+	for (i = 0u; i < ISO_TP_BENCH_ROUNDS; i++) {
+		for (j = 0u; j < n; j++) {
+			const struct iso_tp_can_frame *f = &iso_tp_bench_mix[j];
+			uint64_t t0;
+			uint64_t t;
+
+			t0 = ISO_TP_BENCH_CYCLES();
+			_iso_tp_decode(&tp, f->id, f->len, f->data);
+			t = ISO_TP_BENCH_CYCLES() - t0;
+
+			sum[j] += t;
+			if (t < min[j]) {
+				min[j] = t;
+			}
+		}
+	}
+
+	for (j = 0u; j < n; j++) {
+		printf("decode[%s] frame %u: min %lu mean %lu cycles\n",
+		       ISO_TP_BENCH_DECODER, (unsigned)j,
+		       (unsigned long)min[j],
+		       (unsigned long)(sum[j] / ISO_TP_BENCH_ROUNDS));
+	}
+}
+
+/** Frames of classification batch (mix repeated) */
+#define ISO_TP_BENCH_BATCH 256u
+
+/** Time classification of batch, vector path against scalar one */
+void iso_tp_bench_classify(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_frame_view view;
+	uint32_t i;
+	uint16_t j;
+
+	static struct iso_tp_can_frame frames[ISO_TP_BENCH_BATCH];
+	static uint8_t types[ISO_TP_BENCH_BATCH];
+
+	const uint16_t n = (uint16_t)(sizeof(iso_tp_bench_mix) /
+				      sizeof(iso_tp_bench_mix[0]));
+
+	uint64_t min_vec = ~(uint64_t)0u;
+	uint64_t min_sca = ~(uint64_t)0u;
+	uint16_t valid   = 0u;
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	(void)iso_tp_step(&tp, 0u);
+
+	/* Types are shuffled, so branches of scalar path are not learned */
+	for (j = 0u; j < ISO_TP_BENCH_BATCH; j++) {
+		frames[j] = iso_tp_bench_mix[((j * 2654435761u) >> 13u) % n];
+	}
+
+	iso_tp_frame_view_init(&view, frames, ISO_TP_BENCH_BATCH);
+
+	for (i = 0u; i < (ISO_TP_BENCH_ROUNDS / 100u); i++) {
+		uint64_t t0;
+		uint64_t t;
+
+		t0    = ISO_TP_BENCH_CYCLES();
+		valid = iso_tp_simd_classify(&tp, &view, types);
+		t     = ISO_TP_BENCH_CYCLES() - t0;
+
+		if (t < min_vec) {
+			min_vec = t;
+		}
+
+		t0 = ISO_TP_BENCH_CYCLES();
+		(void)_iso_tp_simd_classify_scalar(0u, &view, 0u,
+						   ISO_TP_BENCH_BATCH, types);
+		t = ISO_TP_BENCH_CYCLES() - t0;
+
+		if (t < min_sca) {
+			min_sca = t;
+		}
+	}
+
+	printf("classify[%s] %u frames (%u valid): min %lu cycles, "
+	       "scalar %lu cycles\n", ISO_TP_SIMD_PATH,
+	       (unsigned)ISO_TP_BENCH_BATCH, (unsigned)valid,
+	       (unsigned long)min_vec, (unsigned long)min_sca);
+}
+
+/** Sequence of steps, each step is preceded by frame push.
+ *  Frame of zero length is not pushed (timer only step). */
+struct iso_tp_bench_scenario {
+	const char *name;
+	bool     tx;        /**< Start multiframe transmission first */
+	uint32_t delta_ms;  /**< Time passed on every step */
+	uint8_t  n_steps;
+	struct iso_tp_can_frame steps[ISO_TP_BENCH_MAX_STEPS];
+};
+
+/** Every N_PCItype and error path */
+const struct iso_tp_bench_scenario iso_tp_bench_scenarios[] = {
+	{"idle", false, 0u, 1u, {
+		{0u, 0u, {0u}}
+	}},
+	{"sf", false, 0u, 1u, {
+		{0x7BBu, 8u, {0x07u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"sf_bad_sf_dl", false, 0u, 1u, {
+		{0x7BBu, 8u, {0x00u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"reserved_pci", false, 0u, 1u, {
+		{0x7BBu, 8u, {0x40u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"short_frame", false, 0u, 1u, {
+		{0x7BBu, 1u, {0x10u}}
+	}},
+	{"ff_cf", false, 0u, 4u, {
+		{0x7BBu, 8u, {0x10u, 0x14u, 1u, 2u, 3u, 4u, 5u, 6u}},
+		{0x7BBu, 8u, {0x21u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}},
+		{0x7BBu, 8u, {0x22u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}},
+		{0x7BBu, 8u, {0x23u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"ff_bad_ff_dl", false, 0u, 1u, {
+		{0x7BBu, 8u, {0x10u, 0x07u, 1u, 2u, 3u, 4u, 5u, 6u}}
+	}},
+	{"cf_wrong_sn", false, 0u, 2u, {
+		{0x7BBu, 8u, {0x10u, 0x14u, 1u, 2u, 3u, 4u, 5u, 6u}},
+		{0x7BBu, 8u, {0x25u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"cf_unexpected", false, 0u, 1u, {
+		{0x7BBu, 8u, {0x21u, 1u, 2u, 3u, 4u, 5u, 6u, 7u}}
+	}},
+	{"n_cr_timeout", false, 2000u, 2u, {
+		{0x7BBu, 8u, {0x10u, 0x14u, 1u, 2u, 3u, 4u, 5u, 6u}},
+		{0u, 0u, {0u}}
+	}},
+	{"fc_cts", true, 0u, 4u, {
+		{0x7BBu, 8u, {0x30u, 0u, 0u, 0u, 0u, 0u, 0u, 0u}},
+		{0u, 0u, {0u}},
+		{0u, 0u, {0u}},
+		{0u, 0u, {0u}}
+	}},
+	{"fc_wait", true, 0u, 1u, {
+		{0x7BBu, 8u, {0x31u, 0u, 0u, 0u, 0u, 0u, 0u, 0u}}
+	}},
+	{"fc_ovflw", true, 0u, 1u, {
+		{0x7BBu, 8u, {0x32u, 0u, 0u, 0u, 0u, 0u, 0u, 0u}}
+	}},
+	{"fc_unknown", false, 0u, 1u, {
+		{0x7BCu, 8u, {0x30u, 0u, 0u, 0u, 0u, 0u, 0u, 0u}}
+	}},
+	{"n_bs_timeout", true, 2000u, 1u, {
+		{0u, 0u, {0u}}
+	}}
+};
+
+/** Fresh instance for every round, not measured */
+void iso_tp_bench_setup(struct iso_tp *tp, bool tx)
+{
+	struct iso_tp_config cfg;
+	struct iso_tp_can_frame f;
+
+	static uint8_t buf[64];
+	static const uint8_t msg[20] = {0u};
+
+	iso_tp_init(tp);
+	iso_tp_get_config(tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(tp, &cfg);
+	(void)iso_tp_set_rx_buffer(tp, buf, sizeof(buf));
+	(void)iso_tp_bind_n_ai(tp, 0x7BBu, 0x79Bu);
+	(void)iso_tp_step(tp, 0u);
+
+	if (tx) {
+		(void)iso_tp_send(tp, 0x79Bu, msg, sizeof(msg));
+		(void)iso_tp_pop_frame(tp, &f);
+		(void)iso_tp_step(tp, 0u);
+	}
+}
+
+/** Samples of every step of WCET scenario, by step and round */
+uint64_t iso_tp_bench_samples[ISO_TP_BENCH_MAX_STEPS]
+			     [ISO_TP_BENCH_WCET_ROUNDS];
+
+/** Percentile of steps checked against threshold, per mille. The rest
+ *  of rounds absorbs host noise (preemption, interrupts) */
+#define ISO_TP_BENCH_WCET_PERMILLE 999u
+
+/** Runs of scenario over threshold before bench fails, host noise may
+ *  spoil a single run */
+#define ISO_TP_BENCH_WCET_TRIES 3u
+
+/** Samples in ascending order (shell sort, no callbacks) */
+void iso_tp_bench_sort(uint64_t *a, uint32_t n)
+{
+	uint32_t gap;
+	uint32_t i;
+	uint32_t j;
+
+	for (gap = n / 2u; gap > 0u; gap /= 2u) {
+		for (i = gap; i < n; i++) {
+			uint64_t v = a[i];
+
+			for (j = i; (j >= gap) && (a[j - gap] > v); j -= gap) {
+				a[j] = a[j - gap];
+			}
+
+			a[j] = v;
+		}
+	}
+}
+
+/** Run WCET scenario, min/max/mean cycles per iso_tp_step are printed.
+ *  Returns worst case: the worst step, at ISO_TP_BENCH_WCET_PERMILLE of
+ *  its rounds */
+uint64_t iso_tp_bench_wcet_run(const struct iso_tp_bench_scenario *sc)
+{
+	struct iso_tp tp;
+	struct iso_tp_can_frame f;
+	uint8_t j;
+	uint32_t r;
+
+	uint64_t min  = ~(uint64_t)0u;
+	uint64_t max  = 0u;
+	uint64_t sum  = 0u;
+	uint64_t best = 0u; /**< The worst step, taking its best round */
+	uint64_t wcet = 0u;
+
+	for (r = 0u; r < ISO_TP_BENCH_WCET_ROUNDS; r++) {
+		iso_tp_bench_setup(&tp, sc->tx);
+
+		for (j = 0u; j < sc->n_steps; j++) {
+			uint64_t t0;
+			uint64_t t;
+
+			if (sc->steps[j].len > 0u) {
+				f = sc->steps[j];
+				(void)iso_tp_push_frame(&tp, &f);
+			}
+
+			t0 = ISO_TP_BENCH_CYCLES();
+			(void)iso_tp_step(&tp, sc->delta_ms);
+			t = ISO_TP_BENCH_CYCLES() - t0;
+
+			/* Drain transmitted frames (CF, FC) */
+			while (iso_tp_pop_frame(&tp, &f)) {
+			}
+
+			sum += t;
+			min  = (t < min) ? t : min;
+			max  = (t > max) ? t : max;
+			iso_tp_bench_samples[j][r] = t;
+		}
+	}
+
+	for (j = 0u; j < sc->n_steps; j++) {
+		uint64_t *a = iso_tp_bench_samples[j];
+
+		iso_tp_bench_sort(a, ISO_TP_BENCH_WCET_ROUNDS);
+
+		best = (a[0] > best) ? a[0] : best;
+		r    = (ISO_TP_BENCH_WCET_ROUNDS * ISO_TP_BENCH_WCET_PERMILLE) /
+		       1000u;
+		wcet = (a[r] > wcet) ? a[r] : wcet;
+	}
+
+	printf("step[%s] %-14s min %4lu max %6lu mean %4lu best %4lu "
+	       "wcet %4lu cycles%s\n",
+	       ISO_TP_BENCH_DECODER, sc->name, (unsigned long)min,
+	       (unsigned long)max,
+	       (unsigned long)(sum / ((uint64_t)sc->n_steps *
+				      ISO_TP_BENCH_WCET_ROUNDS)),
+	       (unsigned long)best, (unsigned long)wcet,
+	       (wcet > ISO_TP_BENCH_WCET_MAX) ? " REGRESSION" : "");
+
+	return wcet;
+}
+
+/** Worst case cycles per iso_tp_step of every scenario (see
+ *  iso_tp_bench_wcet_run). Scenario over threshold is run again, up to
+ *  ISO_TP_BENCH_WCET_TRIES times. Returns false if threshold is exceeded
+ */
+bool iso_tp_bench_wcet(void)
+{
+	bool result = true;
+
+	uint8_t i;
+	uint8_t k;
+
+	const uint8_t n = (uint8_t)(sizeof(iso_tp_bench_scenarios) /
+				    sizeof(iso_tp_bench_scenarios[0]));
+
+	for (i = 0u; i < n; i++) {
+		bool over = true;
+
+		for (k = 0u; (k < ISO_TP_BENCH_WCET_TRIES) && over; k++) {
+			over = (iso_tp_bench_wcet_run(
+					&iso_tp_bench_scenarios[i]) >
+				ISO_TP_BENCH_WCET_MAX);
+		}
+
+		if (over) {
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+/** Throughput and latency of single run */
+struct iso_tp_bench_stats {
+	uint32_t frames;
+	uint32_t msgs;
+	uint64_t bytes;   /**< Indicated payload */
+	uint64_t cycles;  /**< Spent in push and step */
+	uint64_t sim_us;  /**< Bus time passed, 0 - max rate */
+
+	uint64_t start[256]; /**< FF cycle stamp, by low byte of CAN ID */
+	uint32_t n_lat;
+	uint64_t lat[ISO_TP_BENCH_MAX_SAMPLES];
+};
+
+struct iso_tp_bench_stats iso_tp_bench_st;
+
+/** Cycles of one second, calibrated by clock() */
+uint64_t iso_tp_bench_cps(void)
+{
+	clock_t  c0 = clock();
+	uint64_t t0 = ISO_TP_BENCH_CYCLES();
+
+	while ((clock() - c0) < (CLOCKS_PER_SEC / 10)) {
+	}
+
+	return (ISO_TP_BENCH_CYCLES() - t0) * 10u;
+}
+
+/** Fresh receiver, listens to everyone, reassembles everything */
+void iso_tp_bench_rx_setup(struct iso_tp *tp)
+{
+	struct iso_tp_config cfg;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE * ISO_TP_POOL_MAX_BLOCKS];
+
+	iso_tp_init(tp);
+	iso_tp_get_config(tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(tp, &cfg);
+	(void)iso_tp_set_rx_buffer(tp, pool, sizeof(pool));
+	(void)iso_tp_step(tp, 0u);
+
+	memset(&iso_tp_bench_st, 0, sizeof(iso_tp_bench_st));
+}
+
+/** Handle indication: count payload, take latency sample */
+void iso_tp_bench_ind(struct iso_tp *tp, uint64_t now)
+{
+	struct iso_tp_bench_stats *st = &iso_tp_bench_st;
+	struct iso_tp_n_usdata ind;
+
+	if (iso_tp_get_n_usdata(tp, &ind) &&
+	    (ind.n_result == ISO_TP_N_RESULT_N_OK)) {
+		st->msgs++;
+		st->bytes += ind.len;
+
+		if (st->n_lat < ISO_TP_BENCH_MAX_SAMPLES) {
+			st->lat[st->n_lat] = now - st->start[ind.id & 0xFFu];
+			st->n_lat++;
+		}
+	}
+}
+
+/** Feed one frame (NULL - timer only step) */
+void iso_tp_bench_feed(struct iso_tp *tp, struct iso_tp_can_frame *f,
+		       uint32_t delta_us)
+{
+	struct iso_tp_bench_stats *st = &iso_tp_bench_st;
+	struct iso_tp_can_frame out;
+	enum iso_tp_event ev;
+	uint64_t t0 = ISO_TP_BENCH_CYCLES();
+	uint64_t t;
+
+	if (f != NULL) {
+		uint8_t pcitype = (uint8_t)(f->data[0] >> 4u);
+
+		if (pcitype <= (uint8_t)ISO_TP_N_PCITYPE_FF) {
+			st->start[f->id & 0xFFu] = t0;
+		}
+
+		(void)iso_tp_push_frame(tp, f);
+		st->frames++;
+	}
+
+	ev = iso_tp_step_us(tp, delta_us);
+	t  = ISO_TP_BENCH_CYCLES();
+
+	st->cycles += t - t0;
+	st->sim_us += delta_us;
+
+	if (ev == ISO_TP_EVENT_N_USDATA_IND) {
+		iso_tp_bench_ind(tp, t);
+	}
+
+	/* Receiver may answer (FC), nobody cares */
+	while (iso_tp_pop_frame(tp, &out)) {
+	}
+}
+
+/** Report indications left after last frame */
+void iso_tp_bench_drain(struct iso_tp *tp)
+{
+	uint8_t i;
+
+	for (i = 0u; i < ISO_TP_MAX_SESSIONS; i++) {
+		iso_tp_bench_feed(tp, NULL, 0u);
+	}
+}
+
+/** Print frames/s, bytes/s, latency percentiles and CPU load */
+void iso_tp_bench_report(const char *name, uint64_t cps)
+{
+	struct iso_tp_bench_stats *st = &iso_tp_bench_st;
+	double secs = (double)st->cycles / (double)cps;
+	double us   = 1000000.0 / (double)cps;
+	uint32_t n  = st->n_lat;
+
+	iso_tp_bench_sort(st->lat, n);
+
+	printf("%-20s %6lu frames %5lu msgs %9.0f frames/s %10.0f bytes/s\n",
+	       name, (unsigned long)st->frames, (unsigned long)st->msgs,
+	       (double)st->frames / secs, (double)st->bytes / secs);
+
+	if (n > 0u) {
+		printf("%-20s latency us p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+		       "", (double)st->lat[n / 2u] * us,
+		       (double)st->lat[(n * 9u) / 10u] * us,
+		       (double)st->lat[(n * 99u) / 100u] * us,
+		       (double)st->lat[n - 1u] * us);
+	}
+
+	if (st->sim_us > 0u) {
+		printf("%-20s bus time %.3f s, CPU load %.6f%% per bus\n", "",
+		       (double)st->sim_us / 1000000.0,
+		       (secs * 100000000.0) / (double)st->sim_us);
+	}
+}
+
+/** Replay captured log, at max rate or with its timestamps */
+void iso_tp_bench_log(struct iso_tp *tp, bool real_time, uint64_t cps)
+{
+	const uint32_t n = (uint32_t)(sizeof(example_log) /
+				      sizeof(example_log[0]));
+	const uint32_t rounds = real_time ? 1u : ISO_TP_BENCH_LOG_ROUNDS;
+	uint32_t r;
+	uint32_t i;
+
+	iso_tp_bench_rx_setup(tp);
+
+	for (r = 0u; r < rounds; r++) {
+		for (i = 0u; i < n; i++) {
+			struct iso_tp_can_frame f;
+			uint32_t delta_us = 0u;
+
+			/* Timestamps are in seconds, despite the name */
+			if (real_time && (i > 0u)) {
+				delta_us = (uint32_t)((example_log[i].time_us -
+						example_log[i - 1u].time_us) *
+						1000000.0);
+			}
+
+			f.id  = example_log[i].id;
+			f.len = example_log[i].dlc;
+			memcpy(f.data, example_log[i].data, f.len);
+
+			iso_tp_bench_feed(tp, &f, delta_us);
+		}
+	}
+
+	iso_tp_bench_drain(tp);
+	iso_tp_bench_report(real_time ? "log real-time" : "log max-rate", cps);
+}
+
+/** State of one synthetic transfer */
+struct iso_tp_bench_xfer {
+	uint32_t size;
+	uint32_t offset;
+	uint8_t  sn;
+	uint8_t  msgs; /**< Messages sent */
+};
+
+/** Next frame of transfer, sizes vary from 1 up to max_size.
+ *  Returns false if transfer has sent all its messages */
+bool iso_tp_bench_xfer_next(struct iso_tp_bench_xfer *x, uint32_t id,
+			    uint32_t max_size, struct iso_tp_can_frame *f)
+{
+	bool result = false;
+
+	uint32_t n;
+
+	if (x->msgs < ISO_TP_BENCH_SYNTH_MSGS) {
+		if (x->offset == 0u) {
+			x->size = 1u + (((uint32_t)x->msgs * 1499u + id) %
+					max_size);
+		}
+
+		f->id  = id;
+		f->len = 8u;
+		memset(f->data, 0xA5, sizeof(f->data));
+
+		if ((x->offset == 0u) && (x->size <= 7u)) {
+			f->data[0] = (uint8_t)x->size;
+			x->offset  = x->size;
+		} else if (x->offset == 0u) {
+			f->data[0] = (uint8_t)(0x10u | (x->size >> 8u));
+			f->data[1] = (uint8_t)(x->size & 0xFFu);
+			x->offset  = 6u;
+			x->sn      = 1u;
+		} else {
+			n = x->size - x->offset;
+			f->data[0] = (uint8_t)(0x20u | x->sn);
+			x->offset += (n > 7u) ? 7u : n;
+			x->sn      = (uint8_t)((x->sn + 1u) & 0x0Fu);
+		}
+
+		if (x->offset >= x->size) {
+			x->offset = 0u;
+			x->msgs++;
+		}
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** N ECUs x M concurrent transfers, frames are interleaved round-robin.
+ *  Real-time rate steps by bus frame time. */
+void iso_tp_bench_synth(struct iso_tp *tp, uint8_t n_ecu, uint8_t m,
+			uint32_t max_size, bool real_time, uint64_t cps)
+{
+	struct iso_tp_bench_xfer x[ISO_TP_BENCH_MAX_XFERS];
+	struct iso_tp_can_frame f;
+	char name[32];
+	uint8_t n_xfers = (uint8_t)(n_ecu * m);
+	uint8_t active  = n_xfers;
+	uint8_t t;
+
+	iso_tp_bench_rx_setup(tp);
+	memset(x, 0, sizeof(x));
+
+	while (active > 0u) {
+		active = 0u;
+
+		for (t = 0u; t < n_xfers; t++) {
+			/* ECU e answers on 0x600 + e * 0x10 + transfer */
+			uint32_t id = 0x600u + ((uint32_t)(t / m) * 0x10u) +
+				      (uint32_t)(t % m);
+
+			if (iso_tp_bench_xfer_next(&x[t], id, max_size, &f)) {
+				iso_tp_bench_feed(tp, &f, real_time ?
+						  ISO_TP_BENCH_FRAME_US : 0u);
+				active++;
+			}
+		}
+	}
+
+	iso_tp_bench_drain(tp);
+
+	sprintf(name, "%ux%u<=%lu %s", (unsigned)n_ecu, (unsigned)m,
+		(unsigned long)max_size, real_time ? "rt" : "max");
+	iso_tp_bench_report(name, cps);
+}
+
+/** Throughput and latency: log replay and synthetic load */
+void iso_tp_bench_throughput(void)
+{
+	struct iso_tp tp;
+	uint64_t cps = iso_tp_bench_cps();
+	uint8_t i;
+
+	/* N ECUs, M transfers each, max message size */
+	const uint32_t loads[][3] = {
+		{1u, 1u, 4095u},
+		{4u, 2u, 4095u},
+		{8u, 1u, 64u}
+	};
+
+	printf("throughput[%s] %.0f cycles/s\n", ISO_TP_BENCH_DECODER,
+	       (double)cps);
+
+	iso_tp_bench_log(&tp, false, cps);
+	iso_tp_bench_log(&tp, true, cps);
+
+	for (i = 0u; i < (uint8_t)(sizeof(loads) / sizeof(loads[0])); i++) {
+		iso_tp_bench_synth(&tp, (uint8_t)loads[i][0],
+				   (uint8_t)loads[i][1], loads[i][2],
+				   false, cps);
+		iso_tp_bench_synth(&tp, (uint8_t)loads[i][0],
+				   (uint8_t)loads[i][1], loads[i][2],
+				   true, cps);
+	}
+}
+
+int main(void)
+{
+	int result = 0;
+
+	ISO_TP_BENCH_CYCLES_INIT();
+
+	printf("ram: instance %lu bytes, session %lu bytes (budget %lu), "
+	       "%u sessions %lu bytes\n",
+	       (unsigned long)sizeof(struct iso_tp),
+	       (unsigned long)ISO_TP_SESSION_SIZE,
+	       (unsigned long)ISO_TP_SESSION_BUDGET,
+	       (unsigned)ISO_TP_MAX_SESSIONS,
+	       (unsigned long)ISO_TP_SESSIONS_SIZE);
+
+	iso_tp_bench_decode();
+	iso_tp_bench_classify();
+	iso_tp_bench_throughput();
+
+	if (!iso_tp_bench_wcet()) {
+		printf("WCET exceeds %lu cycles\n",
+		       (unsigned long)ISO_TP_BENCH_WCET_MAX);
+		result = 1;
+	}
+
+	return result;
+}
@@ -41,13 +41,240 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h> /* for offsetof */
 #include <string.h> /* for memcpy */
 
 /******************************************************************************
  * ISO-TP DEFINITIONS
  *****************************************************************************/
-#define ISO_TP_MAX_CAN_DL 8u /**< Maximum CAN dlc allowed
+#ifndef ISO_TP_MAX_CAN_DL
+#define ISO_TP_MAX_CAN_DL 8u /**< Maximum CAN dlc allowed, 8 for CAN2.0,
+				64 for CAN FD. May be overriden before include.
 				@note Not explicitly stated in standard */
+#endif
+
+/* ISO_TP_FIXED_TX_DL and ISO_TP_FIXED_RX_DL may be defined before include
+ * to pin configuration at build time. Matching fields of struct
+ * iso_tp_config are overwritten by the first step, paths of other values
+ * are folded away by compiler. @note Not standard */
+#ifdef ISO_TP_FIXED_TX_DL
+#define _ISO_TP_TX_DL(self) ((uint8_t)ISO_TP_FIXED_TX_DL)
+#else
+#define _ISO_TP_TX_DL(self) ((self)->_cfg.tx_dl)
+#endif
+
+#ifdef ISO_TP_FIXED_RX_DL
+#define _ISO_TP_RX_DL(self) ((uint8_t)ISO_TP_FIXED_RX_DL)
+#else
+#define _ISO_TP_RX_DL(self) ((self)->_cfg.rx_dl)
+#endif
+
+/* ISO_TP_FIXED_ADDRESSING pins enum iso_tp_addr_format the same way.
+ * Normal addressing then has constant N_PCI offset of 0 */
+#ifdef ISO_TP_FIXED_ADDRESSING
+#define _ISO_TP_ADDR_FORMAT(self) ((uint8_t)ISO_TP_FIXED_ADDRESSING)
+#define _ISO_TP_PCI_OFFSET(self) \
+	((ISO_TP_FIXED_ADDRESSING == ISO_TP_ADDR_FORMAT_NORMAL) ? 0u : 1u)
+#else
+#define _ISO_TP_ADDR_FORMAT(self) ((self)->_cfg.addr_format)
+#define _ISO_TP_PCI_OFFSET(self) ((self)->_pci_offset)
+#endif
+
+/** Received frame of can_dl fits pinned RX_DL. Frames of larger CAN_DL
+ *  are rejected like messages of larger RX_DL, so SF is checked too.
+ *  Constant true for runtime RX_DL. @note Not standard */
+#ifdef ISO_TP_FIXED_RX_DL
+#define _ISO_TP_RX_CAN_DL_OK(can_dl) ((can_dl) <= ISO_TP_FIXED_RX_DL)
+#define _ISO_TP_MAX_RX_DL ISO_TP_FIXED_RX_DL
+#else
+#define _ISO_TP_RX_CAN_DL_OK(can_dl) (true)
+#define _ISO_TP_MAX_RX_DL ISO_TP_MAX_CAN_DL
+#endif
+
+/** Received frame of can_dl is CAN FD frame. Constant false for CAN2.0
+ *  builds (ISO_TP_MAX_CAN_DL of 8) and pinned RX_DL of 8, longer frames
+ *  are invalid there anyway. @note Not standard */
+#define _ISO_TP_FD_FRAME(can_dl) ((_ISO_TP_MAX_RX_DL > 8u) && ((can_dl) > 8u))
+
+/* ISO_TP_LUT_DECODER may be defined before include to select table driven
+ * N_PCI decoder with branch-free validity checks, instead of switch and
+ * if/else cascades. Behaviour is the same. @note Not standard */
+
+#ifndef ISO_TP_MAX_SESSIONS_LOG2
+#define ISO_TP_MAX_SESSIONS_LOG2 3u /**< log2 of the session table capacity.
+					 May be overriden before include.
+					 @note Not standard */
+#endif
+
+/** Maximum number of concurrent multiframe receptions (one per CAN ID).
+ *  @note Not standard */
+#define ISO_TP_MAX_SESSIONS (1u << ISO_TP_MAX_SESSIONS_LOG2)
+
+/* Sizes of optional members of session */
+#ifdef ISO_TP_STATS
+#define _ISO_TP_SESSION_STATS_SIZE 4u
+#else
+#define _ISO_TP_SESSION_STATS_SIZE 0u
+#endif
+
+#ifdef ISO_TP_CRC32
+#define _ISO_TP_SESSION_CRC32_SIZE 4u
+#else
+#define _ISO_TP_SESSION_CRC32_SIZE 0u
+#endif
+
+#ifndef ISO_TP_SESSION_BUDGET
+/** Max bytes of RAM per session, checked at compile time. Optional members
+ *  (see ISO_TP_STATS, ISO_TP_CRC32) add to it.
+ *  May be overriden before include. @note Not standard */
+#define ISO_TP_SESSION_BUDGET (64u + _ISO_TP_SESSION_STATS_SIZE + \
+			       _ISO_TP_SESSION_CRC32_SIZE)
+#endif
+
+#ifndef ISO_TP_POOL_BLOCK_SIZE
+#define ISO_TP_POOL_BLOCK_SIZE 64u /**< Reassembly pool block size in bytes.
+					May be overriden before include.
+					@note Not standard */
+#endif
+
+/** Maximum number of reassembly pool blocks (bits in free bitmap).
+ *  @note Not standard */
+#define ISO_TP_POOL_MAX_BLOCKS 32u
+
+#ifndef ISO_TP_MAX_N_AI
+#define ISO_TP_MAX_N_AI 4u /**< Maximum number of N_AI bindings.
+				May be overriden before include.
+				@note Not standard */
+#endif
+
+#ifndef ISO_TP_FILTER_EXT_LOG2
+#define ISO_TP_FILTER_EXT_LOG2 4u /**< log2 of acceptance filter hash table
+				       capacity for exact 29-bit CAN IDs.
+				       May be overriden before include.
+				       @note Not standard */
+#endif
+
+/** Capacity of acceptance filter hash table @note Not standard */
+#define ISO_TP_FILTER_EXT_LEN (1u << ISO_TP_FILTER_EXT_LOG2)
+
+#ifndef ISO_TP_MAX_RULES_LOG2
+#define ISO_TP_MAX_RULES_LOG2 3u /**< log2 of max number of rewrite rules.
+				      May be overriden before include.
+				      @note Not standard */
+#endif
+
+/** Maximum number of rewrite rules @note Not standard */
+#define ISO_TP_MAX_RULES (1u << ISO_TP_MAX_RULES_LOG2)
+
+#ifndef ISO_TP_RULE_PREFIX_LEN
+#define ISO_TP_RULE_PREFIX_LEN 4u /**< Max length of request payload prefix
+				       of rewrite rule.
+				       May be overriden before include.
+				       @note Not standard */
+#endif
+
+/** Compile time assertion (C89 compatible) @note Not standard */
+#define ISO_TP_STATIC_ASSERT(name, cond) typedef char name[(cond) ? 1 : -1]
+
+#ifndef ISO_TP_QUEUE_LEN_LOG2
+#define ISO_TP_QUEUE_LEN_LOG2 4u /**< log2 of RX/TX frame queue capacity.
+				      May be overriden before include.
+				      @note Not standard */
+#endif
+
+/** Capacity of RX and TX frame queues @note Not standard */
+#define ISO_TP_QUEUE_LEN (1u << ISO_TP_QUEUE_LEN_LOG2)
+
+/** Sink of stream doesn't limit automatic FC (see iso_tp_set_backpressure)
+ *  @note Not standard */
+#define ISO_TP_BACKPRESSURE_OFF 0xFFu
+
+#ifndef ISO_TP_SPSC_BARRIER
+#ifdef __GNUC__
+/** Orders frame slot access against queue index update.
+ *  This default is only a compiler barrier, which is enough for
+ *  ISR <-> main loop on a single core. Define it as a real memory fence
+ *  before include if producer and consumer run on different cores.
+ *  @note Not standard */
+#define ISO_TP_SPSC_BARRIER() __asm__ __volatile__("" : : : "memory")
+#else
+#define ISO_TP_SPSC_BARRIER()
+#endif
+#endif
+
+/* ISO_TP_QUEUE_CACHE_LINE may be defined before include (cache line size,
+ * bytes) if producer and consumer of queues run on different cores, so
+ * head and tail are never on the same line. @note Not standard */
+
+/* ISO_TP_STATS may be defined before include to count frames, rejects,
+ * drops and timeouts (see iso_tp_get_stats) and to trace steps into a ring
+ * (see iso_tp_trace_pop). Otherwise counting compiles to nothing.
+ * @note Not standard */
+#ifdef ISO_TP_STATS
+#define ISO_TP_STAT_INC(self, counter) ((self)->_stats.counter++)
+#define ISO_TP_SESSION_STAT_INC(s, counter) ((s)->stats.counter++)
+#else
+#define ISO_TP_STAT_INC(self, counter) ((void)0)
+#define ISO_TP_SESSION_STAT_INC(s, counter) ((void)0)
+#endif
+
+/* ISO_TP_CRC32 may be defined before include to compute CRC-32 of every
+ * received message as its segments (N_Data of SF, FF and CF) are accepted,
+ * so content is known with indication (see struct iso_tp_n_usdata) with no
+ * extra pass over reassembled or streamed message. Data is hashed as
+ * received, edits made to it later are not. @note Not standard */
+
+#ifndef ISO_TP_TRACE_LEN_LOG2
+#define ISO_TP_TRACE_LEN_LOG2 5u /**< log2 of trace ring capacity.
+				      May be overriden before include.
+				      @note Not standard */
+#endif
+
+/** Capacity of trace ring (see ISO_TP_STATS) @note Not standard */
+#define ISO_TP_TRACE_LEN (1u << ISO_TP_TRACE_LEN_LOG2)
+
+/* Hash index is taken from the upper bits of a 32-bit product */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_sessions_log2,
+		     (ISO_TP_MAX_SESSIONS_LOG2 >= 1u) &&
+		     (ISO_TP_MAX_SESSIONS_LOG2 <= 8u));
+
+/* Same hashing as session table */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_filter_ext_log2,
+		     (ISO_TP_FILTER_EXT_LOG2 >= 1u) &&
+		     (ISO_TP_FILTER_EXT_LOG2 <= 8u));
+
+/* Rule hash tables are twice as big as rule table, indices fit 8 bits */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_rules_log2,
+		     (ISO_TP_MAX_RULES_LOG2 >= 1u) &&
+		     (ISO_TP_MAX_RULES_LOG2 <= 6u));
+
+/* Free running 8-bit indices must be able to tell full from empty */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_queue_len_log2,
+		     (ISO_TP_QUEUE_LEN_LOG2 >= 1u) &&
+		     (ISO_TP_QUEUE_LEN_LOG2 <= 7u));
+
+/* Pinned configuration must be valid CAN_DL within ISO_TP_MAX_CAN_DL */
+#define _ISO_TP_CAN_DL_VALID(dl) (((dl) == 8u) || ((dl) == 12u) || \
+				  ((dl) == 16u) || ((dl) == 20u) || \
+				  ((dl) == 24u) || ((dl) == 32u) || \
+				  ((dl) == 48u) || ((dl) == 64u))
+
+#ifdef ISO_TP_FIXED_TX_DL
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_fixed_tx_dl,
+		     _ISO_TP_CAN_DL_VALID(ISO_TP_FIXED_TX_DL) &&
+		     (ISO_TP_FIXED_TX_DL <= ISO_TP_MAX_CAN_DL));
+#endif
+
+#ifdef ISO_TP_FIXED_RX_DL
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_fixed_rx_dl,
+		     _ISO_TP_CAN_DL_VALID(ISO_TP_FIXED_RX_DL) &&
+		     (ISO_TP_FIXED_RX_DL <= ISO_TP_MAX_CAN_DL));
+#endif
+
+/* Free running 16-bit indices of trace ring */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_trace_len_log2,
+		     (ISO_TP_TRACE_LEN_LOG2 >= 1u) &&
+		     (ISO_TP_TRACE_LEN_LOG2 <= 15u));
 
 /******************************************************************************
  * ISO-TP TYPE AND DATA DEFINITIONS
@@ -90,6 +317,20 @@ enum iso_tp_n_tatype {
 	ISO_TP_N_TATYPE_8
 };
 
+/** Addressing format, which tells where N_PCI starts (see 10.3).
+ *  Normal fixed addressing puts N_TA/N_SA into CAN ID, so data wise it is
+ *  the same as normal one. Applies to every enum iso_tp_n_tatype. */
+enum iso_tp_addr_format {
+	/** N_PCI starts at byte 0 */
+	ISO_TP_ADDR_FORMAT_NORMAL,
+
+	/** Byte 0 is N_TA, N_PCI starts at byte 1 */
+	ISO_TP_ADDR_FORMAT_EXTENDED,
+
+	/** Byte 0 is N_AE, N_PCI starts at byte 1 */
+	ISO_TP_ADDR_FORMAT_MIXED
+};
+
 /** N_PCI (Network Protocol Control Information Type).
  *  In simple terms it just identifies CAN frame type */
 enum iso_tp_n_pcitype {
@@ -105,14 +346,14 @@ enum iso_tp_n_pcitype {
  * In simple terms it just stores general information about CAN frame */
 struct iso_tp_n_pci
 {
+	/* FirstFrame (FF), the widest member goes first (no padding) */
+	uint32_t ff_dl; /**< FirstFrame  DataLength (FF_DL). */
+
 	uint8_t n_pcitype; /**< Network protocol control information type */
 
 	/* SingleFrame (SF) */
 	uint8_t	 sf_dl; /**< SingleFrame DataLength (SF_DL). */
 
-	/* FirstFrame (FF) */
-	uint32_t ff_dl; /**< FirstFrame  DataLength (FF_DL). */
-
 	/* ConsecutiveFrame (CF) */
 	uint8_t sn; /**< SequenceNumber */
 
@@ -120,6 +361,11 @@ struct iso_tp_n_pci
 	uint8_t fs;     /**< FlowStatus */
 	uint8_t bs;     /**< BlockSize */
 	uint8_t min_st; /**< SeparationTime minimum */
+
+	/** Address byte preceding N_PCI: N_TA (extended) or N_AE (mixed
+	 *  addressing), 0 for normal addressing. Belongs to N_AI, kept here
+	 *  so it travels with N_PCI of frame. @note Not standard */
+	uint8_t n_ae;
 };
 
 /** N_PDU (Network Protocol Data Unit) */
@@ -127,11 +373,64 @@ struct iso_tp_n_pdu
 {
 	struct iso_tp_n_pci n_pci; /**< N_PCI info */
 
-	/* TODO replace with reference to CAN message to reduce copying */
 	uint8_t	n_data[ISO_TP_MAX_CAN_DL]; /**< Payload */
 	uint8_t	len_n_data; /**< n_data length @note Not standard */
 };
 
+/** FlowStatus (FS) values. See: Table 18 — Definition of FS values */
+enum iso_tp_fs {
+	ISO_TP_FS_CTS,  /**< ContinueToSend */
+	ISO_TP_FS_WAIT, /**< Wait */
+	ISO_TP_FS_OVFLW /**< Overflow */
+};
+
+/** N_Result. Outcome of service execution (See: 8.3.7 N_Result) */
+enum iso_tp_n_result {
+	ISO_TP_N_RESULT_N_OK,           /**< Service execution was successful */
+	ISO_TP_N_RESULT_N_TIMEOUT_A,    /**< N_Ar/N_As has passed */
+	ISO_TP_N_RESULT_N_TIMEOUT_BS,   /**< N_Bs has passed */
+	ISO_TP_N_RESULT_N_TIMEOUT_CR,   /**< N_Cr has passed */
+	ISO_TP_N_RESULT_N_WRONG_SN,     /**< Unexpected SequenceNumber */
+	ISO_TP_N_RESULT_N_INVALID_FS,   /**< Invalid or unknown FlowStatus */
+	ISO_TP_N_RESULT_N_UNEXP_PDU,    /**< Unexpected protocol data unit */
+	ISO_TP_N_RESULT_N_WFT_OVRN,     /**< Too many FC.WAIT in a row */
+	ISO_TP_N_RESULT_N_BUFFER_OVFLW, /**< Receiver buffer is too small */
+	ISO_TP_N_RESULT_N_ERROR         /**< General error */
+};
+
+/** N_USData.indication parameters. Complete (reassembled) message. */
+struct iso_tp_n_usdata {
+	uint32_t id; /**< N_AI (CAN ID of the sender) @note Simplified */
+	uint8_t  n_ae; /**< N_TA or N_AE of message, 0 for normal addressing
+			    (see struct iso_tp_n_pci) */
+
+	const uint8_t *data; /**< <MessageData> */
+	uint32_t       len;  /**< <Length> */
+
+	uint8_t n_result; /**< <N_Result> */
+
+#ifdef ISO_TP_CRC32
+	uint32_t crc; /**< CRC-32 of received data (see iso_tp_crc32), 0 for
+			   confirmation. Covers data as received, before
+			   rewrite rules and iso_tp_patch edit it
+			   @note Not standard */
+#endif
+};
+
+/** Lock-free single producer, single consumer frame queue.
+ *  Producer only writes head, consumer only writes tail, so one side may
+ *  run inside CAN ISR while the other runs inside main loop.
+ *  @note Not standard */
+struct iso_tp_frame_queue {
+	struct iso_tp_can_frame frames[ISO_TP_QUEUE_LEN]; /**< Frame slots */
+
+	volatile uint8_t head; /**< Free running write index (producer) */
+#ifdef ISO_TP_QUEUE_CACHE_LINE
+	uint8_t _pad[ISO_TP_QUEUE_CACHE_LINE]; /**< Tail is not ours */
+#endif
+	volatile uint8_t tail; /**< Free running read index (consumer) */
+};
+
 /******************************************************************************
  * ISO-TP TYPE AND DATA DEFINITIONS AND IMPLEMENTATION
  *
@@ -143,7 +442,67 @@ struct iso_tp_n_pdu
 enum iso_tp_event {
 	ISO_TP_EVENT_NONE, /**< No event, proceed */
 	ISO_TP_EVENT_INVALID_CONFIG, /**< Providen config is invalid */
-	ISO_TP_EVENT_N_PDU /**< N_PDU detected */
+	ISO_TP_EVENT_N_PDU, /**< N_PDU detected */
+
+	/** Message reception has been finished (successfully or not),
+	 *  see iso_tp_get_n_usdata. N_PDU of the last frame is still
+	 *  available. Only emited if RX buffer is set. */
+	ISO_TP_EVENT_N_USDATA_IND,
+
+	/** Message transmission has been finished (successfully or not),
+	 *  see iso_tp_get_n_usdata. Emited once per iso_tp_send. */
+	ISO_TP_EVENT_N_USDATA_CON,
+
+	/** Frame is rejected by acceptance filter and was not decoded,
+	 *  it may be forwarded untouched (see iso_tp_peek_frame) */
+	ISO_TP_EVENT_PASSTHROUGH,
+
+	/** Next part of streamed message (see stream_ff_dl) has been
+	 *  received, see iso_tp_read_chunk. N_PDU is available as well */
+	ISO_TP_EVENT_N_USDATA_CHUNK
+};
+
+/** Type of acceptance filter rule @note Not standard */
+enum iso_tp_filter_type {
+	ISO_TP_FILTER_MASK,  /**< (id & b) == (a & b) */
+	ISO_TP_FILTER_RANGE  /**< a <= id <= b */
+};
+
+/** Acceptance filter rule, like of CAN controller hardware filter.
+ *  @note Not standard */
+struct iso_tp_filter_rule {
+	uint8_t  type; /**< enum iso_tp_filter_type */
+	uint32_t a;    /**< Code (MASK) or lowest CAN ID (RANGE) */
+	uint32_t b;    /**< Mask (MASK) or highest CAN ID (RANGE) */
+};
+
+/** Operation of message edit @note Not standard */
+enum iso_tp_edit_op {
+	ISO_TP_EDIT_SET, /**< byte = (byte & ~mask) | (value & mask) */
+	ISO_TP_EDIT_ADD, /**< byte = byte + value (modulo 256) */
+	ISO_TP_EDIT_XOR  /**< byte = byte ^ value */
+};
+
+/** Edit of a single byte of message @note Not standard */
+struct iso_tp_edit {
+	uint32_t offset; /**< Offset within message (N_USData) */
+	uint8_t  op;     /**< enum iso_tp_edit_op */
+	uint8_t  mask;   /**< Bits to set (ISO_TP_EDIT_SET) */
+	uint8_t  value;  /**< Operand */
+};
+
+/** Rewrite rule: once request (SF or FF) with payload prefix is received
+ *  on req_id, the following response message on resp_id is edited as its
+ *  frames pass through. Edits must be sorted by offset. @note Not standard */
+struct iso_tp_rule {
+	uint32_t req_id;                         /**< CAN ID of request */
+	uint8_t  prefix[ISO_TP_RULE_PREFIX_LEN]; /**< Request payload prefix */
+	uint8_t  prefix_len;                     /**< Length of prefix */
+
+	uint32_t resp_id; /**< CAN ID of response to edit */
+
+	const struct iso_tp_edit *edits;   /**< Edits of response */
+	uint8_t                   n_edits; /**< Number of edits */
 };
 
 /** Internal FSM state @note Not standard */
@@ -157,283 +516,651 @@ enum _iso_tp_state
 struct iso_tp_config {
 	uint8_t n_tatype; /**< Network target address type. TODO use this*/
 
-	uint8_t tx_dl; /**< Max DLC for TX limited by ISO_TP_MAX_CAN_DL */
-	uint8_t rx_dl; /**< Max DLC for TX limited by ISO_TP_MAX_CAN_DL.
-			Will be deduced automatically,
-			so no configuration needed. */
+	uint8_t tx_dl; /**< Max DLC for TX limited by ISO_TP_MAX_CAN_DL
+			(see ISO_TP_FIXED_TX_DL) */
+	uint8_t rx_dl; /**< Max DLC for RX limited by ISO_TP_MAX_CAN_DL,
+			0 - ISO_TP_MAX_CAN_DL. Actual RX_DL of each message
+			is deduced automatically from its FF (see Table 7).
+			Messages with larger RX_DL are ignored. */
 
 	uint8_t min_ff_dl; /**< Minimum value of FF_DL based on the
 				addressing scheme */
+
+	uint8_t addr_format; /**< enum iso_tp_addr_format
+				  (see ISO_TP_FIXED_ADDRESSING) */
+	uint8_t n_ae; /**< Address byte of transmitted frames: N_TA of peer
+			   (extended) or N_AE (mixed addressing).
+			   FC of mixed addressing echoes N_AE of message */
+	uint8_t n_ta; /**< Own N_TA (extended addressing), FC of peers is
+			   expected with it */
+
+	uint16_t n_bs_ms; /**< N_Bs timeout (wait for FC), 0 - disabled */
+	uint16_t n_cr_ms; /**< N_Cr timeout (wait for CF), 0 - disabled */
+
+	bool fc_auto; /**< Transmit FC to bound peers (see iso_tp_bind_n_ai)
+			   as soon as FF or the last CF of block is received.
+			   @note Not standard */
+
+	uint8_t fc_bs;      /**< Max BS of automatic FC, 0 - limited only by
+				 free space of RX queue */
+	uint8_t fc_min_st;  /**< STmin of automatic FC (see Table 20) */
+	uint8_t fc_wft_max; /**< N_WFTmax, max number of FC.WAIT in a row,
+				 0 - FC.WAIT is not used: if there's no
+				 room till half of N_Cr, FC.OVFLW aborts
+				 message before N_Bs of sender expires */
+
+	uint32_t stream_ff_dl; /**< Messages of FF_DL >= stream_ff_dl are
+				    streamed chunk by chunk (see
+				    iso_tp_read_chunk) instead of being
+				    reassembled, 0 - never.
+				    @note Not standard */
+
+	/** Acceptance filter: exact CAN IDs and rules. Frame is decoded
+	 *  if any of them matches, otherwise ISO_TP_EVENT_PASSTHROUGH is
+	 *  emited. No IDs and no rules - every frame is decoded.
+	 *  Tables are compiled on configuration, but rules must stay valid
+	 *  since they're still checked for 29-bit CAN IDs (ID > 0x7FF).
+	 *  @note Not standard */
+	const uint32_t *filter_ids;
+	uint8_t         filter_n_ids;
+
+	const struct iso_tp_filter_rule *filter_rules;
+	uint8_t                          filter_n_rules;
+
+	/** Rewrite rules (see struct iso_tp_rule), applied to frames
+	 *  received by iso_tp_step. Compiled on configuration, but table
+	 *  must stay valid. @note Not standard */
+	const struct iso_tp_rule *rules;
+	uint8_t                   n_rules;
 };
 
-/** Main instance @note Not standard */
-struct iso_tp {
-	uint8_t _state;
+/** Session state @note Not standard */
+enum _iso_tp_session_state {
+	_ISO_TP_SESSION_RX,         /**< Receive CFs */
+	_ISO_TP_SESSION_TX_WAIT_FC, /**< Transmitted FF or block, wait FC */
+	_ISO_TP_SESSION_TX_CF,      /**< Transmit CFs */
+	_ISO_TP_SESSION_TX_DONE,    /**< Transmission over, confirm to user */
+	_ISO_TP_SESSION_RX_DONE,    /**< Reception failed, indicate to user */
+	_ISO_TP_SESSION_EXPIRED     /**< Timed out, release silently */
+};
 
-	struct iso_tp_n_pdu _n_pdu;
+/** Reason of SF rejection (see _iso_tp_sf_reject) @note Not standard */
+enum iso_tp_sf_reject {
+	ISO_TP_SF_REJECT_NONE,      /**< Valid SF, not counted */
+	ISO_TP_SF_REJECT_SHORT,     /**< CAN_DL < len(N_PCI) */
+	ISO_TP_SF_REJECT_NO_ESC,    /**< CAN_DL > 8 without SF_DL escape */
+	ISO_TP_SF_REJECT_ESC,       /**< SF_DL escape with CAN_DL <= 8 */
+	ISO_TP_SF_REJECT_CAN_DL,    /**< Not a valid CAN FD CAN_DL */
+	ISO_TP_SF_REJECT_EMPTY,     /**< SF_DL = 0 */
+	ISO_TP_SF_REJECT_TRUNCATED, /**< CAN_DL < len(N_PCI) + SF_DL */
+
+	ISO_TP_SF_REJECT_MAX
+};
 
-	struct iso_tp_config _cfg;
+/** Reason of FF rejection (see _iso_tp_decode_ff) @note Not standard */
+enum iso_tp_ff_reject {
+	ISO_TP_FF_REJECT_NONE,   /**< Valid FF, not counted */
+	ISO_TP_FF_REJECT_SHORT,  /**< CAN_DL < 8 */
+	ISO_TP_FF_REJECT_CAN_DL, /**< Not a valid CAN FD CAN_DL */
+	ISO_TP_FF_REJECT_RX_DL,  /**< RX_DL is over configured max */
+	ISO_TP_FF_REJECT_ESC,    /**< FF_DL escape with FF_DL <= 4095 */
+	ISO_TP_FF_REJECT_FF_DL,  /**< FF_DL < min(FF_DL) of RX_DL */
 
-	/* Intermediate */
-	bool _has_tx; /**< Active if TX frame is available for send */
-	bool _has_rx; /**< Active if RX frame is available for receiving */
+	ISO_TP_FF_REJECT_MAX
+};
 
-	struct iso_tp_can_frame _can_tx_frame; /**< Frame to transmit */
-	struct iso_tp_can_frame _can_rx_frame; /**< Received frame */
+/** Instance counters (see ISO_TP_STATS). Counters wrap around.
+ *  @note Not standard */
+struct iso_tp_stats {
+	/** Decoded frames by enum iso_tp_n_pcitype, INVALID are frames
+	 *  ignored (broken, unexpected or not ISO-TP at all) */
+	uint32_t frames[ISO_TP_N_PCITYPE_INVALID + 1];
+	uint32_t passthrough; /**< Frames rejected by acceptance filter */
 
-	uint8_t _cf_left; /**< Data left to read for consecutive frame
-			      @note Not standard */
+	uint32_t sf_rejects[ISO_TP_SF_REJECT_MAX]; /**< By reason */
+	uint32_t ff_rejects[ISO_TP_FF_REJECT_MAX]; /**< By reason */
+	uint32_t sn_errors;  /**< CFs of wrong SequenceNumber */
+	uint32_t no_session; /**< FFs not tracked, session table is full */
+	uint32_t ovflw;      /**< Messages with no room in reassembly pool */
 
-	bool _cf_err; /**< CF is not safe for work @note Not standard */ 
+	uint32_t rx_drops; /**< Frames not pushed, RX queue is full.
+				Written by producer only (see push) */
+	uint32_t tx_drops; /**< Sends and overrides refused, TX queue is full */
+
+	uint32_t timeouts_cr; /**< N_Cr has passed */
+	uint32_t timeouts_bs; /**< N_Bs has passed */
+
+	uint32_t overrides; /**< Frames overriden (iso_tp_override_n_pdu) */
+	uint32_t patches;   /**< Frames patched (iso_tp_patch) */
+	uint32_t edits;     /**< Frames edited by rewrite rules */
+
+	uint32_t trace_lost; /**< Trace entries overwritten before pop */
 };
 
-/** Init main instance */
-void iso_tp_init(struct iso_tp *self)
-{
-	self->_state = _ISO_TP_STATE_CONFIG;
+/** Counters of ongoing transfer, live as long as its session.
+ *  @note Not standard */
+struct iso_tp_session_stats {
+	uint16_t n_cf;   /**< CFs received or transmitted */
+	uint8_t  n_fc;   /**< FCs received or transmitted */
+	uint8_t  n_wait; /**< Of them FC.WAIT */
+};
 
-	(void)memset(&self->_n_pdu, 0u, sizeof(struct iso_tp_n_pdu));
+/** Entry of trace ring, fixed binary layout (native endianness), so ring
+ *  may be dumped as is. @note Not standard */
+struct iso_tp_trace_entry {
+	uint32_t time_us;   /**< Sum of step deltas, wraps around */
+	uint32_t id;        /**< CAN ID of frame or of indication */
+	uint8_t  n_pcitype; /**< enum iso_tp_n_pcitype of frame */
+	uint8_t  ev;        /**< enum iso_tp_event of step */
+	uint8_t  reserved[2];
+};
 
-	self->_cfg.n_tatype  = ISO_TP_N_TATYPE_1; /* Used the most */
-	self->_cfg.tx_dl     = 0u;
-	self->_cfg.rx_dl     = 0u; /* Assume CAN2.0 by default */
-	self->_cfg.min_ff_dl = 0u; /* Assume CAN2.0 by default */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_trace_entry_size,
+		     sizeof(struct iso_tp_trace_entry) == 12u);
+
+/** Transfer context of a single CAN ID. Sessions are stored inside
+ *  open-addressed (linear probing) hash table keyed by CAN ID, so frames
+ *  of different senders never share sequence tracking.
+ *  Receiving session is keyed by CAN ID of the sender, transmitting
+ *  session is keyed by CAN ID FlowControl arrives on.
+ *  Members are ordered by size, hot state (timers, offsets, SN) first, so
+ *  there's no padding and state touched by every CF shares cache line
+ *  (see ISO_TP_SESSION_SIZE). @note Not standard */
+struct _iso_tp_session {
+	/* Hot: every CF and timer step */
+	uint8_t       *buf;       /**< Reassembly buffer, NULL if not
+				       reassembling */
+	const uint8_t *tx_data;   /**< User message being transmitted */
+	uint32_t       timer_us;  /**< Time left till the next CF (STmin),
+				       or till timeout (N_Bs, N_Cr) */
+	uint32_t       cf_left;   /**< Data left to read for consecutive
+				       frame */
+	uint32_t       tx_offset; /**< Bytes of message already transmitted */
+	uint32_t       min_st_us; /**< STmin from the last FC */
+	uint32_t       ff_dl;     /**< FF_DL of message being received or
+				       transmitted */
+#ifdef ISO_TP_CRC32
+	uint32_t       crc;       /**< Running CRC-32 of accepted data,
+				       not inverted */
+#endif
+
+	/* Key */
+	uint32_t id;    /**< CAN ID this session belongs to */
+	uint32_t tx_id; /**< CAN ID to transmit frames on */
+
+	uint8_t state;   /**< Session state */
+	uint8_t sn;      /**< Last accepted SequenceNumber */
+	uint8_t bs_left; /**< CFs left till the end of block */
+	uint8_t bs;      /**< BlockSize of the last FC (0 - none) */
+	uint8_t wft;     /**< FC.WAIT transmitted in a row */
+	uint8_t n_ae;    /**< N_TA or N_AE, part of session key as well */
+	uint8_t tx_ae;   /**< Address byte of transmitted frames */
+	uint8_t rx_dl;   /**< RX_DL deduced from FF (see Table 7) */
+
+	bool    used;       /**< Slot is occupied */
+	bool    cf_err;     /**< CF is not safe for work */
+	bool    fc_pending; /**< Automatic FC is yet to be transmitted */
+	bool    stream;     /**< Message is streamed (see stream_ff_dl) */
+	uint8_t n_result;   /**< Outcome of transmission */
+
+#ifdef ISO_TP_STATS
+	struct iso_tp_session_stats stats;
+#endif
+};
 
-	self->_has_tx = false;
-	self->_has_rx = false;
+/** Bytes of RAM per concurrent transfer (one session), reassembly buffer
+ *  not included (see ISO_TP_POOL_BLOCK_SIZE) @note Not standard */
+#define ISO_TP_SESSION_SIZE sizeof(struct _iso_tp_session)
 
-	self->_cf_left = 0u;
-	self->_cf_err  = false;
+/** Bytes of RAM of the whole session table @note Not standard */
+#define ISO_TP_SESSIONS_SIZE (ISO_TP_SESSION_SIZE * ISO_TP_MAX_SESSIONS)
 
-	/*self->_src_sv_frame = ??;*/
-	/*self->_dst_sv_frame = ??;*/
-}
+/* Session must fit its RAM budget, reorder members if it fails */
+ISO_TP_STATIC_ASSERT(_iso_tp_assert_session_budget,
+		     ISO_TP_SESSION_SIZE <= ISO_TP_SESSION_BUDGET);
 
-/** Deduce variation of ISO_TP_N_PCITYPE_SF.
- *  Currently only Normal addressing is used TODO */
-void _iso_tp_decode_sf(struct iso_tp *self, struct iso_tp_can_frame *f)
-{
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t		     can_dl   = f->len;
-	uint8_t		    *can_data = f->data;
+/** Strided view over array of frames in driver's own format (see
+ *  iso_tp_push_frames). CAN ID is uint32_t (native endianness),
+ *  length is uint8_t, data is len bytes, all at given offsets of each
+ *  frame. @note Not standard */
+struct iso_tp_frame_view {
+	const uint8_t *base;   /**< First frame of array */
+	uint16_t       count;  /**< Number of frames */
+	uint16_t       stride; /**< Distance between frames, bytes */
 
-	/* N_PCI offset within PDU */
-	/* uint8_t offset_n_pci = 0u; */
+	uint16_t id_offset;   /**< Offset of CAN ID within frame */
+	uint16_t len_offset;  /**< Offset of length within frame */
+	uint16_t data_offset; /**< Offset of data within frame */
 
-	n_pci->sf_dl = (can_data[0] & 0x0Fu);
+	uint32_t id_mask; /**< Mask applied to CAN ID, so driver's flags
+			       (like CAN_EFF_FLAG) are stripped */
+};
 
-	if (can_dl < 1u) {
-		/* CAN DLC can't be less than len(N_PCI) */
-	} else if (n_pci->sf_dl == 0u) {
-		/* Extended frame NOT YET supported
-		 * (Do not confuse with extended addressing) */
-	} else if (n_pci->sf_dl > 7u) {
-		/* SF_DL = 7 is only allowed with normal addressing. */
-	} else if (can_dl < (1u + n_pci->sf_dl)) {
-		/* CAN DLC can't be less than len(N_PCI) + N_Data */
-	} else {
-		/* Valid frame */
-		n_pci->n_pcitype = ISO_TP_N_PCITYPE_SF;
+/** Outcome of a single frame of batch (see iso_tp_push_frames).
+ *  N_Data is at offset bytes of frame data. @note Not standard */
+struct iso_tp_frame_desc {
+	uint16_t index;     /**< Index of frame within view */
+	uint8_t  ev;        /**< enum iso_tp_event */
+	uint8_t  n_pcitype; /**< enum iso_tp_n_pcitype */
+	uint8_t  offset;    /**< Offset of N_Data within frame data */
+	uint8_t  len;       /**< len(N_Data) */
+	bool     cf_err;    /**< See iso_tp_has_cf_err */
+
+	uint32_t msg_offset; /**< Offset of N_Data within message */
+};
 
-		n_pdu->len_n_data = n_pci->sf_dl;
+/** Rewrite rule state @note Not standard */
+enum _iso_tp_rule_state {
+	_ISO_TP_RULE_IDLE,   /**< Wait for request */
+	_ISO_TP_RULE_ARMED,  /**< Request received, wait for response */
+	_ISO_TP_RULE_ACTIVE  /**< Response is being edited */
+};
 
-		/* Copy data to N_PDU */
-		(void)memcpy(n_pdu->n_data, &can_data[1], n_pdu->len_n_data);
-	}
-}
+/** Pair of CAN IDs of peer node. Frames of peer are received on rx_id,
+ *  frames to peer (FC, etc) are transmitted on tx_id. @note Not standard */
+struct _iso_tp_n_ai {
+	uint32_t rx_id; /**< CAN ID peer transmits on */
+	uint32_t tx_id; /**< CAN ID peer receives on */
+};
 
-/** Deduce variation of ISO_TP_N_PCITYPE_FF.
- *  Currently only Normal addressing is used TODO */
-void _iso_tp_decode_ff(struct iso_tp *self, struct iso_tp_can_frame *f)
-{
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t		     can_dl   = f->len;
-	uint8_t		    *can_data = f->data;
+/** Main instance, hot state of step first, cold configuration and
+ *  compiled tables after sessions @note Not standard */
+struct iso_tp {
+	/* Current N_PDU. Payload is not copied, but referenced
+	 * inside the frame it was decoded from (see iso_tp_peek_n_pdu) */
+	struct iso_tp_n_pci _n_pci;      /**< N_PCI info */
+	const uint8_t      *_n_data;     /**< Payload (inside frame buffer) */
 
-	n_pci->ff_dl = ((can_data[0] & 0x0Fu) << 8u) | can_data[1];
+	/** Received frame being processed. It is held inside RX queue
+	 *  until the next step, NULL if none */
+	struct iso_tp_can_frame *_rx_frame;
 
-	/* Setup rx_dl based on received CAN DL */
-	/* See: Table 7 — Received CAN_DL to RX_DL mapping table.
-	 * TODO implement correct RX_DL mapping */
-	self->_cfg.rx_dl = can_dl;
+	/** Frame lent by driver (see iso_tp_lend_frame), NULL if none */
+	struct iso_tp_can_frame *_lent_frame;
 
-	self->_cf_err = true;
+	uint8_t *_msg_buf;    /**< Reassembly buffer of message, or NULL */
+	uint8_t *_patch_data; /**< Writable payload for iso_tp_patch,
+				   NULL if frame can't be patched */
+	uint32_t _msg_offset; /**< Offset of payload within message */
+	uint32_t _msg_len;    /**< Length of message */
 
-	if (can_dl < 2u) {
-		/* CAN DLC can't be less than len(N_PCI) */
-	} else if (n_pci->ff_dl == 0u) {
-		/* Extended frame NOT YET supported
-		 * (Do not confuse with extended addressing) */
-	} else if (n_pci->ff_dl < self->_cfg.min_ff_dl) {
-		/* FF_DL can't be less than preconfigured min(FF_DL) */
-	} else if (n_pci->ff_dl < (self->_cfg.rx_dl - 2u)) {
-		/* FF_DL can't be less than RX_DL - len(N_PCI) */
-	} else {
-		/* Valid frame */
-		n_pci->n_pcitype = ISO_TP_N_PCITYPE_FF;
+	uint8_t _state;
+	uint8_t _len_n_data; /**< Payload length */
 
-		n_pdu->len_n_data = can_dl - 2u;
+	/* Frame layout, computed by config step (see addr_format) */
+	uint8_t _pci_offset; /**< Offset of N_PCI within frame data */
+	uint8_t _tx_sf_max;  /**< Max SF_DL of transmitted SF */
+	uint8_t _tx_ff_len;  /**< N_Data of transmitted FF (no escape) */
+	uint8_t _tx_cf_len;  /**< Max N_Data of transmitted CF */
 
-		/* Set cf_left to know how many bytes left for CF to read */
-		self->_cf_left = n_pci->ff_dl - n_pdu->len_n_data;
+	uint8_t _tx_count; /**< Number of transmitting sessions */
+	uint8_t _fc_count; /**< Number of sessions with pending FC */
+	uint8_t _n_done;   /**< Number of sessions waiting for report */
 
-		/* Set initial sequence num */
-		n_pdu->n_pci.sn = 0u;
+	uint8_t _backpressure; /**< Max BS of automatic FC allowed by sink of
+				    stream, 0 - FC.WAIT */
 
-		/* Copy data to N_PDU */
-		(void)memcpy(n_pdu->n_data, &can_data[2], n_pdu->len_n_data);
+	bool _rx_lent;   /**< _rx_frame memory is borrowed from driver */
+	bool _cf_err;    /**< CF of the last frame session is not safe for
+			      work @note Not standard */
+	bool _has_ind;   /**< _ind is valid */
+	bool _has_chunk; /**< N_Data of frame is chunk of stream */
+	bool _edited;    /**< Current frame has been edited by rules */
 
-		self->_cf_err = false;
-	}
-}
+	uint16_t _n_sessions; /**< Number of used sessions */
+
+	/** Indication or confirmation of the last step */
+	struct iso_tp_n_usdata _ind;
+
+	/** Session table (see _iso_tp_session_find) */
+	struct _iso_tp_session _sessions[ISO_TP_MAX_SESSIONS];
+
+	/* Intermediate */
+	struct iso_tp_frame_queue _tx_queue; /**< Frames to transmit */
+	struct iso_tp_frame_queue _rx_queue; /**< Received frames */
+
+	/* Cold: configuration and tables compiled from it */
+	struct iso_tp_config _cfg;
+
+	/* Reassembly pool (user buffer split into blocks) */
+	uint8_t *_pool;          /**< User buffer for message reassembly */
+	uint32_t _pool_free;     /**< Free blocks bitmap, bit set if free */
+	uint8_t  _pool_n_blocks; /**< Number of blocks in pool */
+
+	/** N_AI bindings (see iso_tp_bind_n_ai) */
+	uint8_t _n_ai_count; /**< Number of N_AI bindings */
+	struct _iso_tp_n_ai _n_ai[ISO_TP_MAX_N_AI];
+
+	/* Compiled acceptance filter */
+	bool     _filter_on; /**< Filter is configured */
+	uint32_t _filter_std[0x800u / 32u]; /**< Bitmap of 11-bit CAN IDs */
+	uint32_t _filter_ext[ISO_TP_FILTER_EXT_LEN]; /**< Hash table of exact
+							  29-bit CAN IDs */
+
+	/* Compiled rewrite rules. Hash tables hold rule index + 1 (0 - empty),
+	 * rules with the same CAN ID are chained */
+	uint8_t _rule_req[2u * ISO_TP_MAX_RULES];  /**< Index by req_id */
+	uint8_t _rule_resp[2u * ISO_TP_MAX_RULES]; /**< Index by resp_id */
+	uint8_t _rule_next_req[ISO_TP_MAX_RULES];  /**< Chains by req_id */
+	uint8_t _rule_next_resp[ISO_TP_MAX_RULES]; /**< Chains by resp_id */
+	uint8_t _rule_state[ISO_TP_MAX_RULES];     /**< Idle, armed, active */
+	uint8_t _rule_edit[ISO_TP_MAX_RULES];      /**< Next edit to apply */
+
+#ifdef ISO_TP_STATS
+	struct iso_tp_stats _stats;
+
+	/* Trace ring, oldest entries are overwritten */
+	struct iso_tp_trace_entry _trace[ISO_TP_TRACE_LEN];
+	uint16_t _trace_head; /**< Free running write index */
+	uint16_t _trace_tail; /**< Free running read index */
+	uint32_t _time_us;    /**< Sum of step deltas */
+#endif
+};
 
-/** Decode ISO_TP_N_PCITYPE_CF.
- *  Currently only Normal addressing is used TODO */
-void _iso_tp_decode_cf(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Init frame queue */
+void _iso_tp_queue_init(struct iso_tp_frame_queue *q)
 {
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t		    *can_data = f->data;
+	q->head = 0u;
+	q->tail = 0u;
+}
 
-	uint8_t sn = (can_data[0] & 0x0Fu);
+/** Producer side. Returns free slot to fill or NULL if queue is full.
+ *  Slot becomes visible to consumer after _iso_tp_queue_commit */
+struct iso_tp_can_frame *_iso_tp_queue_back(struct iso_tp_frame_queue *q)
+{
+	struct iso_tp_can_frame *result = NULL;
 
-	n_pci->n_pcitype = ISO_TP_N_PCITYPE_CF;
+	uint8_t head = q->head;
 
-	if (((sn - 1u) & 0x0Fu) != n_pdu->n_pci.sn) {
-		self->_cf_err = true;
+	if ((uint8_t)(head - q->tail) < ISO_TP_QUEUE_LEN) {
+		result = &q->frames[head & (ISO_TP_QUEUE_LEN - 1u)];
 	}
 
-	n_pdu->n_pci.sn = sn;
-	n_pdu->len_n_data = (self->_cf_left > 7u) ?
-			     7u : self->_cf_left;
-
-	self->_cf_left = (self->_cf_left >= 7u) ?
-			 (self->_cf_left - 7u) : 0u;
+	return result;
+}
 
-	/* Copy data to N_PDU */
-	(void)memcpy(n_pdu->n_data, &can_data[1],
-		     n_pdu->len_n_data);
+/** Producer side. Publish slot obtained by _iso_tp_queue_back */
+void _iso_tp_queue_commit(struct iso_tp_frame_queue *q)
+{
+	ISO_TP_SPSC_BARRIER();
+	q->head = (uint8_t)(q->head + 1u);
 }
 
-/** Decode ISO_TP_N_PCITYPE_FC
- *  Currently only Normal addressing is used TODO */
-void _iso_tp_decode_fc(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Consumer side. Returns oldest frame or NULL if queue is empty.
+ *  Slot stays owned by consumer until _iso_tp_queue_release */
+struct iso_tp_can_frame *_iso_tp_queue_front(struct iso_tp_frame_queue *q)
 {
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t		    *can_data = f->data;
+	struct iso_tp_can_frame *result = NULL;
 
-	/* Simplest case, we don't assume a shit */
-	n_pdu->len_n_data = 0u;
-	n_pci->n_pcitype  = ISO_TP_N_PCITYPE_FC;
-	n_pci->fs         = (can_data[0] & 0x0Fu);
-	n_pci->bs         = can_data[1];
-	n_pci->min_st     = can_data[2];
+	uint8_t tail = q->tail;
+
+	if (q->head != tail) {
+		ISO_TP_SPSC_BARRIER();
+		result = &q->frames[tail & (ISO_TP_QUEUE_LEN - 1u)];
+	}
+
+	return result;
 }
 
-/** Decode N_PDU and N_PCItype based on frame contents.
- * Based on: ISO 15765-2:2016(E) Table 9 — Summary of N_PCI bytes.
- * Currently only Normal addressing is used TODO */
-void _iso_tp_decode_n_pdu(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Consumer side. Give slot obtained by _iso_tp_queue_front back */
+void _iso_tp_queue_release(struct iso_tp_frame_queue *q)
 {
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t		     can_dl   = f->len;
-	uint8_t		    *can_data = f->data;
+	ISO_TP_SPSC_BARRIER();
+	q->tail = (uint8_t)(q->tail + 1u);
+}
 
-	n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+/** Init main instance */
+void iso_tp_init(struct iso_tp *self)
+{
+	self->_state = _ISO_TP_STATE_CONFIG;
 
-	switch ((can_data[0] & 0xF0u) >> 4u) {
-	case ISO_TP_N_PCITYPE_SF:
-		if (can_dl >= 1u) {
-			_iso_tp_decode_sf(self, f);
-		}
+	(void)memset(&self->_n_pci, 0u, sizeof(struct iso_tp_n_pci));
+	self->_n_pci.n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+	self->_n_data          = NULL;
+	self->_len_n_data      = 0u;
 
-		break;
+	self->_msg_offset = 0u;
+	self->_msg_len    = 0u;
+	self->_msg_buf    = NULL;
+	self->_patch_data = NULL;
 
-	case ISO_TP_N_PCITYPE_FF:
-		if (can_dl >= 2u) {
-			_iso_tp_decode_ff(self, f);
-		}
+	self->_cfg.n_tatype  = ISO_TP_N_TATYPE_1; /* Used the most */
+	self->_cfg.tx_dl     = 0u;
+	self->_cfg.rx_dl     = 0u; /* Up to ISO_TP_MAX_CAN_DL */
+	self->_cfg.min_ff_dl = 0u; /* Assume CAN2.0 by default */
+	self->_cfg.n_bs_ms   = 1000u; /* See: Table 16 */
+	self->_cfg.n_cr_ms   = 1000u; /* See: Table 16 */
 
-		break;
+	self->_cfg.addr_format = (uint8_t)ISO_TP_ADDR_FORMAT_NORMAL;
+	self->_cfg.n_ae        = 0u;
+	self->_cfg.n_ta        = 0u;
 
-	case ISO_TP_N_PCITYPE_CF:
-		if ((can_dl >= 2u) && (self->_cf_left > 1u)) {
-			_iso_tp_decode_cf(self, f);
-		}
+	self->_pci_offset = 0u;
+	self->_tx_sf_max  = 0u;
+	self->_tx_ff_len  = 0u;
+	self->_tx_cf_len  = 0u;
 
-		break;
+	self->_cfg.fc_auto    = false; /* Just listen by default */
+	self->_cfg.fc_bs      = 0u;
+	self->_cfg.fc_min_st  = 0u;
+	self->_cfg.fc_wft_max = 0u;
 
-	case ISO_TP_N_PCITYPE_FC:
-		if (can_dl >= 3u) {
-			_iso_tp_decode_fc(self, f);
-		}
+	self->_cfg.stream_ff_dl = 0u;
 
-		break;
+	self->_cfg.filter_ids     = NULL; /* Accept all */
+	self->_cfg.filter_n_ids   = 0u;
+	self->_cfg.filter_rules   = NULL;
+	self->_cfg.filter_n_rules = 0u;
 
-	default:
-		break;
+	self->_filter_on = false;
+
+	self->_cfg.rules   = NULL;
+	self->_cfg.n_rules = 0u;
+
+	self->_edited = false;
+
+	_iso_tp_queue_init(&self->_tx_queue);
+	_iso_tp_queue_init(&self->_rx_queue);
+
+#ifdef ISO_TP_STATS
+	(void)memset(&self->_stats, 0u, sizeof(struct iso_tp_stats));
+	self->_trace_head = 0u;
+	self->_trace_tail = 0u;
+	self->_time_us    = 0u;
+#endif
+
+	self->_rx_frame   = NULL;
+	self->_rx_lent    = false;
+	self->_lent_frame = NULL;
+
+	(void)memset(self->_sessions, 0u, sizeof(self->_sessions));
+	self->_n_sessions = 0u;
+
+	self->_cf_err = false;
+
+	self->_pool          = NULL;
+	self->_pool_n_blocks = 0u;
+	self->_pool_free     = 0u;
+
+	self->_n_ai_count = 0u;
+
+	self->_tx_count = 0u;
+	self->_fc_count = 0u;
+	self->_n_done  = 0u;
+
+	(void)memset(&self->_ind, 0u, sizeof(struct iso_tp_n_usdata));
+	self->_has_ind = false;
+
+	self->_has_chunk    = false;
+	self->_backpressure = ISO_TP_BACKPRESSURE_OFF;
+
+	/*self->_src_sv_frame = ??;*/
+	/*self->_dst_sv_frame = ??;*/
+}
+
+/** Check if CAN_DL is one of the valid CAN FD data lengths
+ *  (0..8, 12, 16, 20, 24, 32, 48, 64) supported by ISO_TP_MAX_CAN_DL.
+ *  See: Table 7 — Received CAN_DL to RX_DL mapping table */
+bool _iso_tp_can_dl_valid(uint8_t can_dl)
+{
+	bool result = false;
+
+	if (can_dl > ISO_TP_MAX_CAN_DL) {
+		/* Not supported */
+	} else if (can_dl <= 8u) {
+		result = true;
+	} else if (can_dl <= 24u) {
+		result = ((can_dl & 0x03u) == 0u);
+	} else {
+		result = ((can_dl == 32u) || (can_dl == 48u) ||
+			  (can_dl == 64u));
 	}
+
+	return result;
 }
 
-/** Encode N_PDU and put its content into CAN frame.
- * Caller must ensure n_pdu->n_data contains the payload for
- * THIS specific frame. Currently only Normal addressing is used TODO */
-void _iso_tp_encode_n_pdu(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Branch-free variant of _iso_tp_can_dl_valid, returns 1 or 0.
+ *  Bit N of table is set if N is a valid CAN_DL */
+uint8_t _iso_tp_can_dl_valid_mask(uint8_t can_dl)
+{
+	static const uint32_t valid[8] = {
+		0x011111FFu, /* 0..8, 12, 16, 20, 24 */
+		0x00010001u, /* 32, 48 */
+		0x00000001u, /* 64 */
+		0u, 0u, 0u, 0u, 0u
+	};
+
+	return (uint8_t)(((valid[can_dl >> 5u] >> (can_dl & 0x1Fu)) & 1u) &
+			 (uint32_t)(can_dl <= ISO_TP_MAX_CAN_DL));
+}
+
+/** Round length of CAN FD frame up to the next valid CAN_DL.
+ *  Lengths up to 8 are valid as is (CAN2.0 frames are never padded). */
+uint8_t _iso_tp_can_dl_pad(uint8_t len)
+{
+	uint8_t result = 64u;
+
+	if (len <= 8u) {
+		result = len;
+	} else if (len <= 24u) {
+		result = (uint8_t)((len + 3u) & 0xFCu);
+	} else if (len <= 32u) {
+		result = 32u;
+	} else if (len <= 48u) {
+		result = 48u;
+	} else {}
+
+	return result;
+}
+
+/** Max SF_DL for given TX_DL and N_PCI offset (see Table 11).
+ *  CAN2.0 SF has 1 byte N_PCI, CAN FD SF has 2 bytes (escape sequence). */
+uint8_t _iso_tp_max_sf_dl(uint8_t tx_dl, uint8_t pci_offset)
+{
+	return ((tx_dl > 8u) ? (tx_dl - 2u) : 7u) - pci_offset;
+}
+
+/** Encode N_PCI and its payload into CAN frame. Payload may be any buffer,
+ *  SF takes SF_DL bytes, FF takes TX_DL - 2 bytes (TX_DL - 6 with FF_DL
+ *  escape sequence, which is used for FF_DL > 4095; FF is always a full
+ *  frame), CF takes up to TX_DL - 1 bytes (len_n_data) and FC takes none.
+ *  CAN FD frames (longer than 8 bytes) are padded to the next valid CAN_DL.
+ *  Extended and mixed addressing put n_pci->n_ae before N_PCI, which takes
+ *  one byte of payload capacity (see _tx_sf_max, _tx_ff_len, _tx_cf_len) */
+void _iso_tp_encode_frame(struct iso_tp *self,
+			  const struct iso_tp_n_pci *n_pci,
+			  const uint8_t *n_data, uint8_t len_n_data,
+			  struct iso_tp_can_frame *f)
 {
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
-	uint8_t             *can_data = f->data;
-	uint8_t		    *can_dl   = &f->len;
+	uint8_t  off      = _ISO_TP_PCI_OFFSET(self);
+	uint8_t *can_data = &f->data[off]; /* N_PCI */
+	uint8_t	*can_dl   = &f->len;
+	uint8_t  tx_dl    = _ISO_TP_TX_DL(self);
 
 	/* Cleanup frame */
-	(void)memset(can_data, 0u, 8u);
+	(void)memset(f->data, 0u, ISO_TP_MAX_CAN_DL);
+
+	/* N_TA or N_AE */
+	if (off > 0u) {
+		f->data[0] = n_pci->n_ae;
+	}
 
 	switch (n_pci->n_pcitype) {
 	case ISO_TP_N_PCITYPE_SF:
-		/* SF PCI: 0000 LLLL */
-		if (n_pci->sf_dl <= 7u) {
+		if (n_pci->sf_dl == 0u) {
+			*can_dl = 0u;
+		} else if (n_pci->sf_dl <= (7u - off)) {
+			/* SF PCI: 0000 LLLL */
 			can_data[0] = (uint8_t)(0x00u | n_pci->sf_dl);
 
-			(void)memcpy(&can_data[1], n_pdu->n_data,
-				     n_pci->sf_dl);
+			(void)memcpy(&can_data[1], n_data, n_pci->sf_dl);
+
+			*can_dl = off + 1u + n_pci->sf_dl;
+		} else if ((tx_dl > 8u) &&
+			   (n_pci->sf_dl <= self->_tx_sf_max)) {
+			/* SF PCI (CAN FD): 0000 0000 LLLL LLLL */
+			can_data[0] = 0x00u;
+			can_data[1] = n_pci->sf_dl;
 
-			*can_dl = 1u + n_pci->sf_dl;
+			(void)memcpy(&can_data[2], n_data, n_pci->sf_dl);
+
+			*can_dl = _iso_tp_can_dl_pad(off + 2u + n_pci->sf_dl);
+		} else {
+			*can_dl = 0u;
 		}
 		break;
 
 	case ISO_TP_N_PCITYPE_FF:
-		/* FF PCI: 0001 LLLL LLLL LLLL */
-		/* Byte 0: 0x10 | Upper 4 bits of Length */
-		can_data[0] = (uint8_t)(0x10u | ((n_pci->ff_dl >> 8u) & 0x0Fu));
-
-		/* Byte 1: Lower 8 bits of Length */
-		can_data[1] = (uint8_t)(n_pci->ff_dl & 0xFFu);
-
-		/* Payload for FF starts at index 2.
-		   Standard CAN FF always has 6 bytes of payload (if full).
-		  (Assuming we are sending a full frame here) */
-		(void)memcpy(&can_data[2], n_pdu->n_data, 6u);
+		if (n_pci->ff_dl <= 0xFFFu) {
+			/* FF PCI: 0001 LLLL LLLL LLLL */
+			/* Byte 0: 0x10 | Upper 4 bits of Length */
+			can_data[0] = (uint8_t)(0x10u |
+					((n_pci->ff_dl >> 8u) & 0x0Fu));
+
+			/* Byte 1: Lower 8 bits of Length */
+			can_data[1] = (uint8_t)(n_pci->ff_dl & 0xFFu);
+
+			/* Payload for FF starts at index 2.
+			   FF always has TX_DL - 2 bytes of payload (if full).
+			  (Assuming we are sending a full frame here) */
+			(void)memcpy(&can_data[2], n_data, self->_tx_ff_len);
+		} else {
+			/* FF PCI (escape): 0001 0000 0000 0000 followed by
+			 * 32 bit FF_DL, most significant byte first */
+			can_data[0] = 0x10u;
+			can_data[1] = 0x00u;
+			can_data[2] = (uint8_t)((n_pci->ff_dl >> 24u) & 0xFFu);
+			can_data[3] = (uint8_t)((n_pci->ff_dl >> 16u) & 0xFFu);
+			can_data[4] = (uint8_t)((n_pci->ff_dl >> 8u) & 0xFFu);
+			can_data[5] = (uint8_t)(n_pci->ff_dl & 0xFFu);
+
+			/* Payload for FF starts at index 6 */
+			(void)memcpy(&can_data[6], n_data,
+				     self->_tx_ff_len - 4u);
+		}
 
-		*can_dl = 8u; /* FF Always full frame from CAN 2.0 */
+		*can_dl = tx_dl; /* FF is always a full frame */
 		break;
 
 	case ISO_TP_N_PCITYPE_CF: {
-		uint8_t cf_payload_len = n_pdu->len_n_data;
+		uint8_t cf_payload_len = len_n_data;
 
 		/* CF PCI: 0010 SSSS */
 		can_data[0] = (uint8_t)(0x20u | (n_pci->sn & 0x0Fu));
 
 		/* Safety cap */
-		if (n_pdu->len_n_data > 7u) {
-			cf_payload_len = 7u;
+		if (len_n_data > self->_tx_cf_len) {
+			cf_payload_len = self->_tx_cf_len;
 		}
 
-		(void)memcpy(&can_data[1], n_pdu->n_data, cf_payload_len);
+		(void)memcpy(&can_data[1], n_data, cf_payload_len);
 
-		*can_dl = 1u + cf_payload_len;
+		/* CAN2.0 frames are never padded */
+		*can_dl = (uint8_t)(off + 1u + cf_payload_len);
+
+		if (tx_dl > 8u) {
+			*can_dl = _iso_tp_can_dl_pad(*can_dl);
+		}
 
 		break;
 	}
@@ -457,127 +1184,2198 @@ void _iso_tp_encode_n_pdu(struct iso_tp *self, struct iso_tp_can_frame *f)
 	}
 }
 
-/** Gets current configuration. Call this method to get initial config. */
-void iso_tp_get_config(struct iso_tp *self, struct iso_tp_config *cfg)
+/** Encode N_PDU and put its content into CAN frame.
+ * Caller must ensure n_pdu->n_data contains the payload for
+ * THIS specific frame. */
+void _iso_tp_encode_n_pdu(struct iso_tp *self,
+			  const struct iso_tp_n_pdu *n_pdu,
+			  struct iso_tp_can_frame *f)
 {
-	*cfg = self->_cfg;
+	_iso_tp_encode_frame(self, &n_pdu->n_pci, n_pdu->n_data,
+			     n_pdu->len_n_data, f);
 }
 
-/** Configures main instance. Call this method after init. */
-void iso_tp_set_config(struct iso_tp *self, struct iso_tp_config *cfg)
+/** SeparationTime minimum (STmin) to microseconds.
+ *  See: Table 20 — Definition of STmin values */
+uint32_t _iso_tp_min_st_to_us(uint8_t min_st)
 {
-	/* Only set config in this specific state */
-	if (self->_state == (uint8_t)_ISO_TP_STATE_CONFIG) {
-		self->_cfg = *cfg;
+	uint32_t result;
+
+	if (min_st <= 0x7Fu) {
+		/* 0 - 127 ms */
+		result = (uint32_t)min_st * 1000u;
+	} else if ((min_st >= 0xF1u) && (min_st <= 0xF9u)) {
+		/* 100 - 900 us */
+		result = (uint32_t)(min_st - 0xF0u) * 100u;
+	} else {
+		/* Reserved, use the longest STmin allowed */
+		result = 127000u;
 	}
+
+	return result;
 }
 
-/** Push RX CAN frame for processing, returns false if busy. */
-bool iso_tp_push_frame(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Milliseconds timeout to microseconds, 0 (disabled) stays 0 */
+uint32_t _iso_tp_timeout_us(uint16_t timeout_ms)
 {
-	bool result = false;
+	return (uint32_t)timeout_ms * 1000u;
+}
 
-	if ((self->_state == (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) &&
-	    !self->_has_rx) {
-		self->_has_rx = true;
+/** Home slot of CAN ID and N_TA/N_AE inside session table
+ *  (multiplicative hash). N_AE is 0 for normal addressing. */
+uint8_t _iso_tp_session_hash(uint32_t id, uint8_t n_ae)
+{
+	return (uint8_t)(((id ^ ((uint32_t)n_ae << 24u)) * 2654435761u) >>
+			 (32u - ISO_TP_MAX_SESSIONS_LOG2));
+}
+
+/** Find session by CAN ID and N_TA/N_AE. Returns NULL if there's no such
+ *  session. Probing is bounded by table capacity. */
+struct _iso_tp_session *_iso_tp_session_find(struct iso_tp *self, uint32_t id,
+					     uint8_t n_ae)
+{
+	struct _iso_tp_session *result = NULL;
 
-		self->_can_rx_frame = *f;
+	uint8_t slot = _iso_tp_session_hash(id, n_ae);
+	uint16_t i;
 
-		result = true;
+	for (i = 0u; i < ISO_TP_MAX_SESSIONS; i++) {
+		struct _iso_tp_session *s = &self->_sessions[slot];
+
+		if (!s->used) {
+			/* Chain ends here, no such ID */
+			break;
+		}
+
+		if ((s->id == id) && (s->n_ae == n_ae)) {
+			result = s;
+			break;
+		}
+
+		slot = (uint8_t)((slot + 1u) & (ISO_TP_MAX_SESSIONS - 1u));
 	}
 
 	return result;
 }
 
-/** Pop TX CAN frame, returns false if busy.
- * TODO not yet implemented */
-bool iso_tp_pop_frame(struct iso_tp *self, struct iso_tp_can_frame *f)
+/** Find session by CAN ID and N_TA/N_AE or occupy a new one.
+ *  Returns NULL if session table is full. */
+struct _iso_tp_session *_iso_tp_session_open(struct iso_tp *self, uint32_t id,
+					     uint8_t n_ae)
 {
-	bool result = false;
+	struct _iso_tp_session *result = NULL;
 
-	if (self->_has_tx) {
-		self->_has_tx = false;
+	uint8_t slot = _iso_tp_session_hash(id, n_ae);
+	uint16_t i;
 
-		if (f != NULL) {
-			*f = self->_can_tx_frame;
+	for (i = 0u; i < ISO_TP_MAX_SESSIONS; i++) {
+		struct _iso_tp_session *s = &self->_sessions[slot];
+
+		if (!s->used) {
+			(void)memset(s, 0u, sizeof(struct _iso_tp_session));
+			s->used = true;
+			s->id   = id;
+			s->n_ae = n_ae;
+
+			self->_n_sessions++;
+
+			result = s;
+			break;
 		}
 
-		result = true;
+		if ((s->id == id) && (s->n_ae == n_ae)) {
+			result = s;
+			break;
+		}
+
+		slot = (uint8_t)((slot + 1u) & (ISO_TP_MAX_SESSIONS - 1u));
 	}
 
 	return result;
 }
 
-/** Get N_PDU if one is detected. Returns false if no valid N_PDU */
-bool iso_tp_get_n_pdu(struct iso_tp *self, struct iso_tp_n_pdu *pdu)
+/** Release session. Uses backward shift deletion, so no tombstones are
+ *  left behind and lookup chains stay short. */
+void _iso_tp_session_close(struct iso_tp *self, struct _iso_tp_session *s)
 {
-	bool result = false;
+	const uint8_t mask = (uint8_t)(ISO_TP_MAX_SESSIONS - 1u);
 
-	if (self->_n_pdu.n_pci.n_pcitype !=
-	    (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
-		*pdu = self->_n_pdu;
+	uint8_t hole = (uint8_t)(s - self->_sessions);
+	uint8_t slot = hole;
+	uint16_t i;
 
-		result = true;
+	if (s->fc_pending) {
+		self->_fc_count--;
 	}
 
-	return result;
+	self->_sessions[hole].used = false;
+	self->_n_sessions--;
+
+	for (i = 1u; i < ISO_TP_MAX_SESSIONS; i++) {
+		struct _iso_tp_session *next;
+		uint8_t home;
+
+		slot = (uint8_t)((slot + 1u) & mask);
+		next = &self->_sessions[slot];
+
+		if (!next->used) {
+			break;
+		}
+
+		home = _iso_tp_session_hash(next->id, next->n_ae);
+
+		/* Move entry into the hole if it lies between home and slot */
+		if (((uint8_t)(slot - home) & mask) >=
+		    ((uint8_t)(slot - hole) & mask)) {
+			self->_sessions[hole] = *next;
+			next->used = false;
+			hole = slot;
+		}
+	}
 }
 
-bool iso_tp_has_cf_err(struct iso_tp *self)
+/** Bitmask of n lowest bits, n <= 32 */
+uint32_t _iso_tp_pool_mask(uint8_t n)
 {
-	return self->_cf_err;
+	return (n >= 32u) ? 0xFFFFFFFFu : ((1u << n) - 1u);
 }
 
-/** Override N_PDU. Will override internal N_PDU frame and will put TX frame
- *  into frame queue. That's how the filtering is done!
- *  Will return false if TX queue is full */
-bool iso_tp_override_n_pdu(struct iso_tp *self, struct iso_tp_n_pdu *pdu)
+/** Index of the lowest set bit of non-zero word (de Bruijn sequence) */
+uint8_t _iso_tp_pool_ctz(uint32_t v)
 {
-	bool result = false;
+	static const uint8_t debruijn[32] = {
+		 0u,  1u, 28u,  2u, 29u, 14u, 24u,  3u,
+		30u, 22u, 20u, 15u, 25u, 17u,  4u,  8u,
+		31u, 27u, 13u, 23u, 21u, 19u, 16u,  7u,
+		26u, 12u, 18u,  6u, 11u,  5u, 10u,  9u
+	};
+
+	return debruijn[((v & (~v + 1u)) * 0x077CB531u) >> 27u];
+}
 
-	if (!self->_has_tx) {
-		self->_n_pdu = *pdu;
+/** Number of pool blocks message of len bytes occupies */
+uint8_t _iso_tp_pool_blocks(uint32_t len)
+{
+	/* Rounded up, can't overflow for any FF_DL */
+	uint32_t n = (len / ISO_TP_POOL_BLOCK_SIZE) +
+		     (((len % ISO_TP_POOL_BLOCK_SIZE) != 0u) ? 1u : 0u);
 
-		/* Set TX ID same as RX, since we override frame */
-		self->_can_tx_frame.id = self->_can_rx_frame.id;
+	return (n > ISO_TP_POOL_MAX_BLOCKS) ? 0xFFu : (uint8_t)n;
+}
 
-		_iso_tp_encode_n_pdu(self, &self->_can_tx_frame);
+/** Give contiguous block run of the pool to session, if message fits it.
+ *  Bitmap search is bounded: log2(ISO_TP_POOL_MAX_BLOCKS) iterations.
+ *  s->buf is left NULL if no such run is available */
+void _iso_tp_buf_alloc(struct iso_tp *self, struct _iso_tp_session *s)
+{
+	uint8_t  n    = _iso_tp_pool_blocks(s->ff_dl);
+	uint8_t  k    = 1u;
 
-		self->_has_tx = true;
-		result = true;
+	/* Message larger than the pool is not searched at all, so shifts
+	 * below stay within 32 bits (n <= ISO_TP_POOL_MAX_BLOCKS) */
+	uint32_t runs = (n <= self->_pool_n_blocks) ? self->_pool_free : 0u;
+
+	s->buf = NULL;
+
+	/* Keep only bits which start a run of n free blocks.
+	 * Each pass doubles run length being checked */
+	while ((k < n) && (runs != 0u)) {
+		uint8_t step = ((n - k) < k) ? (n - k) : k;
+
+		runs &= runs >> step;
+		k    += step;
 	}
 
-	return result;
+	if (runs != 0u) {
+		uint8_t first = _iso_tp_pool_ctz(runs);
+
+		self->_pool_free &= ~(_iso_tp_pool_mask(n) << first);
+
+		s->buf = &self->_pool[(uint32_t)first * ISO_TP_POOL_BLOCK_SIZE];
+	}
 }
 
-/** Main instance state machine. Works step by step. Returns events during
- *  operation. Must be run inside main loop. */
-enum iso_tp_event iso_tp_step(struct iso_tp *self, uint32_t delta_time_ms)
+/** Take reassembly buffer back from session */
+void _iso_tp_buf_free(struct iso_tp *self, struct _iso_tp_session *s)
 {
-	/* Commonly used */
-	struct iso_tp_n_pci *n_pci = &self->_n_pdu.n_pci;
+	if (s->buf != NULL) {
+		uint8_t first = (uint8_t)((uint32_t)(s->buf - self->_pool) /
+					  ISO_TP_POOL_BLOCK_SIZE);
+		uint8_t n     = _iso_tp_pool_blocks(s->ff_dl);
 
-	enum iso_tp_event ev = ISO_TP_EVENT_NONE;
+		self->_pool_free |= _iso_tp_pool_mask(n) << first;
 
-	/* bool passthrough = false; */ /* Passthrough received messages */
+		s->buf = NULL;
+	}
+}
 
-	(void)self;
-	(void)delta_time_ms;
-	switch (self->_state) {
+/** Get TX CAN ID bound to RX CAN ID. Returns false if not bound */
+bool _iso_tp_n_ai_tx_id(struct iso_tp *self, uint32_t rx_id, uint32_t *tx_id)
+{
+	bool result = false;
+
+	uint8_t i;
+
+	for (i = 0u; i < self->_n_ai_count; i++) {
+		if (self->_n_ai[i].rx_id == rx_id) {
+			*tx_id = self->_n_ai[i].tx_id;
+
+			result = true;
+			break;
+		}
+	}
+
+	return result;
+}
+
+/** Address byte of FC answering message of n_ae: mixed addressing echoes
+ *  N_AE, extended one addresses peer (see n_ae of config) */
+uint8_t _iso_tp_fc_n_ae(struct iso_tp *self, uint8_t n_ae)
+{
+	uint8_t result = 0u;
+
+	if (_ISO_TP_ADDR_FORMAT(self) == (uint8_t)ISO_TP_ADDR_FORMAT_MIXED) {
+		result = n_ae;
+	} else if (_ISO_TP_ADDR_FORMAT(self) ==
+		   (uint8_t)ISO_TP_ADDR_FORMAT_EXTENDED) {
+		result = self->_cfg.n_ae;
+	} else {}
+
+	return result;
+}
+
+/** Put FlowControl to the peer bound to rx_id into TX queue.
+ *  Message being answered has address byte n_ae (see _iso_tp_fc_n_ae).
+ *  Returns false if peer is not bound or TX queue is full. */
+bool _iso_tp_send_fc(struct iso_tp *self, uint32_t rx_id, uint8_t n_ae,
+		     uint8_t fs, uint8_t bs, uint8_t min_st)
+{
+	bool result = false;
+
+	struct iso_tp_can_frame *slot = _iso_tp_queue_back(&self->_tx_queue);
+	struct iso_tp_n_pci fc;
+	uint32_t tx_id;
+
+	if ((slot != NULL) && _iso_tp_n_ai_tx_id(self, rx_id, &tx_id)) {
+		fc.n_pcitype = ISO_TP_N_PCITYPE_FC;
+		fc.fs        = fs;
+		fc.bs        = bs;
+		fc.min_st    = min_st;
+		fc.n_ae      = _iso_tp_fc_n_ae(self, n_ae);
+
+		slot->id = tx_id;
+		_iso_tp_encode_frame(self, &fc, NULL, 0u, slot);
+
+		_iso_tp_queue_commit(&self->_tx_queue);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Transmit automatic FC of receiving session (see fc_auto).
+ *  BS follows free space of RX queue, so sender never bursts more CFs than
+ *  we can absorb, and backpressure of streamed message (see
+ *  iso_tp_set_backpressure). If there's no room, FC.WAIT is transmitted
+ *  (if allowed, at most fc_wft_max in a row) and FC.CTS is retried by the
+ *  following steps. FC.WAIT is repeated (repeat_wait) on half of N_Cr,
+ *  before N_Bs of sender expires. Without FC.WAIT, FC.OVFLW is sent on
+ *  half of N_Cr instead (see _iso_tp_timer_step). @note Not standard */
+void _iso_tp_session_rx_fc(struct iso_tp *self, struct _iso_tp_session *s,
+			   bool repeat_wait)
+{
+	struct iso_tp_frame_queue *q = &self->_rx_queue;
+
+	uint8_t  room = ISO_TP_QUEUE_LEN - (uint8_t)(q->head - q->tail);
+	uint8_t  bs   = room;
+	bool     sent = false;
+	uint32_t tx_id;
+
+	if ((self->_cfg.fc_bs > 0u) && (self->_cfg.fc_bs < bs)) {
+		bs = self->_cfg.fc_bs;
+	}
+
+	/* Sink of stream takes no more than it allows */
+	if (s->stream && (self->_backpressure < bs)) {
+		bs   = self->_backpressure;
+		room = bs;
+	}
+
+	if (!_iso_tp_n_ai_tx_id(self, s->id, &tx_id)) {
+		/* FC is only transmitted to bound peers */
+		sent = true;
+	} else if (room > 0u) {
+		sent = _iso_tp_send_fc(self, s->id, s->n_ae,
+				       (uint8_t)ISO_TP_FS_CTS, bs,
+				       self->_cfg.fc_min_st);
+
+		if (sent) {
+			s->bs       = bs;
+			s->bs_left  = bs;
+			s->wft      = 0u;
+			s->timer_us = _iso_tp_timeout_us(self->_cfg.n_cr_ms);
+
+			ISO_TP_SESSION_STAT_INC(s, n_fc);
+		}
+	} else if (self->_cfg.fc_wft_max == 0u) {
+		/* Sender can't be asked to wait, it gets answer in time */
+		if (!s->fc_pending) {
+			s->timer_us = _iso_tp_timeout_us(self->_cfg.n_cr_ms) /
+				      2u;
+		}
+	} else if (((s->wft == 0u) || repeat_wait) &&
+		   (s->wft < self->_cfg.fc_wft_max) &&
+		   _iso_tp_send_fc(self, s->id, s->n_ae,
+				   (uint8_t)ISO_TP_FS_WAIT, 0u, 0u)) {
+		s->wft++;
+		s->timer_us = _iso_tp_timeout_us(self->_cfg.n_cr_ms) / 2u;
+
+		ISO_TP_SESSION_STAT_INC(s, n_fc);
+		ISO_TP_SESSION_STAT_INC(s, n_wait);
+	} else {
+		/* Retry later */
+	}
+
+	if (s->fc_pending == sent) {
+		s->fc_pending = !sent;
+
+		if (sent) {
+			self->_fc_count--;
+		} else {
+			self->_fc_count++;
+		}
+	}
+}
+
+#ifdef ISO_TP_CRC32
+/** Continue running CRC-32 (not inverted, starts with all ones) over
+ *  len bytes of data. Nibble table keeps it small for MCU */
+uint32_t _iso_tp_crc32_update(uint32_t crc, const uint8_t *data,
+			      uint32_t len)
+{
+	/* Reflected polynomial 0xEDB88320, 4 bits at a time */
+	static const uint32_t lut[16] = {
+		0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu,
+		0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+		0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu,
+		0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+	};
+
+	uint32_t i;
+
+	for (i = 0u; i < len; i++) {
+		crc ^= data[i];
+		crc  = (crc >> 4u) ^ lut[crc & 0x0Fu];
+		crc  = (crc >> 4u) ^ lut[crc & 0x0Fu];
+	}
+
+	return crc;
+}
+
+/** CRC-32 (IEEE 802.3, as zlib crc32) of len bytes of data, resumable:
+ *  crc is the result for preceding data, 0 at start. Gives the same value
+ *  as struct iso_tp_n_usdata crc for the whole message @note Not standard */
+uint32_t iso_tp_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+	return ~_iso_tp_crc32_update(~crc, data, len);
+}
+#endif
+
+/** Emit indication about message of session. Buffer is freed, however its
+ *  contents is not touched until the next step, so user may read it. */
+void _iso_tp_session_indicate(struct iso_tp *self, struct _iso_tp_session *s,
+			      enum iso_tp_n_result n_result)
+{
+	/* Streamed message has no buffer, data is NULL */
+	if ((s->buf != NULL) || s->stream) {
+		self->_ind.id       = s->id;
+		self->_ind.n_ae     = s->n_ae;
+		self->_ind.data     = s->buf;
+		self->_ind.len      = s->ff_dl;
+		self->_ind.n_result = (uint8_t)n_result;
+#ifdef ISO_TP_CRC32
+		self->_ind.crc      = ~s->crc;
+#endif
+
+		self->_has_ind = true;
+
+		/* Message is indicated exactly once: broken one is still
+		 * tracked till its end, but with neither buffer nor stream */
+		_iso_tp_buf_free(self, s);
+		s->stream = false;
+	}
+}
+
+/** Check SF of len(N_PCI) + N_Data bytes. Returns reason of rejection,
+ *  ISO_TP_SF_REJECT_NONE if SF is valid. Used to count rejects by table
+ *  driven decoder as well, so reasons are the same. */
+uint8_t _iso_tp_sf_reject(uint8_t can_dl, uint8_t off, const uint8_t *pci)
+{
+	uint8_t result = (uint8_t)ISO_TP_SF_REJECT_NONE;
+
+	/* N_PCI length, CAN FD SF uses escape sequence (SF_DL in byte 1) */
+	uint8_t len_n_pci = _ISO_TP_FD_FRAME(can_dl) ? 2u : 1u;
+	uint8_t sf_dl     = (pci[0] & 0x0Fu);
+
+	if (can_dl < (off + len_n_pci)) {
+		/* CAN DLC can't be less than len(N_PCI) */
+		result = (uint8_t)ISO_TP_SF_REJECT_SHORT;
+	} else if (_ISO_TP_FD_FRAME(can_dl) && (sf_dl != 0u)) {
+		/* SF with CAN_DL > 8 must use escape sequence */
+		result = (uint8_t)ISO_TP_SF_REJECT_NO_ESC;
+	} else if (!_ISO_TP_FD_FRAME(can_dl) && (sf_dl == 0u)) {
+		/* Escape sequence is only valid with CAN_DL > 8 */
+		result = (uint8_t)ISO_TP_SF_REJECT_ESC;
+	} else if (!_iso_tp_can_dl_valid(can_dl) ||
+		   !_ISO_TP_RX_CAN_DL_OK(can_dl)) {
+		/* Not a valid CAN FD frame, or larger than pinned RX_DL */
+		result = (uint8_t)ISO_TP_SF_REJECT_CAN_DL;
+	} else {
+		if (_ISO_TP_FD_FRAME(can_dl)) {
+			sf_dl = pci[1];
+		}
+
+		if (sf_dl == 0u) {
+			/* Empty SF is not allowed */
+			result = (uint8_t)ISO_TP_SF_REJECT_EMPTY;
+		} else if (can_dl < (off + len_n_pci + sf_dl)) {
+			/* CAN DLC can't be less than len(N_PCI) + N_Data */
+			result = (uint8_t)ISO_TP_SF_REJECT_TRUNCATED;
+		} else {
+			/* Valid frame */
+		}
+	}
+
+	return result;
+}
+
+/** Deduce variation of ISO_TP_N_PCITYPE_SF.
+ *  N_PCI follows address byte, if any (see _ISO_TP_PCI_OFFSET) */
+void _iso_tp_decode_sf(struct iso_tp *self, uint32_t id, uint8_t can_dl,
+		       const uint8_t *can_data)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	uint8_t        off = _ISO_TP_PCI_OFFSET(self);
+	const uint8_t *pci = &can_data[off];
+
+#ifdef ISO_TP_LUT_DECODER
+	/* CAN FD SF uses escape sequence (SF_DL in byte 1).
+	 * All the checks of cascade below are folded into masks */
+	uint8_t fd        = (uint8_t)_ISO_TP_FD_FRAME(can_dl);
+	uint8_t fd_mask   = (uint8_t)(0u - fd);
+	uint8_t low       = (uint8_t)(pci[0] & 0x0Fu);
+	uint8_t len_n_pci = (uint8_t)(1u + fd);
+	uint8_t valid;
+
+	n_pci->sf_dl = (uint8_t)((pci[1] & fd_mask) |
+				 (low & (uint8_t)~fd_mask));
+
+	valid = (uint8_t)((uint8_t)((low == 0u) == (fd != 0u)) &
+			  _iso_tp_can_dl_valid_mask(can_dl) &
+			  (uint8_t)_ISO_TP_RX_CAN_DL_OK(can_dl) &
+			  (uint8_t)(n_pci->sf_dl != 0u) &
+			  (uint8_t)(can_dl >= (off + len_n_pci +
+					       n_pci->sf_dl)));
+
+	if (valid != 0u) {
+		n_pci->n_pcitype = ISO_TP_N_PCITYPE_SF;
+	} else {
+		/* Reason is only looked for if counted */
+		ISO_TP_STAT_INC(self, sf_rejects[_iso_tp_sf_reject(can_dl,
+								   off, pci)]);
+	}
+#else
+	/* N_PCI length, CAN FD SF uses escape sequence (SF_DL in byte 1) */
+	uint8_t len_n_pci = _ISO_TP_FD_FRAME(can_dl) ? 2u : 1u;
+	uint8_t reject    = _iso_tp_sf_reject(can_dl, off, pci);
+
+	n_pci->sf_dl = (pci[0] & 0x0Fu);
+
+	if (reject != (uint8_t)ISO_TP_SF_REJECT_NONE) {
+		ISO_TP_STAT_INC(self, sf_rejects[reject]);
+	} else {
+		if (_ISO_TP_FD_FRAME(can_dl)) {
+			n_pci->sf_dl = pci[1];
+		}
+
+		/* Valid frame */
+		n_pci->n_pcitype = ISO_TP_N_PCITYPE_SF;
+	}
+#endif
+
+	if (n_pci->n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_SF) {
+		/* Reference data from N_PDU */
+		self->_len_n_data = n_pci->sf_dl;
+		self->_n_data     = &pci[len_n_pci];
+		self->_msg_offset = 0u;
+		self->_msg_len    = n_pci->sf_dl;
+
+		/* SF is a complete message on its own */
+		if (self->_pool != NULL) {
+			self->_ind.id       = id;
+			self->_ind.n_ae     = n_pci->n_ae;
+			self->_ind.data     = self->_n_data;
+			self->_ind.len      = self->_len_n_data;
+			self->_ind.n_result = (uint8_t)ISO_TP_N_RESULT_N_OK;
+#ifdef ISO_TP_CRC32
+			self->_ind.crc      = iso_tp_crc32(0u, self->_n_data,
+							   self->_len_n_data);
+#endif
+
+			self->_has_ind = true;
+		}
+	}
+}
+
+/** Deduce variation of ISO_TP_N_PCITYPE_FF.
+ *  N_PCI follows address byte, if any (see _ISO_TP_PCI_OFFSET) */
+void _iso_tp_decode_ff(struct iso_tp *self, uint32_t id, uint8_t can_dl,
+		       const uint8_t *can_data)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	struct _iso_tp_session *s = NULL;
+
+	uint8_t        off = _ISO_TP_PCI_OFFSET(self);
+	const uint8_t *pci = &can_data[off];
+
+	/* RX_DL of the message is CAN_DL of its FF.
+	 * See: Table 7 — Received CAN_DL to RX_DL mapping table */
+	uint8_t rx_dl = can_dl;
+
+	/* Min FF_DL for RX_DL and addressing (see Table 14) */
+	uint8_t min_ff_dl = (_ISO_TP_FD_FRAME(rx_dl) ? (rx_dl - 1u) : 8u) - off;
+
+	/* N_PCI length, 6 bytes if FF_DL escape sequence is used */
+	uint8_t len_n_pci = 2u;
+
+	n_pci->ff_dl = ((pci[0] & 0x0Fu) << 8u) | pci[1];
+
+	/* FF_DL = 0 is followed by 32 bit FF_DL */
+	if ((n_pci->ff_dl == 0u) && (can_dl >= (off + 6u))) {
+		n_pci->ff_dl = ((uint32_t)pci[2] << 24u) |
+			       ((uint32_t)pci[3] << 16u) |
+			       ((uint32_t)pci[4] << 8u)  |
+			       (uint32_t)pci[5];
+
+		len_n_pci = 6u;
+	}
+
+	if (can_dl < 8u) {
+		/* FF is always a full frame, RX_DL can't be less than 8 */
+		ISO_TP_STAT_INC(self, ff_rejects[ISO_TP_FF_REJECT_SHORT]);
+	} else if (!_iso_tp_can_dl_valid(can_dl)) {
+		/* Not a valid CAN FD frame */
+		ISO_TP_STAT_INC(self, ff_rejects[ISO_TP_FF_REJECT_CAN_DL]);
+	} else if (rx_dl > _ISO_TP_RX_DL(self)) {
+		/* RX_DL is not supported */
+		ISO_TP_STAT_INC(self, ff_rejects[ISO_TP_FF_REJECT_RX_DL]);
+	} else if ((len_n_pci == 6u) && (n_pci->ff_dl <= 0xFFFu)) {
+		/* Escape sequence is only valid for FF_DL > 4095 */
+		ISO_TP_STAT_INC(self, ff_rejects[ISO_TP_FF_REJECT_ESC]);
+	} else if (n_pci->ff_dl < min_ff_dl) {
+		/* FF_DL can't be less than min(FF_DL) of RX_DL */
+		ISO_TP_STAT_INC(self, ff_rejects[ISO_TP_FF_REJECT_FF_DL]);
+	} else {
+		/* Valid frame */
+		n_pci->n_pcitype = ISO_TP_N_PCITYPE_FF;
+
+		/* Set initial sequence num */
+		n_pci->sn = 0u;
+
+		/* Reference data from N_PDU */
+		self->_len_n_data = can_dl - off - len_n_pci;
+		self->_n_data     = &pci[len_n_pci];
+		self->_msg_offset = 0u;
+		self->_msg_len    = n_pci->ff_dl;
+
+		/* New FF restarts reception of the same sender */
+		s = _iso_tp_session_open(self, id, n_pci->n_ae);
+
+		/* New message of the sender replaces failed one, which
+		 * was not reported yet */
+		if ((s != NULL) &&
+		    (s->state == (uint8_t)_ISO_TP_SESSION_RX_DONE)) {
+			s->state = (uint8_t)_ISO_TP_SESSION_RX;
+			self->_n_done--;
+		}
+
+		/* Peer is busy receiving from us, can't track both */
+		if ((s != NULL) && (s->state != (uint8_t)_ISO_TP_SESSION_RX)) {
+			s = NULL;
+		}
+
+		if (s != NULL) {
+			/* Previous message (if any) is abandoned. Its buffer
+			 * is freed by its own FF_DL, before it's replaced */
+			_iso_tp_buf_free(self, s);
+
+			/* Set cf_left to know how many bytes left for CF */
+			s->cf_left = n_pci->ff_dl - self->_len_n_data;
+			s->rx_dl   = rx_dl;
+			s->sn      = 0u;
+			s->cf_err  = false;
+			s->ff_dl   = n_pci->ff_dl;
+			s->bs      = 0u;
+			s->bs_left = 0u;
+			s->wft     = 0u;
+			s->stream  = (self->_cfg.stream_ff_dl > 0u) &&
+				     (n_pci->ff_dl >= self->_cfg.stream_ff_dl);
+#ifdef ISO_TP_CRC32
+			s->crc     = _iso_tp_crc32_update(0xFFFFFFFFu,
+							  self->_n_data,
+							  self->_len_n_data);
+#endif
+
+			s->timer_us = _iso_tp_timeout_us(self->_cfg.n_cr_ms);
+
+			if ((self->_pool != NULL) && !s->stream) {
+				_iso_tp_buf_alloc(self, s);
+			}
+
+			if (s->stream) {
+				/* Sink takes data right from frames */
+				self->_has_chunk = true;
+			} else if (s->buf != NULL) {
+				(void)memcpy(s->buf, self->_n_data,
+					     self->_len_n_data);
+
+				self->_msg_buf = s->buf;
+			} else if ((self->_pool != NULL) &&
+				   _iso_tp_send_fc(self, id, n_pci->n_ae,
+				   (uint8_t)ISO_TP_FS_OVFLW, 0u, 0u)) {
+				/* We're the receiver and can't take message,
+				 * sender will abort transmission */
+				s->cf_left = 0u;
+
+				ISO_TP_STAT_INC(self, ovflw);
+			} else {
+				/* Just listen, without reassembly */
+			}
+
+			/* Let sender continue, unless message is rejected */
+			if (self->_cfg.fc_auto && (s->cf_left > 0u) &&
+			    ((s->buf != NULL) || s->stream ||
+			     (self->_pool == NULL))) {
+				_iso_tp_session_rx_fc(self, s, false);
+			}
+
+			/* Whole message fits FF, nothing to track */
+			if (s->cf_left == 0u) {
+				_iso_tp_session_indicate(self, s,
+							 ISO_TP_N_RESULT_N_OK);
+				_iso_tp_session_close(self, s);
+			}
+		}
+	}
+
+	if (n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_FF) {
+		/* Broken FF also breaks ongoing reception */
+		s = _iso_tp_session_find(self, id, n_pci->n_ae);
+
+		if ((s != NULL) && (s->state == (uint8_t)_ISO_TP_SESSION_RX)) {
+			s->cf_err = true;
+
+			_iso_tp_session_indicate(self, s,
+						 ISO_TP_N_RESULT_N_UNEXP_PDU);
+		}
+
+		self->_cf_err = true;
+	} else {
+		/* No session means session table is full, CF can't follow */
+		self->_cf_err = (s == NULL);
+
+		if (s == NULL) {
+			ISO_TP_STAT_INC(self, no_session);
+		}
+	}
+}
+
+/** Decode ISO_TP_N_PCITYPE_CF of specific session.
+ *  N_PCI follows address byte, if any (see _ISO_TP_PCI_OFFSET) */
+void _iso_tp_decode_cf(struct iso_tp *self, struct _iso_tp_session *s,
+		       uint8_t can_dl, const uint8_t *can_data)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	uint8_t        off = _ISO_TP_PCI_OFFSET(self);
+	const uint8_t *pci = &can_data[off];
+
+	uint8_t sn = (pci[0] & 0x0Fu);
+
+	/* Each CF carries RX_DL - 1 bytes (less address byte), except
+	 * the last one */
+	uint8_t len = s->rx_dl - 1u - off;
+
+	if (s->cf_left < len) {
+		len = s->cf_left;
+	}
+
+	if (can_dl < (off + 1u + len)) {
+		/* CAN DLC can't be less than len(N_PCI) + N_Data, ignore */
+		len = 0u;
+	} else {
+		n_pci->n_pcitype = ISO_TP_N_PCITYPE_CF;
+	}
+
+	if ((len > 0u) && (((sn - 1u) & 0x0Fu) != s->sn)) {
+		s->cf_err = true;
+
+		ISO_TP_STAT_INC(self, sn_errors);
+
+		/* Message is broken, stop reassembling */
+		_iso_tp_session_indicate(self, s, ISO_TP_N_RESULT_N_WRONG_SN);
+	}
+
+	if (len > 0u) {
+		s->sn = sn;
+		n_pci->sn = sn;
+
+		ISO_TP_SESSION_STAT_INC(s, n_cf);
+
+		/* Reference data from N_PDU */
+		self->_len_n_data = len;
+		self->_n_data     = &pci[1];
+		self->_msg_offset = s->ff_dl - s->cf_left;
+		self->_msg_len    = s->ff_dl;
+
+		/* Write data directly to its place in message */
+		if (s->buf != NULL) {
+			(void)memcpy(&s->buf[self->_msg_offset],
+				     self->_n_data, self->_len_n_data);
+
+			self->_msg_buf = s->buf;
+		}
+
+		/* Broken stream yields no more chunks */
+		self->_has_chunk = s->stream && !s->cf_err;
+
+#ifdef ISO_TP_CRC32
+		/* Broken message is not hashed any further */
+		if (!s->cf_err) {
+			s->crc = _iso_tp_crc32_update(s->crc, self->_n_data,
+						      self->_len_n_data);
+		}
+#endif
+
+		s->cf_left -= len;
+
+		/* Next CF is expected within N_Cr */
+		s->timer_us = _iso_tp_timeout_us(self->_cfg.n_cr_ms);
+
+		self->_cf_err = s->cf_err;
+
+		/* Block is over, sender waits for the next FC */
+		if ((s->cf_left > 0u) && (s->bs > 0u) && (s->bs_left > 0u)) {
+			s->bs_left--;
+
+			if (s->bs_left == 0u) {
+				_iso_tp_session_rx_fc(self, s, false);
+			}
+		}
+
+		/* Reception is over, session no longer needed */
+		if (s->cf_left == 0u) {
+			_iso_tp_session_indicate(self, s,
+						 ISO_TP_N_RESULT_N_OK);
+			_iso_tp_session_close(self, s);
+		}
+	}
+}
+
+/** Finish transmission, user will be confirmed by the following steps */
+void _iso_tp_session_tx_done(struct iso_tp *self, struct _iso_tp_session *s,
+			     enum iso_tp_n_result n_result)
+{
+	s->state    = (uint8_t)_ISO_TP_SESSION_TX_DONE;
+	s->n_result = (uint8_t)n_result;
+
+	self->_n_done++;
+}
+
+/** Apply received FC (current N_PCI) to transmitting session */
+void _iso_tp_session_fc(struct iso_tp *self, struct _iso_tp_session *s)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	if ((s == NULL) ||
+	    (s->state != (uint8_t)_ISO_TP_SESSION_TX_WAIT_FC)) {
+		/* FC is not expected, ignore */
+	} else if (n_pci->fs == (uint8_t)ISO_TP_FS_CTS) {
+		ISO_TP_SESSION_STAT_INC(s, n_fc);
+
+		s->state     = (uint8_t)_ISO_TP_SESSION_TX_CF;
+		s->bs        = n_pci->bs;
+		s->bs_left   = n_pci->bs;
+		s->min_st_us = _iso_tp_min_st_to_us(n_pci->min_st);
+		s->timer_us  = 0u; /* First CF of block goes immediately */
+	} else if (n_pci->fs == (uint8_t)ISO_TP_FS_WAIT) {
+		ISO_TP_SESSION_STAT_INC(s, n_fc);
+		ISO_TP_SESSION_STAT_INC(s, n_wait);
+
+		/* Keep waiting for the next FC, N_Bs restarts */
+		s->timer_us = _iso_tp_timeout_us(self->_cfg.n_bs_ms);
+	} else if (n_pci->fs == (uint8_t)ISO_TP_FS_OVFLW) {
+		_iso_tp_session_tx_done(self, s,
+					ISO_TP_N_RESULT_N_BUFFER_OVFLW);
+	} else {
+		_iso_tp_session_tx_done(self, s, ISO_TP_N_RESULT_N_INVALID_FS);
+	}
+}
+
+/** Decode ISO_TP_N_PCITYPE_FC.
+ *  N_PCI follows address byte, if any (see _ISO_TP_PCI_OFFSET) */
+void _iso_tp_decode_fc(struct iso_tp *self, uint32_t id,
+		       const uint8_t *can_data)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	const uint8_t *pci = &can_data[_ISO_TP_PCI_OFFSET(self)];
+
+	/* Simplest case, we don't assume a shit */
+	self->_len_n_data = 0u;
+	self->_n_data     = &pci[3];
+	n_pci->n_pcitype  = ISO_TP_N_PCITYPE_FC;
+	n_pci->fs         = (pci[0] & 0x0Fu);
+	n_pci->bs         = pci[1];
+	n_pci->min_st     = pci[2];
+
+	_iso_tp_session_fc(self, _iso_tp_session_find(self, id, n_pci->n_ae));
+}
+
+#ifdef ISO_TP_LUT_DECODER
+/** Decoder table entry: N_PCItype and min CAN_DL of the first N_PCI
+ *  nibble (see Table 9). @note Not standard */
+struct _iso_tp_pci_entry {
+	uint8_t n_pcitype; /**< enum iso_tp_n_pcitype */
+	uint8_t min_dl;    /**< Min CAN_DL of frame of this type */
+};
+#endif
+
+/** Decode N_PDU and N_PCItype based on frame contents. Frame fields are
+ *  passed separately, so frames may be decoded in place from any memory.
+ *  Extended and mixed addressing frames start with address byte, which is
+ *  kept in n_pci->n_ae (see enum iso_tp_addr_format).
+ * Based on: ISO 15765-2:2016(E) Table 9 — Summary of N_PCI bytes. */
+void _iso_tp_decode(struct iso_tp *self, uint32_t id, uint8_t can_dl,
+		    const uint8_t *can_data)
+{
+#ifdef ISO_TP_LUT_DECODER
+	/* Types 4..15 are reserved, never valid */
+	static const struct _iso_tp_pci_entry lut[16] = {
+		{(uint8_t)ISO_TP_N_PCITYPE_SF, 1u},
+		{(uint8_t)ISO_TP_N_PCITYPE_FF, 2u},
+		{(uint8_t)ISO_TP_N_PCITYPE_CF, 2u},
+		{(uint8_t)ISO_TP_N_PCITYPE_FC, 3u},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu},
+		{(uint8_t)ISO_TP_N_PCITYPE_INVALID, 0xFFu}
+	};
+
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	uint8_t off = _ISO_TP_PCI_OFFSET(self);
+
+	/* Length of N_PCI and N_Data */
+	uint8_t dl = (can_dl > off) ? (uint8_t)(can_dl - off) : 0u;
+
+	/* Frame without N_PCI is looked up as reserved type */
+	const struct _iso_tp_pci_entry *e =
+		&lut[(dl > 0u) ? ((can_data[off] >> 4u) & 0x0Fu) : 4u];
+
+	/* All ones if frame is long enough and not too long */
+	uint8_t mask = (uint8_t)(0u - (uint8_t)((uint8_t)(dl >= e->min_dl) &
+				      (uint8_t)(can_dl <= ISO_TP_MAX_CAN_DL)));
+
+	uint8_t n_pcitype = (uint8_t)((e->n_pcitype & mask) |
+			    ((uint8_t)ISO_TP_N_PCITYPE_INVALID &
+			     (uint8_t)~mask));
+
+	struct _iso_tp_session *s = NULL;
+
+	n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+	n_pci->n_ae      = (off > 0u) ? can_data[0] : 0u;
+
+	/* Length has been checked already */
+	switch (n_pcitype) {
+	case ISO_TP_N_PCITYPE_SF:
+		_iso_tp_decode_sf(self, id, can_dl, can_data);
+		break;
+
+	case ISO_TP_N_PCITYPE_FF:
+		_iso_tp_decode_ff(self, id, can_dl, can_data);
+		break;
+
+	case ISO_TP_N_PCITYPE_CF:
+		/* Route CF to the session of its sender */
+		s = _iso_tp_session_find(self, id, n_pci->n_ae);
+
+		if ((s != NULL) && (s->state == (uint8_t)_ISO_TP_SESSION_RX) &&
+		    (s->cf_left > 0u)) {
+			_iso_tp_decode_cf(self, s, can_dl, can_data);
+		}
+
+		break;
+
+	case ISO_TP_N_PCITYPE_FC:
+		_iso_tp_decode_fc(self, id, can_data);
+		break;
+
+	default:
+		break;
+	}
+#else
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	uint8_t off = _ISO_TP_PCI_OFFSET(self);
+
+	/* Frames longer than supported are not decoded at all */
+	uint8_t n_pcitype = ((can_dl <= off) || (can_dl > ISO_TP_MAX_CAN_DL)) ?
+			    (uint8_t)ISO_TP_N_PCITYPE_INVALID :
+			    (uint8_t)((can_data[off] & 0xF0u) >> 4u);
+
+	/* Length of N_PCI and N_Data */
+	uint8_t dl = (can_dl > off) ? (uint8_t)(can_dl - off) : 0u;
+
+	n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+	n_pci->n_ae      = (off > 0u) ? can_data[0] : 0u;
+
+	switch (n_pcitype) {
+	case ISO_TP_N_PCITYPE_SF:
+		if (dl >= 1u) {
+			_iso_tp_decode_sf(self, id, can_dl, can_data);
+		}
+
+		break;
+
+	case ISO_TP_N_PCITYPE_FF:
+		if (dl >= 2u) {
+			_iso_tp_decode_ff(self, id, can_dl, can_data);
+		}
+
+		break;
+
+	case ISO_TP_N_PCITYPE_CF: {
+		/* Route CF to the session of its sender */
+		struct _iso_tp_session *s = _iso_tp_session_find(self, id,
+								 n_pci->n_ae);
+
+		if ((dl >= 2u) && (s != NULL) &&
+		    (s->state == (uint8_t)_ISO_TP_SESSION_RX) &&
+		    (s->cf_left > 0u)) {
+			_iso_tp_decode_cf(self, s, can_dl, can_data);
+		}
+
+		break;
+	}
+
+	case ISO_TP_N_PCITYPE_FC:
+		if (dl >= 3u) {
+			_iso_tp_decode_fc(self, id, can_data);
+		}
+
+		break;
+
+	default:
+		break;
+	}
+#endif
+
+	ISO_TP_STAT_INC(self, frames[self->_n_pci.n_pcitype]);
+}
+
+/** Decode N_PDU of CAN frame */
+void _iso_tp_decode_n_pdu(struct iso_tp *self, struct iso_tp_can_frame *f)
+{
+	_iso_tp_decode(self, f->id, f->len, f->data);
+}
+
+/** Gets current configuration. Call this method to get initial config. */
+void iso_tp_get_config(struct iso_tp *self, struct iso_tp_config *cfg)
+{
+	*cfg = self->_cfg;
+}
+
+/** Configures main instance. Call this method after init. */
+void iso_tp_set_config(struct iso_tp *self, struct iso_tp_config *cfg)
+{
+	/* Only set config in this specific state */
+	if (self->_state == (uint8_t)_ISO_TP_STATE_CONFIG) {
+		self->_cfg = *cfg;
+	}
+}
+
+/** Set buffer for message reassembly. Once set, SF and FF + CF payloads
+ *  are stitched by ISO-TP itself and ISO_TP_EVENT_N_USDATA_IND is emited
+ *  for every complete message.
+ *
+ *  Buffer is used as a pool of ISO_TP_POOL_BLOCK_SIZE blocks (up to
+ *  ISO_TP_POOL_MAX_BLOCKS, the rest is unused). Every FF takes as many
+ *  contiguous blocks as FF_DL requires, so concurrent receptions share
+ *  the buffer. If there's no room for a message, bound peer
+ *  (see iso_tp_bind_n_ai) receives FC.OVFLW, otherwise message is
+ *  reported as N_PDU only.
+ *
+ *  Call this method after init. Returns false if not in config state. */
+bool iso_tp_set_rx_buffer(struct iso_tp *self, uint8_t *buf, uint32_t size)
+{
+	bool result = false;
+
+	uint32_t n = size / ISO_TP_POOL_BLOCK_SIZE;
+
+	if (self->_state == (uint8_t)_ISO_TP_STATE_CONFIG) {
+		if (n > ISO_TP_POOL_MAX_BLOCKS) {
+			n = ISO_TP_POOL_MAX_BLOCKS;
+		}
+
+		self->_pool          = buf;
+		self->_pool_n_blocks = (uint8_t)n;
+		self->_pool_free     = _iso_tp_pool_mask((uint8_t)n);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Bind peer node CAN IDs. Peer transmits on rx_id and receives on tx_id.
+ *  Frames of bound peers are answered (for example with FlowControl),
+ *  frames of other nodes are only listened to.
+ *  Call this method after init. Returns false if not in config state or
+ *  there's no room (see ISO_TP_MAX_N_AI). */
+bool iso_tp_bind_n_ai(struct iso_tp *self, uint32_t rx_id, uint32_t tx_id)
+{
+	bool result = false;
+
+	if ((self->_state == (uint8_t)_ISO_TP_STATE_CONFIG) &&
+	    (self->_n_ai_count < ISO_TP_MAX_N_AI)) {
+		self->_n_ai[self->_n_ai_count].rx_id = rx_id;
+		self->_n_ai[self->_n_ai_count].tx_id = tx_id;
+		self->_n_ai_count++;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Empty slot of filter hash table, CAN ID can't be that big */
+#define _ISO_TP_FILTER_EMPTY 0xFFFFFFFFu
+
+/** Check if CAN ID matches filter rule */
+bool _iso_tp_filter_rule_match(const struct iso_tp_filter_rule *r,
+			       uint32_t id)
+{
+	bool result = false;
+
+	if (r->type == (uint8_t)ISO_TP_FILTER_MASK) {
+		result = ((id & r->b) == (r->a & r->b));
+	} else if (r->type == (uint8_t)ISO_TP_FILTER_RANGE) {
+		result = ((id >= r->a) && (id <= r->b));
+	} else {}
+
+	return result;
+}
+
+/** Check if CAN ID matches any of filter rules */
+bool _iso_tp_filter_rules_match(const struct iso_tp_config *cfg, uint32_t id)
+{
+	bool result = false;
+
+	uint8_t i;
+
+	for (i = 0u; (i < cfg->filter_n_rules) && !result; i++) {
+		result = _iso_tp_filter_rule_match(&cfg->filter_rules[i], id);
+	}
+
+	return result;
+}
+
+/** Hash index of 29-bit CAN ID within filter table */
+uint8_t _iso_tp_filter_hash(uint32_t id)
+{
+	return (uint8_t)((id * 2654435761u) >> (32u - ISO_TP_FILTER_EXT_LOG2));
+}
+
+/** Compile acceptance filter of config: 11-bit space into bitmap (rules are
+ *  expanded over all 2048 CAN IDs), exact 29-bit CAN IDs into hash table.
+ *  Returns false if hash table is too small */
+bool _iso_tp_filter_compile(struct iso_tp *self)
+{
+	const struct iso_tp_config *cfg = &self->_cfg;
+
+	bool result = true;
+
+	uint32_t id;
+	uint16_t i;
+
+	(void)memset(self->_filter_std, 0u, sizeof(self->_filter_std));
+
+	for (i = 0u; i < ISO_TP_FILTER_EXT_LEN; i++) {
+		self->_filter_ext[i] = _ISO_TP_FILTER_EMPTY;
+	}
+
+	self->_filter_on = ((cfg->filter_n_ids > 0u) ||
+			    (cfg->filter_n_rules > 0u));
+
+	for (i = 0u; (i < cfg->filter_n_ids) && result; i++) {
+		uint8_t slot = _iso_tp_filter_hash(cfg->filter_ids[i]);
+		uint16_t k;
+
+		id = cfg->filter_ids[i];
+
+		if (id <= 0x7FFu) {
+			self->_filter_std[id >> 5u] |=
+				((uint32_t)1u << (id & 0x1Fu));
+			continue;
+		}
+
+		/* Linear probing, free slot or the same ID */
+		result = false;
+		for (k = 0u; k < ISO_TP_FILTER_EXT_LEN; k++) {
+			uint32_t *e = &self->_filter_ext[slot];
+
+			if ((*e == _ISO_TP_FILTER_EMPTY) || (*e == id)) {
+				*e     = id;
+				result = true;
+				break;
+			}
+
+			slot = (uint8_t)((slot + 1u) &
+					 (ISO_TP_FILTER_EXT_LEN - 1u));
+		}
+	}
+
+	for (id = 0u; (id <= 0x7FFu) && (cfg->filter_n_rules > 0u); id++) {
+		if (_iso_tp_filter_rules_match(cfg, id)) {
+			self->_filter_std[id >> 5u] |=
+				((uint32_t)1u << (id & 0x1Fu));
+		}
+	}
+
+	return result;
+}
+
+/** Check if frame of CAN ID passes acceptance filter.
+ *  11-bit CAN ID takes a single bitmap lookup. */
+bool _iso_tp_filter_accept(struct iso_tp *self, uint32_t id)
+{
+	bool result = true;
+
+	uint8_t  slot = _iso_tp_filter_hash(id);
+	uint16_t k;
+
+	if (!self->_filter_on) {
+		/* Accept all */
+	} else if (id <= 0x7FFu) {
+		result = (((self->_filter_std[id >> 5u] >> (id & 0x1Fu)) &
+			   1u) != 0u);
+	} else {
+		result = false;
+
+		for (k = 0u; k < ISO_TP_FILTER_EXT_LEN; k++) {
+			uint32_t e = self->_filter_ext[slot];
+
+			if ((e == id) || (e == _ISO_TP_FILTER_EMPTY)) {
+				result = (e == id);
+				break;
+			}
+
+			slot = (uint8_t)((slot + 1u) &
+					 (ISO_TP_FILTER_EXT_LEN - 1u));
+		}
+
+		if (!result) {
+			result = _iso_tp_filter_rules_match(&self->_cfg, id);
+		}
+	}
+
+	return result;
+}
+
+/** Hash index of CAN ID within rule index */
+uint8_t _iso_tp_rule_hash(uint32_t id)
+{
+	return (uint8_t)((id * 2654435761u) >>
+			 (32u - (ISO_TP_MAX_RULES_LOG2 + 1u)));
+}
+
+/** CAN ID rule is indexed by */
+uint32_t _iso_tp_rule_key(const struct iso_tp_rule *r, bool by_req)
+{
+	return by_req ? r->req_id : r->resp_id;
+}
+
+/** Put rule i into index (open-addressed, linear probing) or into chain of
+ *  rule with the same CAN ID. Returns false if index is full */
+bool _iso_tp_rule_insert(struct iso_tp *self, uint8_t i, bool by_req)
+{
+	const struct iso_tp_rule *rules = self->_cfg.rules;
+
+	uint8_t *index = by_req ? self->_rule_req : self->_rule_resp;
+	uint8_t *next  = by_req ? self->_rule_next_req : self->_rule_next_resp;
+	uint32_t key   = _iso_tp_rule_key(&rules[i], by_req);
+	uint8_t  slot  = _iso_tp_rule_hash(key);
+
+	bool result = false;
+	uint16_t k;
+
+	for (k = 0u; k < (2u * ISO_TP_MAX_RULES); k++) {
+		uint8_t v = index[slot];
+
+		if ((v == 0u) ||
+		    (_iso_tp_rule_key(&rules[v - 1u], by_req) == key)) {
+			next[i]     = v;
+			index[slot] = (uint8_t)(i + 1u);
+
+			result = true;
+			break;
+		}
+
+		slot = (uint8_t)((slot + 1u) & ((2u * ISO_TP_MAX_RULES) - 1u));
+	}
+
+	return result;
+}
+
+/** Find the first rule (index + 1) of CAN ID, 0 if none */
+uint8_t _iso_tp_rule_find(struct iso_tp *self, uint32_t id, bool by_req)
+{
+	const uint8_t *index = by_req ? self->_rule_req : self->_rule_resp;
+
+	uint8_t result = 0u;
+	uint8_t slot   = _iso_tp_rule_hash(id);
+	uint16_t k;
+
+	for (k = 0u; k < (2u * ISO_TP_MAX_RULES); k++) {
+		uint8_t v = index[slot];
+
+		if ((v == 0u) ||
+		    (_iso_tp_rule_key(&self->_cfg.rules[v - 1u], by_req) ==
+		     id)) {
+			result = v;
+			break;
+		}
+
+		slot = (uint8_t)((slot + 1u) & ((2u * ISO_TP_MAX_RULES) - 1u));
+	}
+
+	return result;
+}
+
+/** Validate rewrite rules of config and compile them into hash index.
+ *  Returns false if rules are invalid or too many */
+bool _iso_tp_rules_compile(struct iso_tp *self)
+{
+	const struct iso_tp_config *cfg = &self->_cfg;
+
+	bool result = (cfg->n_rules <= ISO_TP_MAX_RULES);
+
+	uint8_t i;
+	uint8_t k;
+
+	(void)memset(self->_rule_req, 0u, sizeof(self->_rule_req));
+	(void)memset(self->_rule_resp, 0u, sizeof(self->_rule_resp));
+	(void)memset(self->_rule_state, 0u, sizeof(self->_rule_state));
+
+	for (i = 0u; (i < cfg->n_rules) && result; i++) {
+		const struct iso_tp_rule *r = &cfg->rules[i];
+
+		result = (r->prefix_len <= ISO_TP_RULE_PREFIX_LEN);
+
+		/* Edits are applied as frames stream, in order */
+		for (k = 0u; (k < r->n_edits) && result; k++) {
+			result = (r->edits[k].op <= (uint8_t)ISO_TP_EDIT_XOR) &&
+				 ((k == 0u) || (r->edits[k - 1u].offset <=
+						r->edits[k].offset));
+		}
+
+		result = result && _iso_tp_rule_insert(self, i, true) &&
+			 _iso_tp_rule_insert(self, i, false);
+	}
+
+	return result;
+}
+
+/** Apply edit to byte */
+uint8_t _iso_tp_edit_apply(const struct iso_tp_edit *e, uint8_t byte)
+{
+	uint8_t result = byte;
+
+	if (e->op == (uint8_t)ISO_TP_EDIT_SET) {
+		result = (uint8_t)((byte & (uint8_t)~e->mask) |
+				   (e->value & e->mask));
+	} else if (e->op == (uint8_t)ISO_TP_EDIT_ADD) {
+		result = (uint8_t)(byte + e->value);
+	} else {
+		result = (uint8_t)(byte ^ e->value);
+	}
+
+	return result;
+}
+
+/** Apply edits of active rule, falling into current frame */
+void _iso_tp_rule_edit(struct iso_tp *self, uint8_t i)
+{
+	const struct iso_tp_rule *r = &self->_cfg.rules[i];
+
+	uint32_t begin = self->_msg_offset;
+	uint32_t end   = self->_msg_offset + self->_len_n_data;
+
+	/* Bounded by number of edits */
+	while ((self->_rule_edit[i] < r->n_edits) &&
+	       (r->edits[self->_rule_edit[i]].offset < end)) {
+		const struct iso_tp_edit *e = &r->edits[self->_rule_edit[i]];
+
+		/* Offsets of frames missed are skipped */
+		if (e->offset >= begin) {
+			uint8_t *p = &self->_patch_data[e->offset - begin];
+
+			*p = _iso_tp_edit_apply(e, *p);
+
+			if (self->_msg_buf != NULL) {
+				self->_msg_buf[e->offset] = *p;
+			}
+
+			self->_edited = true;
+		}
+
+		self->_rule_edit[i]++;
+	}
+}
+
+/** Track requests and edit responses of current frame by rewrite rules.
+ *  Only rules of frame CAN ID are looked at. */
+void _iso_tp_rules_step(struct iso_tp *self, uint32_t id)
+{
+	const struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	bool first = (n_pci->n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_SF) ||
+		     (n_pci->n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_FF);
+	bool last  = ((self->_msg_offset + self->_len_n_data) >=
+		      self->_msg_len);
+
+	uint8_t v = _iso_tp_rule_find(self, id, true);
+	uint8_t k;
+
+	/* Request arms its rules */
+	for (k = 0u; (k < ISO_TP_MAX_RULES) && (v != 0u); k++) {
+		const struct iso_tp_rule *r = &self->_cfg.rules[v - 1u];
+
+		if (first && (r->prefix_len <= self->_len_n_data) &&
+		    (memcmp(r->prefix, self->_n_data, r->prefix_len) == 0)) {
+			self->_rule_state[v - 1u] = (uint8_t)_ISO_TP_RULE_ARMED;
+		}
+
+		v = self->_rule_next_req[v - 1u];
+	}
+
+	/* Response of armed rule is edited till its end */
+	v = _iso_tp_rule_find(self, id, false);
+
+	for (k = 0u; (k < ISO_TP_MAX_RULES) && (v != 0u); k++) {
+		uint8_t  i     = (uint8_t)(v - 1u);
+		uint8_t *state = &self->_rule_state[i];
+
+		if (first) {
+			*state = (*state == (uint8_t)_ISO_TP_RULE_ARMED) ?
+				 (uint8_t)_ISO_TP_RULE_ACTIVE :
+				 (uint8_t)_ISO_TP_RULE_IDLE;
+
+			self->_rule_edit[i] = 0u;
+		} else if (self->_cf_err) {
+			/* Broken message is not edited */
+			*state = (uint8_t)_ISO_TP_RULE_IDLE;
+		} else {}
+
+		if (*state == (uint8_t)_ISO_TP_RULE_ACTIVE) {
+			_iso_tp_rule_edit(self, i);
+
+			if (last) {
+				*state = (uint8_t)_ISO_TP_RULE_IDLE;
+			}
+		}
+
+		v = self->_rule_next_resp[i];
+	}
+}
+
+/** Push RX CAN frame for processing, returns false if RX queue is full.
+ *  May be called from CAN ISR while iso_tp_step runs inside main loop. */
+bool iso_tp_push_frame(struct iso_tp *self, struct iso_tp_can_frame *f)
+{
+	bool result = false;
+
+	struct iso_tp_can_frame *slot = _iso_tp_queue_back(&self->_rx_queue);
+
+	if ((self->_state == (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) &&
+	    (slot != NULL)) {
+		*slot = *f;
+
+		_iso_tp_queue_commit(&self->_rx_queue);
+
+		result = true;
+	} else if (self->_state == (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) {
+		ISO_TP_STAT_INC(self, rx_drops);
+	} else {}
+
+	return result;
+}
+
+/** Zero copy variant of iso_tp_push_frame. Frame memory is borrowed from
+ *  driver and is processed in place by the next iso_tp_step call.
+ *  The frame must stay valid and unmodified by driver until the step after
+ *  that one (N_PDU references it, see iso_tp_peek_n_pdu).
+ *  Must be called from the same context as iso_tp_step.
+ *  Returns false if busy: another frame is lent or RX queue is not empty
+ *  (frames must not be reordered). */
+bool iso_tp_lend_frame(struct iso_tp *self, struct iso_tp_can_frame *f)
+{
+	bool result = false;
+
+	/* Slot of queued frame processed by the last step is held till the
+	 * next one, queue is empty otherwise */
+	uint8_t held = ((self->_rx_frame != NULL) && !self->_rx_lent) ? 1u : 0u;
+
+	if ((self->_state == (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) &&
+	    (self->_lent_frame == NULL) &&
+	    ((uint8_t)(self->_rx_queue.head - self->_rx_queue.tail) <= held)) {
+		self->_lent_frame = f;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Pop TX CAN frame, returns false if TX queue is empty.
+ *  May be called from CAN ISR while iso_tp_step runs inside main loop. */
+bool iso_tp_pop_frame(struct iso_tp *self, struct iso_tp_can_frame *f)
+{
+	bool result = false;
+
+	struct iso_tp_can_frame *slot = _iso_tp_queue_front(&self->_tx_queue);
+
+	if (slot != NULL) {
+		if (f != NULL) {
+			*f = *slot;
+		}
+
+		_iso_tp_queue_release(&self->_tx_queue);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Get N_PDU if one is detected. Returns false if no valid N_PDU */
+bool iso_tp_get_n_pdu(struct iso_tp *self, struct iso_tp_n_pdu *pdu)
+{
+	bool result = false;
+
+	if (self->_n_pci.n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
+		pdu->n_pci      = self->_n_pci;
+		pdu->len_n_data = self->_len_n_data;
+
+		(void)memcpy(pdu->n_data, self->_n_data, self->_len_n_data);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Zero copy variant of iso_tp_get_n_pdu. Gives N_PCI and payload
+ *  references instead of copies. Payload points inside the frame it was
+ *  decoded from and stays valid until the next iso_tp_step call.
+ *  Any output pointer may be NULL. Returns false if no valid N_PDU */
+bool iso_tp_peek_n_pdu(struct iso_tp *self, const struct iso_tp_n_pci **n_pci,
+		       const uint8_t **n_data, uint8_t *len_n_data)
+{
+	bool result = false;
+
+	if (self->_n_pci.n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
+		if (n_pci != NULL) {
+			*n_pci = &self->_n_pci;
+		}
+
+		if (n_data != NULL) {
+			*n_data = self->_n_data;
+		}
+
+		if (len_n_data != NULL) {
+			*len_n_data = self->_len_n_data;
+		}
+
+		result = true;
+	}
+
+	return result;
+}
+
+bool iso_tp_has_cf_err(struct iso_tp *self)
+{
+	return self->_cf_err;
+}
+
+/** Get frame processed by the last step (for example to forward it on
+ *  ISO_TP_EVENT_PASSTHROUGH). Frame stays valid until the next step.
+ *  Returns false if there's no such frame (also for iso_tp_push_frames) */
+bool iso_tp_peek_frame(struct iso_tp *self,
+		       const struct iso_tp_can_frame **f)
+{
+	*f = self->_rx_frame;
+
+	return (self->_rx_frame != NULL);
+}
+
+/** Check if frame processed by the last step has been edited by rewrite
+ *  rules (see iso_tp_config), so it must be forwarded instead of original.
+ *  @note Not standard */
+bool iso_tp_is_edited(struct iso_tp *self)
+{
+	return self->_edited;
+}
+
+/** Get chunk of streamed message (see stream_ff_dl) received by the last
+ *  step: N_Data of FF or CF, which is len bytes at msg_offset of message.
+ *  Chunks come in order with no gaps, pointer refers to frame and stays
+ *  valid until the next step. Stream ends with ISO_TP_EVENT_N_USDATA_IND
+ *  (data is NULL), which may carry the last chunk as well.
+ *  Returns false if there's no chunk. @note Not standard */
+bool iso_tp_read_chunk(struct iso_tp *self, const uint8_t **data,
+		       uint8_t *len, uint32_t *msg_offset)
+{
+	if (self->_has_chunk) {
+		*data       = self->_n_data;
+		*len        = self->_len_n_data;
+		*msg_offset = self->_msg_offset;
+	}
+
+	return self->_has_chunk;
+}
+
+/** Tell how many frames sink of streamed messages is able to take:
+ *  automatic FC of streams has BS of at most max_bs, 0 - sink is busy,
+ *  FC.WAIT is transmitted instead (see fc_wft_max), retried till sink has
+ *  room. ISO_TP_BACKPRESSURE_OFF - no limit (default). @note Not standard */
+void iso_tp_set_backpressure(struct iso_tp *self, uint8_t max_bs)
+{
+	self->_backpressure = max_bs;
+}
+
+/** Get RX CAN ID bound to TX CAN ID. Returns false if not bound */
+bool _iso_tp_n_ai_rx_id(struct iso_tp *self, uint32_t tx_id, uint32_t *rx_id)
+{
+	bool result = false;
+
+	uint8_t i;
+
+	for (i = 0u; i < self->_n_ai_count; i++) {
+		if (self->_n_ai[i].tx_id == tx_id) {
+			*rx_id = self->_n_ai[i].rx_id;
+
+			result = true;
+			break;
+		}
+	}
+
+	return result;
+}
+
+/** Session key address byte of FC answering message sent with n_ae:
+ *  mixed addressing FC echoes N_AE, extended one carries own N_TA */
+uint8_t _iso_tp_tx_key_n_ae(struct iso_tp *self, uint8_t n_ae)
+{
+	uint8_t result = 0u;
+
+	if (_ISO_TP_ADDR_FORMAT(self) == (uint8_t)ISO_TP_ADDR_FORMAT_MIXED) {
+		result = n_ae;
+	} else if (_ISO_TP_ADDR_FORMAT(self) ==
+		   (uint8_t)ISO_TP_ADDR_FORMAT_EXTENDED) {
+		result = self->_cfg.n_ta;
+	} else {}
+
+	return result;
+}
+
+/** Transmit message (N_USData.request) with address byte n_ae (N_TA of
+ *  peer for extended, N_AE for mixed addressing, ignored for normal one).
+ *  See iso_tp_send. @note Not standard */
+bool iso_tp_send_n_ae(struct iso_tp *self, uint32_t tx_id, uint8_t n_ae,
+		      const uint8_t *data, uint32_t len)
+{
+	bool result = false;
+
+	struct iso_tp_can_frame *slot = _iso_tp_queue_back(&self->_tx_queue);
+	struct _iso_tp_session  *s    = NULL;
+	struct iso_tp_n_pci      n_pci;
+	uint32_t rx_id  = tx_id; /* SF does not need FC */
+	uint8_t  ae     = (_ISO_TP_PCI_OFFSET(self) > 0u) ? n_ae : 0u;
+	uint8_t  key    = _iso_tp_tx_key_n_ae(self, n_ae);
+	bool     is_sf  = (len <= self->_tx_sf_max);
+	bool     bound  = _iso_tp_n_ai_rx_id(self, tx_id, &rx_id);
+
+	if ((self->_state == (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) &&
+	    (slot == NULL)) {
+		/* TX queue is full */
+		ISO_TP_STAT_INC(self, tx_drops);
+	} else if ((self->_state != (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) ||
+		   (len == 0u) || (!is_sf && !bound)) {
+		/* Can't send */
+	} else if (_iso_tp_session_find(self, rx_id, key) != NULL) {
+		/* Peer is busy */
+	} else {
+		s = _iso_tp_session_open(self, rx_id, key);
+	}
+
+	if (s != NULL) {
+		s->tx_id   = tx_id;
+		s->tx_ae   = ae;
+		s->tx_data = data;
+		s->ff_dl   = len;
+
+		n_pci.n_ae = ae;
+
+		if (is_sf) {
+			n_pci.n_pcitype = ISO_TP_N_PCITYPE_SF;
+			n_pci.sf_dl     = (uint8_t)len;
+
+			s->tx_offset = len;
+		} else {
+			n_pci.n_pcitype = ISO_TP_N_PCITYPE_FF;
+			n_pci.ff_dl     = len;
+
+			/* FF_DL escape sequence takes 4 more bytes */
+			s->tx_offset = self->_tx_ff_len -
+				       ((len > 0xFFFu) ? 4u : 0u);
+		}
+
+		slot->id = tx_id;
+		_iso_tp_encode_frame(self, &n_pci, data, 0u, slot);
+		_iso_tp_queue_commit(&self->_tx_queue);
+
+		self->_tx_count++;
+
+		if (is_sf) {
+			_iso_tp_session_tx_done(self, s, ISO_TP_N_RESULT_N_OK);
+		} else {
+			s->state    = (uint8_t)_ISO_TP_SESSION_TX_WAIT_FC;
+			s->sn       = 0u;
+			s->timer_us = _iso_tp_timeout_us(self->_cfg.n_bs_ms);
+		}
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Transmit message (N_USData.request). SF is used if message fits it,
+ *  otherwise FF is transmitted and CFs follow as FlowControl of the peer
+ *  allows (BS, STmin). Multiframe transmission requires peer to be bound
+ *  (see iso_tp_bind_n_ai), since FC is received on its RX CAN ID.
+ *  Extended and mixed addressing use address byte of config (see n_ae).
+ *  Message data is not copied and must stay valid until
+ *  ISO_TP_EVENT_N_USDATA_CON. Returns false if message can't be sent:
+ *  invalid length, peer is busy, session table or TX queue is full. */
+bool iso_tp_send(struct iso_tp *self, uint32_t tx_id,
+		 const uint8_t *data, uint32_t len)
+{
+	return iso_tp_send_n_ae(self, tx_id, self->_cfg.n_ae, data, len);
+}
+
+/** Transmit CFs of session as long as STmin, BS and TX queue allow */
+void _iso_tp_session_tx_cf(struct iso_tp *self, struct _iso_tp_session *s)
+{
+	struct iso_tp_n_pci n_pci;
+	uint8_t i;
+
+	n_pci.n_pcitype = ISO_TP_N_PCITYPE_CF;
+	n_pci.n_ae      = s->tx_ae;
+
+	/* Bounded by TX queue capacity */
+	for (i = 0u; i < ISO_TP_QUEUE_LEN; i++) {
+		struct iso_tp_can_frame *slot;
+		uint32_t left = s->ff_dl - s->tx_offset;
+		uint8_t  max  = self->_tx_cf_len;
+		uint8_t  len  = (left > max) ? max : (uint8_t)left;
+
+		if ((s->state != (uint8_t)_ISO_TP_SESSION_TX_CF) ||
+		    (s->timer_us > 0u)) {
+			break;
+		}
+
+		slot = _iso_tp_queue_back(&self->_tx_queue);
+		if (slot == NULL) {
+			break;
+		}
+
+		s->sn       = (uint8_t)((s->sn + 1u) & 0x0Fu);
+		n_pci.sn    = s->sn;
+		slot->id    = s->tx_id;
+		_iso_tp_encode_frame(self, &n_pci, &s->tx_data[s->tx_offset],
+				     len, slot);
+		_iso_tp_queue_commit(&self->_tx_queue);
+
+		ISO_TP_SESSION_STAT_INC(s, n_cf);
+
+		s->tx_offset += len;
+		s->timer_us   = s->min_st_us;
+
+		if (s->tx_offset >= s->ff_dl) {
+			_iso_tp_session_tx_done(self, s, ISO_TP_N_RESULT_N_OK);
+		} else if (s->bs > 0u) {
+			s->bs_left--;
+
+			if (s->bs_left == 0u) {
+				s->state    =
+					(uint8_t)_ISO_TP_SESSION_TX_WAIT_FC;
+				s->timer_us = _iso_tp_timeout_us(
+						self->_cfg.n_bs_ms);
+			}
+		} else {}
+	}
+}
+
+/** Timer part of the step: count down session timers, handle timeouts.
+ *  Expired sessions release their buffers at once, so pool is recycled
+ *  even if report is postponed. */
+void _iso_tp_timer_step(struct iso_tp *self, uint32_t delta_time_us)
+{
+	bool expired = false;
+	uint16_t i;
+
+	for (i = 0u; (i < ISO_TP_MAX_SESSIONS) && (self->_n_sessions > 0u) &&
+		     (delta_time_us > 0u); i++) {
+		struct _iso_tp_session *s = &self->_sessions[i];
+		bool timeout;
+
+		if (!s->used || (s->timer_us == 0u)) {
+			continue;
+		}
+
+		timeout     = (s->timer_us <= delta_time_us);
+		s->timer_us = timeout ? 0u : (s->timer_us - delta_time_us);
+
+		if (!timeout) {
+			/* Keep counting */
+		} else if ((s->state == (uint8_t)_ISO_TP_SESSION_RX) &&
+			   s->fc_pending && (s->wft > 0u) &&
+			   (s->wft < self->_cfg.fc_wft_max)) {
+			/* Still busy, ask sender to wait more */
+			_iso_tp_session_rx_fc(self, s, true);
+		} else if (s->state == (uint8_t)_ISO_TP_SESSION_RX) {
+			uint8_t n_result;
+
+			n_result = (uint8_t)ISO_TP_N_RESULT_N_TIMEOUT_CR;
+
+			if (s->fc_pending && (self->_cfg.fc_wft_max == 0u) &&
+			    _iso_tp_send_fc(self, s->id, s->n_ae,
+					    (uint8_t)ISO_TP_FS_OVFLW, 0u, 0u)) {
+				/* Still no room and FC.WAIT is not used,
+				 * sender aborts instead of waiting N_Bs */
+				n_result = (uint8_t)
+					   ISO_TP_N_RESULT_N_BUFFER_OVFLW;
+
+				ISO_TP_STAT_INC(self, ovflw);
+			} else {
+				ISO_TP_STAT_INC(self, timeouts_cr);
+			}
+
+			if ((s->buf != NULL) || s->stream) {
+				/* Reassembly was requested, indicate it */
+				_iso_tp_buf_free(self, s);
+
+				s->state    = (uint8_t)_ISO_TP_SESSION_RX_DONE;
+				s->n_result = n_result;
+				self->_n_done++;
+			} else {
+				s->state = (uint8_t)_ISO_TP_SESSION_EXPIRED;
+				expired  = true;
+			}
+		} else if (s->state == (uint8_t)_ISO_TP_SESSION_TX_WAIT_FC) {
+			ISO_TP_STAT_INC(self, timeouts_bs);
+
+			_iso_tp_session_tx_done(self, s,
+						ISO_TP_N_RESULT_N_TIMEOUT_BS);
+		} else {
+			/* STmin has passed */
+		}
+	}
+
+	/* Sweep silently expired sessions. Closing shifts entries back,
+	 * so the same slot is checked again. Bounded by 2x table size */
+	i = 0u;
+	while (expired && (i < ISO_TP_MAX_SESSIONS)) {
+		struct _iso_tp_session *s = &self->_sessions[i];
+
+		if (s->used && (s->state == (uint8_t)_ISO_TP_SESSION_EXPIRED)) {
+			_iso_tp_session_close(self, s);
+		} else {
+			i++;
+		}
+	}
+}
+
+/** Transmission part of the step: transmit pending CFs and FCs
+ *  of all sessions */
+void _iso_tp_tx_step(struct iso_tp *self)
+{
+	uint16_t i;
+
+	for (i = 0u; (i < ISO_TP_MAX_SESSIONS) &&
+		     ((self->_tx_count > 0u) || (self->_fc_count > 0u)); i++) {
+		struct _iso_tp_session *s = &self->_sessions[i];
+
+		if (!s->used) {
+			/* Free slot */
+		} else if (s->state == (uint8_t)_ISO_TP_SESSION_TX_CF) {
+			_iso_tp_session_tx_cf(self, s);
+		} else if ((s->state == (uint8_t)_ISO_TP_SESSION_RX) &&
+			   s->fc_pending) {
+			_iso_tp_session_rx_fc(self, s, false);
+		} else {}
+	}
+}
+
+/** Report one finished session to user: confirm transmission or indicate
+ *  failed reception. Returns resulting event */
+enum iso_tp_event _iso_tp_report(struct iso_tp *self)
+{
+	enum iso_tp_event ev = ISO_TP_EVENT_NONE;
+
+	uint16_t i;
+
+	for (i = 0u; (i < ISO_TP_MAX_SESSIONS) && (self->_n_done > 0u);
+	     i++) {
+		struct _iso_tp_session *s = &self->_sessions[i];
+
+		if (!s->used) {
+			/* Skip */
+		} else if (s->state == (uint8_t)_ISO_TP_SESSION_TX_DONE) {
+			self->_ind.id       = s->tx_id;
+			self->_ind.n_ae     = s->tx_ae;
+			self->_ind.data     = s->tx_data;
+			self->_ind.len      = s->ff_dl;
+			self->_ind.n_result = s->n_result;
+#ifdef ISO_TP_CRC32
+			self->_ind.crc      = 0u;
+#endif
+
+			self->_tx_count--;
+
+			ev = ISO_TP_EVENT_N_USDATA_CON;
+		} else if (s->state == (uint8_t)_ISO_TP_SESSION_RX_DONE) {
+			/* Buffer is already gone, report received length */
+			self->_ind.id       = s->id;
+			self->_ind.n_ae     = s->n_ae;
+			self->_ind.data     = NULL;
+			self->_ind.len      = s->ff_dl - s->cf_left;
+			self->_ind.n_result = s->n_result;
+#ifdef ISO_TP_CRC32
+			self->_ind.crc      = ~s->crc;
+#endif
+
+			ev = ISO_TP_EVENT_N_USDATA_IND;
+		} else {
+			/* Skip */
+		}
+
+		if (ev != ISO_TP_EVENT_NONE) {
+			self->_has_ind = true;
+
+			self->_n_done--;
+			_iso_tp_session_close(self, s);
+			break;
+		}
+	}
+
+	return ev;
+}
+
+/** Get indication (complete message) or confirmation (transmitted
+ *  message) of the last step, see ISO_TP_EVENT_N_USDATA_IND and
+ *  ISO_TP_EVENT_N_USDATA_CON. Received message data stays valid until the
+ *  next iso_tp_step call. Returns false if the last step produced none */
+bool iso_tp_get_n_usdata(struct iso_tp *self, struct iso_tp_n_usdata *ind)
+{
+	bool result = false;
+
+	if (self->_has_ind) {
+		*ind = self->_ind;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Length of N_PCI encoded at pci (see _iso_tp_encode_n_pdu), N_Data
+ *  follows it. FC carries no N_Data */
+uint8_t _iso_tp_pci_len(uint8_t n_pcitype, const uint8_t *pci)
+{
+	uint8_t result = 1u;
+
+	if (n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_SF) {
+		/* CAN FD SF uses escape sequence (SF_DL in byte 1) */
+		result = ((pci[0] & 0x0Fu) == 0u) ? 2u : 1u;
+	} else if (n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_FF) {
+		/* FF_DL = 0 is followed by 32 bit FF_DL */
+		result = (((pci[0] & 0x0Fu) == 0u) && (pci[1] == 0u)) ? 6u : 2u;
+	} else if (n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_FC) {
+		result = 3u;
+	} else {}
+
+	return result;
+}
+
+/** Override N_PDU. Will override internal N_PDU frame and will put TX frame
+ *  into frame queue. That's how the filtering is done!
+ *  Will return false if TX queue is full or no frame is being processed */
+bool iso_tp_override_n_pdu(struct iso_tp *self, struct iso_tp_n_pdu *pdu)
+{
+	bool result = false;
+
+	struct iso_tp_can_frame *slot = _iso_tp_queue_back(&self->_tx_queue);
+
+	uint8_t off = _ISO_TP_PCI_OFFSET(self);
+	uint8_t head;
+	uint8_t room;
+
+	if ((slot != NULL) && (self->_rx_frame != NULL)) {
+		/* Set TX ID same as RX, since we override frame */
+		slot->id = self->_rx_frame->id;
+
+		_iso_tp_encode_n_pdu(self, pdu, slot);
+
+		/* N_Data follows N_PCI, padding of CAN FD frame (if any)
+		 * follows N_Data */
+		head = off + _iso_tp_pci_len(pdu->n_pci.n_pcitype,
+					     &slot->data[off]);
+		room = (slot->len > head) ? (uint8_t)(slot->len - head) : 0u;
+
+		if (pdu->n_pci.n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_FC) {
+			room = 0u;
+		}
+
+		/* Current N_PDU now refers to the overriden frame */
+		self->_n_pci      = pdu->n_pci;
+		self->_len_n_data = (room >= pdu->len_n_data) ?
+				    pdu->len_n_data : room;
+		self->_n_data     = &slot->data[head];
+
+		/* Overriden frame is already on its way */
+		self->_patch_data = NULL;
+
+		_iso_tp_queue_commit(&self->_tx_queue);
+
+		ISO_TP_STAT_INC(self, overrides);
+
+		result = true;
+	} else if (self->_rx_frame != NULL) {
+		ISO_TP_STAT_INC(self, tx_drops);
+	} else {}
+
+	return result;
+}
+
+/** Patch message in place: write len bytes at message offset msg_offset
+ *  (offset within N_USData, FF payload starts at 0). Only the part which
+ *  falls into N_Data of the current frame (SF, FF or CF) is written,
+ *  straight into the received frame, so it may be forwarded with no
+ *  re-encode (see iso_tp_peek_frame). Reassembly buffer is patched as well.
+ *  Call it for every frame of message to patch range spanning several CFs.
+ *  Returns number of bytes written, 0 if range is not in this frame or
+ *  frame can't be patched (overriden or pushed by iso_tp_push_frames).
+ *  @note Not standard */
+uint8_t iso_tp_patch(struct iso_tp *self, uint32_t msg_offset,
+		     const uint8_t *bytes, uint32_t len)
+{
+	uint8_t result = 0u;
+
+	uint32_t begin = self->_msg_offset;
+	uint32_t end   = self->_msg_offset + self->_len_n_data;
+	uint32_t from  = (msg_offset > begin) ? msg_offset : begin;
+	uint32_t to    = ((len > (end - msg_offset)) || (msg_offset > end)) ?
+			 end : (msg_offset + len);
+
+	if ((self->_patch_data != NULL) && (from < to)) {
+		(void)memcpy(&self->_patch_data[from - begin],
+			     &bytes[from - msg_offset], to - from);
+
+		if (self->_msg_buf != NULL) {
+			(void)memcpy(&self->_msg_buf[from],
+				     &bytes[from - msg_offset], to - from);
+		}
+
+		result = (uint8_t)(to - from);
+
+		ISO_TP_STAT_INC(self, patches);
+	}
+
+	return result;
+}
+
+#ifdef ISO_TP_STATS
+/** Append entry to trace ring, the oldest one is lost if ring is full */
+void _iso_tp_trace(struct iso_tp *self, uint32_t id, enum iso_tp_event ev)
+{
+	struct iso_tp_trace_entry *e;
+
+	if ((uint16_t)(self->_trace_head - self->_trace_tail) >=
+	    ISO_TP_TRACE_LEN) {
+		self->_trace_tail++;
+		self->_stats.trace_lost++;
+	}
+
+	e = &self->_trace[self->_trace_head & (ISO_TP_TRACE_LEN - 1u)];
+
+	e->time_us     = self->_time_us;
+	e->id          = id;
+	e->n_pcitype   = self->_n_pci.n_pcitype;
+	e->ev          = (uint8_t)ev;
+	e->reserved[0] = 0u;
+	e->reserved[1] = 0u;
+
+	self->_trace_head++;
+}
+
+/** Copy instance counters (requires ISO_TP_STATS). @note Not standard */
+void iso_tp_get_stats(struct iso_tp *self, struct iso_tp_stats *stats)
+{
+	*stats = self->_stats;
+}
+
+/** Zero instance counters (requires ISO_TP_STATS). Counters written by
+ *  producer (see iso_tp_push_frame) must not be counted meanwhile.
+ *  @note Not standard */
+void iso_tp_reset_stats(struct iso_tp *self)
+{
+	(void)memset(&self->_stats, 0u, sizeof(struct iso_tp_stats));
+}
+
+/** Copy counters of ongoing transfer. Sessions are looked up by CAN ID
+ *  peer transmits on (sender ID of reception, FC ID of transmission) and
+ *  by address byte of its frames (n_ae, 0 for normal addressing).
+ *  Returns false if there's no session (requires ISO_TP_STATS).
+ *  @note Not standard */
+bool iso_tp_get_session_stats(struct iso_tp *self, uint32_t id, uint8_t n_ae,
+			      struct iso_tp_session_stats *stats)
+{
+	bool result = false;
+
+	struct _iso_tp_session *s = _iso_tp_session_find(self, id, n_ae);
+
+	if (s != NULL) {
+		*stats = s->stats;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Pop the oldest trace entry, one per step with frame or event (and per
+ *  reported frame of iso_tp_push_frames). Must be called from the same
+ *  context as iso_tp_step. Returns false if ring is empty
+ *  (requires ISO_TP_STATS). @note Not standard */
+bool iso_tp_trace_pop(struct iso_tp *self, struct iso_tp_trace_entry *e)
+{
+	bool result = false;
+
+	if (self->_trace_head != self->_trace_tail) {
+		*e = self->_trace[self->_trace_tail & (ISO_TP_TRACE_LEN - 1u)];
+		self->_trace_tail++;
+
+		result = true;
+	}
+
+	return result;
+}
+#endif
+
+/** Main instance state machine. Works step by step. Returns events during
+ *  operation. Must be run inside main loop.
+ *  Microsecond resolution variant, required for STmin of 100-900 us. */
+enum iso_tp_event iso_tp_step_us(struct iso_tp *self, uint32_t delta_time_us)
+{
+	/* Commonly used */
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	enum iso_tp_event ev = ISO_TP_EVENT_NONE;
+
+	bool passthrough = false; /* Passthrough received messages */
+
+	(void)self;
+	switch (self->_state) {
 	case _ISO_TP_STATE_CONFIG:
+		/* Pinned configuration takes precedence over the runtime one,
+		 * so iso_tp_get_config reports the actual values */
+#ifdef ISO_TP_FIXED_TX_DL
+		self->_cfg.tx_dl = _ISO_TP_TX_DL(self);
+#endif
+#ifdef ISO_TP_FIXED_RX_DL
+		self->_cfg.rx_dl = _ISO_TP_RX_DL(self);
+#endif
+#ifdef ISO_TP_FIXED_ADDRESSING
+		self->_cfg.addr_format = _ISO_TP_ADDR_FORMAT(self);
+#endif
+
+		/* Max RX_DL is not limited by default */
+		if (self->_cfg.rx_dl == 0u) {
+			self->_cfg.rx_dl = ISO_TP_MAX_CAN_DL;
+		}
+
 		/* Mode and MTU must be set correctly */
-		if (self->_cfg.tx_dl < 8u) {
+		if ((self->_cfg.tx_dl < 8u) ||
+		    !_iso_tp_can_dl_valid(self->_cfg.tx_dl) ||
+		    (self->_cfg.rx_dl < 8u) ||
+		    !_iso_tp_can_dl_valid(self->_cfg.rx_dl) ||
+		    (self->_cfg.addr_format >
+		     (uint8_t)ISO_TP_ADDR_FORMAT_MIXED)) {
+			ev = ISO_TP_EVENT_INVALID_CONFIG;
+			break;
+		}
+
+		/* Acceptance filter and rules must fit their tables */
+		if (!_iso_tp_filter_compile(self) ||
+		    !_iso_tp_rules_compile(self)) {
 			ev = ISO_TP_EVENT_INVALID_CONFIG;
 			break;
 		}
 
-		/* Min DLC min_ff_dl (see Table 14)
-		 * TODO addressing types
-		 * Only normal addressing mode is supported yet */
+		/* Address byte shifts N_PCI, so frame layout is computed
+		 * once instead of per frame */
+		self->_pci_offset = (self->_cfg.addr_format ==
+				     (uint8_t)ISO_TP_ADDR_FORMAT_NORMAL) ?
+				    0u : 1u;
+
+		self->_tx_sf_max = _iso_tp_max_sf_dl(self->_cfg.tx_dl,
+						     _ISO_TP_PCI_OFFSET(self));
+		self->_tx_ff_len = self->_cfg.tx_dl - 2u -
+				   _ISO_TP_PCI_OFFSET(self);
+		self->_tx_cf_len = self->_cfg.tx_dl - 1u -
+				   _ISO_TP_PCI_OFFSET(self);
+
+		/* Min DLC min_ff_dl (see Table 14) */
 		if (self->_cfg.tx_dl == 8u) {
-			self->_cfg.min_ff_dl = 8u;
+			self->_cfg.min_ff_dl = 8u - _ISO_TP_PCI_OFFSET(self);
 		} else if (self->_cfg.tx_dl > 8u) {
-			self->_cfg.min_ff_dl = self->_cfg.tx_dl - 1u;
+			self->_cfg.min_ff_dl = self->_cfg.tx_dl - 1u -
+					       _ISO_TP_PCI_OFFSET(self);
 		} else {}
 
 		/* @@ PREPARE TRANSITION TO THE NEXT STATE @@ */
@@ -587,23 +3385,92 @@ enum iso_tp_event iso_tp_step(struct iso_tp *self, uint32_t delta_time_ms)
 
 	case _ISO_TP_STATE_LISTEN_N_PDU: {
 		/* Invalidate N_PDU before all */
-		n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+		n_pci->n_pcitype  = ISO_TP_N_PCITYPE_INVALID;
+		self->_has_ind    = false;
+		self->_has_chunk  = false;
+		self->_msg_buf    = NULL;
+		self->_patch_data = NULL;
+		self->_edited     = false;
+
+		/* Previous frame has been processed, give its slot back */
+		if ((self->_rx_frame != NULL) && !self->_rx_lent) {
+			_iso_tp_queue_release(&self->_rx_queue);
+		}
 
-		if (!self->_has_rx) {
-			break;
+		/* Lent frame always precedes queued ones (see lend) */
+		if (self->_lent_frame != NULL) {
+			self->_rx_frame   = self->_lent_frame;
+			self->_rx_lent    = true;
+			self->_lent_frame = NULL;
+		} else {
+			self->_rx_frame = _iso_tp_queue_front(&self->_rx_queue);
+			self->_rx_lent  = false;
+		}
+
+		/* Time has passed since the previous step */
+		_iso_tp_timer_step(self, delta_time_us);
+
+		if (self->_rx_frame == NULL) {
+			/* Nothing received */
+		} else if (!_iso_tp_filter_accept(self,
+						  self->_rx_frame->id)) {
+			/* Rejected before decoding */
+			passthrough = true;
+
+			ISO_TP_STAT_INC(self, passthrough);
+		} else {
+			_iso_tp_decode_n_pdu(self, self->_rx_frame);
 		}
 
-		_iso_tp_decode_n_pdu(self, &self->_can_rx_frame);
+		/* N_Data of received frame may be patched in place */
+		if ((self->_rx_frame != NULL) &&
+		    (n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_INVALID) &&
+		    (n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_FC)) {
+			self->_patch_data = &self->_rx_frame->data[
+				self->_n_data - self->_rx_frame->data];
+
+			if (self->_cfg.n_rules > 0u) {
+				_iso_tp_rules_step(self, self->_rx_frame->id);
+			}
 
-		/* We've already decoded rx frame, wait for the next frame. */
-		self->_has_rx = false;
+			if (self->_edited) {
+				ISO_TP_STAT_INC(self, edits);
+			}
+		}
 
-		if (n_pci->n_pcitype == (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
+		if (self->_has_ind) {
+			ev = ISO_TP_EVENT_N_USDATA_IND;
+		} else if (self->_has_chunk) {
+			ev = ISO_TP_EVENT_N_USDATA_CHUNK;
+		} else if (n_pci->n_pcitype !=
+			   (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
+			ev = ISO_TP_EVENT_N_PDU;
+		} else if (passthrough) {
+			ev = ISO_TP_EVENT_PASSTHROUGH;
+		} else {
 			/* Ignore frame */
-			break;
 		}
 
-		ev = ISO_TP_EVENT_N_PDU;
+		/* Keep transmitting regardless of received frames */
+		_iso_tp_tx_step(self);
+
+		/* Report only if there's no other event, it will wait */
+		if (ev == ISO_TP_EVENT_NONE) {
+			ev = _iso_tp_report(self);
+		}
+
+#ifdef ISO_TP_STATS
+		self->_time_us += delta_time_us;
+
+		if ((ev == ISO_TP_EVENT_N_USDATA_IND) ||
+		    (ev == ISO_TP_EVENT_N_USDATA_CON)) {
+			_iso_tp_trace(self, self->_ind.id, ev);
+		} else if (self->_rx_frame != NULL) {
+			_iso_tp_trace(self, self->_rx_frame->id, ev);
+		} else if (ev != ISO_TP_EVENT_NONE) {
+			_iso_tp_trace(self, 0u, ev);
+		} else {}
+#endif
 
 		break;
 	}
@@ -615,3 +3482,173 @@ enum iso_tp_event iso_tp_step(struct iso_tp *self, uint32_t delta_time_ms)
 
 	return ev;
 }
+
+/** Main instance state machine. Works step by step. Returns events during
+ *  operation. Must be run inside main loop. */
+enum iso_tp_event iso_tp_step(struct iso_tp *self, uint32_t delta_time_ms)
+{
+	/* Timers have microsecond resolution */
+	uint32_t delta_time_us = (delta_time_ms < (0xFFFFFFFFu / 1000u)) ?
+				 (delta_time_ms * 1000u) : 0xFFFFFFFFu;
+
+	return iso_tp_step_us(self, delta_time_us);
+}
+
+/** Same as iso_tp_step, but processes up to max_frames queued frames in a
+ *  single call. Stops early on the first event, so no N_PDU is lost, or
+ *  when RX queue runs empty. Frames that produce no event (ignored ones)
+ *  are drained without returning to the caller. */
+enum iso_tp_event iso_tp_step_burst(struct iso_tp *self, uint32_t delta_time_ms,
+				    uint8_t max_frames)
+{
+	enum iso_tp_event ev = ISO_TP_EVENT_NONE;
+
+	uint8_t i;
+
+	for (i = 0u; i < max_frames; i++) {
+		/* Time passes only once per call */
+		ev = iso_tp_step(self, (i == 0u) ? delta_time_ms : 0u);
+
+		if ((ev != ISO_TP_EVENT_NONE) || (self->_rx_frame == NULL)) {
+			break;
+		}
+	}
+
+	return ev;
+}
+
+/** Describe contiguous array of struct iso_tp_can_frame as frame view */
+void iso_tp_frame_view_init(struct iso_tp_frame_view *view,
+			    const struct iso_tp_can_frame *frames,
+			    uint16_t count)
+{
+	view->base   = (const uint8_t *)frames;
+	view->count  = count;
+	view->stride = (uint16_t)sizeof(struct iso_tp_can_frame);
+
+	view->id_offset   = (uint16_t)offsetof(struct iso_tp_can_frame, id);
+	view->len_offset  = (uint16_t)offsetof(struct iso_tp_can_frame, len);
+	view->data_offset = (uint16_t)offsetof(struct iso_tp_can_frame, data);
+
+	view->id_mask = 0xFFFFFFFFu;
+}
+
+/** Batch variant of iso_tp_lend_frame + iso_tp_step. Frames of view are
+ *  decoded in place, in one pass. Each frame which produced an event
+ *  (including ISO_TP_EVENT_PASSTHROUGH) gets a descriptor (desc must have
+ *  room for view->count of them), n_desc is set to their number.
+ *  Stops after ISO_TP_EVENT_N_USDATA_IND, so iso_tp_get_n_usdata can be
+ *  called before the rest is pushed.
+ *  Time does not pass and sessions are not reported, iso_tp_step does it.
+ *  Frames must stay valid and unmodified till the next call of step.
+ *  Returns number of frames processed, 0 if busy: frame is lent or RX
+ *  queue is not empty (frames must not be reordered). */
+uint16_t iso_tp_push_frames(struct iso_tp *self,
+			    const struct iso_tp_frame_view *view,
+			    struct iso_tp_frame_desc *desc, uint16_t *n_desc)
+{
+	struct iso_tp_n_pci *n_pci = &self->_n_pci;
+
+	uint16_t i = 0u;
+	uint16_t n = 0u;
+
+	if (self->_state != (uint8_t)_ISO_TP_STATE_LISTEN_N_PDU) {
+		/* Not ready */
+	} else if ((self->_lent_frame != NULL) ||
+		   ((uint8_t)(self->_rx_queue.head - self->_rx_queue.tail) >
+		    (((self->_rx_frame != NULL) && !self->_rx_lent) ?
+		     1u : 0u))) {
+		/* Busy */
+	} else {
+		/* Previous frame has been processed, give its slot back */
+		if ((self->_rx_frame != NULL) && !self->_rx_lent) {
+			_iso_tp_queue_release(&self->_rx_queue);
+		}
+
+		/* Batch frames can't be overriden or patched */
+		self->_rx_frame   = NULL;
+		self->_rx_lent    = false;
+		self->_patch_data = NULL;
+
+		n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+		self->_has_ind   = false;
+		self->_has_chunk = false;
+
+		for (i = 0u; i < view->count; i++) {
+			const uint8_t *frame = &view->base[(uint32_t)i *
+							   view->stride];
+			const uint8_t *data  = &frame[view->data_offset];
+			uint32_t id;
+
+			(void)memcpy(&id, &frame[view->id_offset],
+				     sizeof(uint32_t));
+
+			n_pci->n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+			self->_has_ind   = false;
+			self->_has_chunk = false;
+			self->_msg_buf   = NULL;
+
+			id &= view->id_mask;
+
+			if (!_iso_tp_filter_accept(self, id)) {
+				ISO_TP_STAT_INC(self, passthrough);
+
+				desc[n].index     = i;
+				desc[n].ev        = (uint8_t)
+						    ISO_TP_EVENT_PASSTHROUGH;
+				desc[n].n_pcitype = (uint8_t)
+						    ISO_TP_N_PCITYPE_INVALID;
+				desc[n].offset    = 0u;
+				desc[n].len       = 0u;
+				desc[n].cf_err    = false;
+				desc[n].msg_offset = 0u;
+				n++;
+
+#ifdef ISO_TP_STATS
+				_iso_tp_trace(self, id,
+					      ISO_TP_EVENT_PASSTHROUGH);
+#endif
+				continue;
+			}
+
+			_iso_tp_decode(self, id, frame[view->len_offset], data);
+
+			if (n_pci->n_pcitype ==
+			    (uint8_t)ISO_TP_N_PCITYPE_INVALID) {
+				/* Ignore frame */
+				continue;
+			}
+
+			desc[n].index     = i;
+			desc[n].ev        = self->_has_ind ?
+				(uint8_t)ISO_TP_EVENT_N_USDATA_IND :
+				(self->_has_chunk ?
+				 (uint8_t)ISO_TP_EVENT_N_USDATA_CHUNK :
+				 (uint8_t)ISO_TP_EVENT_N_PDU);
+			desc[n].n_pcitype = n_pci->n_pcitype;
+			desc[n].offset    = (uint8_t)(self->_n_data - data);
+			desc[n].len       = self->_len_n_data;
+			desc[n].cf_err    = self->_cf_err;
+			desc[n].msg_offset = self->_msg_offset;
+			n++;
+
+#ifdef ISO_TP_STATS
+			_iso_tp_trace(self, id,
+				      (enum iso_tp_event)desc[n - 1u].ev);
+#endif
+
+			/* Indication must be taken before the next frame */
+			if (self->_has_ind) {
+				i++;
+				break;
+			}
+		}
+
+		/* Transmit what received FCs allowed */
+		_iso_tp_tx_step(self);
+	}
+
+	*n_desc = n;
+
+	return i;
+}
@@ -1,4 +1,23 @@
+/* Tests cover CAN FD frames as well */
+#define ISO_TP_MAX_CAN_DL 64u
+
+/* And counters, unless the default configuration is tested (see makefile) */
+#ifndef ISO_TP_TEST_DEFAULT
+#ifndef ISO_TP_STATS
+#define ISO_TP_STATS
+#endif
+
+/* And content hash of messages */
+#ifndef ISO_TP_CRC32
+#define ISO_TP_CRC32
+#endif
+#endif
+
+#include "iso_tp_gateway.h" /* Before iso_tp.h, see its description */
 #include "iso_tp.h"
+#include "iso_tp_capture.h"
+#include "iso_tp_sched.h"
+#include "iso_tp_simd.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -10,8 +29,10 @@
  *****************************************************************************/
 void iso_tp_print_n_pdu(struct iso_tp *self)
 {
-	struct iso_tp_n_pdu *n_pdu    = &self->_n_pdu;
-	struct iso_tp_n_pci *n_pci    = &self->_n_pdu.n_pci;
+	struct iso_tp_n_pdu  pdu;
+	struct iso_tp_n_pdu *n_pdu    = &pdu;
+	struct iso_tp_n_pci *n_pci    = &pdu.n_pci;
+	struct iso_tp_config cfg;
 
 	uint8_t i;
 
@@ -23,6 +44,13 @@ void iso_tp_print_n_pdu(struct iso_tp *self)
 		"ISO_TP_N_PCITYPE_INVALID"
 	};
 
+	if (!iso_tp_get_n_pdu(self, &pdu)) {
+		pdu.n_pci.n_pcitype = ISO_TP_N_PCITYPE_INVALID;
+		pdu.len_n_data      = 0u;
+	}
+
+	iso_tp_get_config(self, &cfg);
+
 	printf("-- N_PDU BEGIN --\n");
 	printf("\tN_PCI_Type: %s\n", n_pcitype_str[n_pci->n_pcitype]);
 
@@ -32,7 +60,7 @@ void iso_tp_print_n_pdu(struct iso_tp *self)
 		break;
 
 	case ISO_TP_N_PCITYPE_FF:
-		printf("\t\tmin(FF_DL): %u\n", self->_cfg.min_ff_dl);
+		printf("\t\tmin(FF_DL): %u\n", cfg.min_ff_dl);
 		printf("\t\tFF_DL     : %u\n", n_pci->ff_dl);
 		break;
 
@@ -71,6 +99,33 @@ void iso_tp_print_can_frame(struct iso_tp_can_frame *f)
 	printf("\n");
 }
 
+/** Push single frame and step, returns resulting event */
+enum iso_tp_event iso_tp_test_push(struct iso_tp *self, uint32_t id,
+				   uint8_t len, const uint8_t *data)
+{
+	struct iso_tp_can_frame f;
+
+	f.id  = id;
+	f.len = len;
+	memcpy(&f.data, data, len);
+
+	assert(iso_tp_push_frame(self, &f));
+
+	return iso_tp_step(self, 0u);
+}
+
+/** Init and configure instance for CAN2.0 */
+void iso_tp_test_setup(struct iso_tp *self)
+{
+	struct iso_tp_config cfg;
+
+	iso_tp_init(self);
+	iso_tp_get_config(self, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(self, &cfg);
+	assert(iso_tp_step(self, 0u) == ISO_TP_EVENT_NONE);
+}
+
 /******************************************************************************
  * TESTS
  *****************************************************************************/
@@ -80,8 +135,10 @@ void iso_tp_test_init(struct iso_tp *self)
 
 	iso_tp_init(self);
 
-	/* Usage without configuration must fail */
+#ifndef ISO_TP_FIXED_TX_DL
+	/* Usage without configuration must fail (pinned one is valid) */
 	assert(iso_tp_step(self, 0u) == ISO_TP_EVENT_INVALID_CONFIG);
+#endif
 
 	/* Get current configuration */
 	iso_tp_get_config(self, &cfg);
@@ -112,7 +169,7 @@ void iso_tp_test_example_log(struct iso_tp *self)
 		/* Push frame into iso_tp state machine */
 		iso_tp_push_frame(self, &f);
 		assert(iso_tp_step(self, 0u) == ISO_TP_EVENT_N_PDU);
-		iso_tp_print_n_pdu(self); /* TODO no private access */
+		iso_tp_print_n_pdu(self);
 	}
 }
 
@@ -191,13 +248,2208 @@ void iso_tp_test_override(struct iso_tp *self)
 	}
 }
 
-int main ()
+/** Interleaved multiframe transfers of different IDs must not affect
+ *  sequence tracking of each other */
+void iso_tp_test_sessions(void)
 {
 	struct iso_tp tp;
+	struct iso_tp_n_pdu n_pdu;
+	uint32_t i;
 
-	iso_tp_test_init(&tp);
-	/* iso_tp_test_example_log(&tp); */
-	iso_tp_test_override(&tp);
+	const uint8_t ff[8]  = {0x10u, 0x16u, 0x61u, 0x01u, 1u, 2u, 3u, 4u};
+	const uint8_t cf1[8] = {0x21u, 5u, 6u, 7u, 8u, 9u, 10u, 11u};
+	const uint8_t cf2[8] = {0x22u, 12u, 13u, 14u, 15u, 16u, 17u, 18u};
+	const uint8_t cf3[8] = {0x23u, 19u, 20u, 0u, 0u, 0u, 0u, 0u};
+
+	iso_tp_test_setup(&tp);
+
+	/* Start transfers of many senders at once */
+	for (i = 0u; i < ISO_TP_MAX_SESSIONS; i++) {
+		assert(iso_tp_test_push(&tp, 0x700u + i, 8u, ff) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(!iso_tp_has_cf_err(&tp));
+	}
+
+	/* Session table is full now */
+	assert(iso_tp_test_push(&tp, 0x6FFu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_has_cf_err(&tp));
+	assert(iso_tp_test_push(&tp, 0x6FFu, 8u, cf1) == ISO_TP_EVENT_NONE);
+
+	/* Interleave CFs, every sender keeps its own sequence */
+	for (i = 0u; i < ISO_TP_MAX_SESSIONS; i++) {
+		assert(iso_tp_test_push(&tp, 0x700u + i, 8u, cf1) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(!iso_tp_has_cf_err(&tp));
+	}
+
+	/* Wrong SN breaks only one session */
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, cf3) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_has_cf_err(&tp));
+
+	for (i = 1u; i < ISO_TP_MAX_SESSIONS; i++) {
+		assert(iso_tp_test_push(&tp, 0x700u + i, 8u, cf2) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(!iso_tp_has_cf_err(&tp));
+	}
+
+	/* Last CF must carry only remaining data, then session is closed */
+	for (i = 1u; i < ISO_TP_MAX_SESSIONS; i++) {
+		assert(iso_tp_test_push(&tp, 0x700u + i, 8u, cf3) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(iso_tp_get_n_pdu(&tp, &n_pdu));
+		assert(n_pdu.len_n_data == 2u);
+		assert(n_pdu.n_data[1] == 20u);
+		assert(!iso_tp_has_cf_err(&tp));
+
+		assert(iso_tp_test_push(&tp, 0x700u + i, 8u, cf1) ==
+		       ISO_TP_EVENT_NONE);
+	}
+
+	/* Freed sessions may be reused */
+	assert(iso_tp_test_push(&tp, 0x6FFu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_has_cf_err(&tp));
+	assert(iso_tp_test_push(&tp, 0x6FFu, 8u, cf1) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_has_cf_err(&tp));
+}
+
+/** Back-to-back frames must be queued until the main loop gets to them */
+void iso_tp_test_queues(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_can_frame f;
+	struct iso_tp_n_pdu n_pdu;
+	uint32_t i;
+
+	iso_tp_test_setup(&tp);
+
+	/* Simulate ISR burst: FF, CFs and some junk frames */
+	f.id      = 0x7BBu;
+	f.len     = 8u;
+	f.data[0] = 0x10u;
+	f.data[1] = 60u;
+	assert(iso_tp_push_frame(&tp, &f));
+
+	for (i = 1u; i < ISO_TP_QUEUE_LEN; i++) {
+		f.data[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+
+		/* Every second one is junk (invalid PCI) */
+		if ((i & 1u) == 0u) {
+			f.data[0] = 0xF0u;
+		}
+
+		assert(iso_tp_push_frame(&tp, &f));
+	}
+
+	/* Queue is full */
+	assert(!iso_tp_push_frame(&tp, &f));
+
+	/* Nothing is lost, junk is drained silently */
+	assert(iso_tp_step_burst(&tp, 0u, 4u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_get_n_pdu(&tp, &n_pdu));
+	assert(n_pdu.n_pci.n_pcitype == ISO_TP_N_PCITYPE_FF);
+
+	for (i = 1u; i < ISO_TP_QUEUE_LEN; i += 2u) {
+		assert(iso_tp_step_burst(&tp, 0u, 4u) == ISO_TP_EVENT_N_PDU);
+		assert(iso_tp_get_n_pdu(&tp, &n_pdu));
+		assert(n_pdu.n_pci.n_pcitype == ISO_TP_N_PCITYPE_CF);
+		assert(n_pdu.n_pci.sn == (i & 0x0Fu));
+
+		/* Junk SN gap is reported as CF error, but not the first */
+		assert(iso_tp_has_cf_err(&tp) == (i > 1u));
+
+		/* Overrides are queued too */
+		assert(iso_tp_override_n_pdu(&tp, &n_pdu));
+	}
+
+	/* Drained */
+	assert(iso_tp_step_burst(&tp, 0u, 4u) == ISO_TP_EVENT_NONE);
+
+	/* All overrides are transmitted in order */
+	for (i = 1u; i < ISO_TP_QUEUE_LEN; i += 2u) {
+		assert(iso_tp_pop_frame(&tp, &f));
+		assert(f.id == 0x7BBu);
+		assert(f.data[0] == (0x20u | (i & 0x0Fu)));
+	}
+
+	assert(!iso_tp_pop_frame(&tp, &f));
+}
+
+/** Payload must be referenced in place, lent frames must not be copied */
+void iso_tp_test_zero_copy(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_can_frame f;
+	struct iso_tp_can_frame q;
+
+	const struct iso_tp_n_pci *n_pci;
+	const uint8_t *n_data;
+	uint8_t len_n_data;
+
+	iso_tp_test_setup(&tp);
+
+	/* Nothing to peek yet */
+	assert(!iso_tp_peek_n_pdu(&tp, &n_pci, &n_data, &len_n_data));
+
+	f.id      = 0x79Bu;
+	f.len     = 8u;
+	f.data[0] = 0x02u;
+	f.data[1] = 0x21u;
+	f.data[2] = 0x01u;
+
+	assert(iso_tp_lend_frame(&tp, &f));
+	assert(!iso_tp_lend_frame(&tp, &f)); /* Only one at a time */
+
+	/* Frame pushed after lent one must be processed after it */
+	q = f;
+	q.data[2] = 0x04u;
+	assert(iso_tp_push_frame(&tp, &q));
+	assert(!iso_tp_lend_frame(&tp, &f)); /* Queue is not empty */
+
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_peek_n_pdu(&tp, &n_pci, &n_data, &len_n_data));
+	assert(n_pci->n_pcitype == ISO_TP_N_PCITYPE_SF);
+	assert(len_n_data == 2u);
+	assert(n_data == &f.data[1]); /* Points into driver memory */
+
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_peek_n_pdu(&tp, NULL, &n_data, NULL));
+	assert(n_data[1] == 0x04u);
+
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_peek_n_pdu(&tp, NULL, NULL, NULL));
+
+	/* Slot of processed frame is held till the next step, yet queue is
+	 * empty for lending */
+	assert(iso_tp_push_frame(&tp, &q));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_lend_frame(&tp, &f));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_peek_n_pdu(&tp, NULL, &n_data, NULL));
+	assert(n_data == &f.data[1]);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+}
+
+/** Messages of example log must be reassembled by ISO-TP itself */
+void iso_tp_test_reassembly(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	size_t i;
+
+	static uint8_t buf[64];
+
+	uint32_t n_resp = 0u;
+	uint32_t n_req  = 0u;
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, buf, sizeof(buf)));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* Too late to set buffer */
+	assert(!iso_tp_set_rx_buffer(&tp, buf, sizeof(buf)));
+
+	for (i = 0; i < sizeof(example_log) / sizeof(struct example_can_frame);
+	     i++) {
+		struct iso_tp_can_frame f;
+		enum iso_tp_event ev;
+
+		f.id   = example_log[i].id;
+		f.len  = example_log[i].dlc;
+		memcpy(&f.data, example_log[i].data, f.len);
+
+		assert(iso_tp_push_frame(&tp, &f));
+		ev = iso_tp_step(&tp, 0u);
+
+		if (ev != ISO_TP_EVENT_N_USDATA_IND) {
+			assert(ev == ISO_TP_EVENT_N_PDU);
+			assert(!iso_tp_get_n_usdata(&tp, &ind));
+			continue;
+		}
+
+		assert(iso_tp_get_n_usdata(&tp, &ind));
+		assert(ind.n_result == ISO_TP_N_RESULT_N_OK);
+
+		if (ind.id == 0x79Bu) {
+			/* Request: 21 XX */
+			assert(ind.len == 2u);
+			assert(ind.data[0] == 0x21u);
+			n_req++;
+		} else {
+			/* Positive response: 61 XX */
+			assert(ind.id == 0x7BBu);
+			assert(ind.data[0] == 0x61u);
+			n_resp++;
+		}
+
+		/* Known response (see override test) */
+		if ((ind.id == 0x7BBu) && (ind.data[1] == 0x01u)) {
+			assert(ind.len == 41u);
+			assert(ind.data[15] == 0xFFu);
+			assert(ind.data[16] == 0x02u);
+		}
+	}
+
+	assert(n_req  > 0u);
+	assert(n_resp > 0u);
+
+	/* Broken sequence is indicated as well */
+	{
+		const uint8_t ff[8] = {0x10u, 0x10u, 1u, 2u, 3u, 4u, 5u, 6u};
+		const uint8_t cf[8] = {0x22u, 7u, 8u, 9u, 10u, 11u, 12u, 13u};
+
+		assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf) ==
+		       ISO_TP_EVENT_N_USDATA_IND);
+		assert(iso_tp_get_n_usdata(&tp, &ind));
+		assert(ind.n_result == ISO_TP_N_RESULT_N_WRONG_SN);
+		assert(iso_tp_has_cf_err(&tp));
+	}
+}
+
+/** Concurrent receptions share reassembly pool, bound peer gets FC.OVFLW
+ *  once pool is exhausted */
+void iso_tp_test_pool(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame f;
+
+	/* 4 blocks */
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE * 4u];
+
+	const uint8_t ff_small[8] = {0x10u, 0x0Du, 1u, 2u, 3u, 4u, 5u, 6u};
+	const uint8_t cf_small[8] = {0x21u, 7u, 8u, 9u, 10u, 11u, 12u, 13u};
+
+	/* Takes 2 blocks */
+	const uint8_t ff_big[8] = {0x10u, ISO_TP_POOL_BLOCK_SIZE + 1u,
+				   0u, 0u, 0u, 0u, 0u, 0u};
+
+	/* Does not fit pool at all */
+	const uint8_t ff_huge[8] = {0x1Fu, 0xFFu, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	/* Takes 4 blocks */
+	const uint8_t ff_4_blocks[8] = {0x11u, 0x00u, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	/* One byte more than pool of max blocks */
+	static uint8_t pool_max[ISO_TP_POOL_BLOCK_SIZE *
+				ISO_TP_POOL_MAX_BLOCKS];
+
+	const uint8_t ff_over[8] = {
+		(uint8_t)(0x10u | ((sizeof(pool_max) + 1u) >> 8u)),
+		(uint8_t)((sizeof(pool_max) + 1u) & 0xFFu),
+		0u, 0u, 0u, 0u, 0u, 0u
+	};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* Bound peer is too big for pool */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_huge) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.id == 0x79Bu);
+	assert(f.data[0] == 0x32u); /* FC.OVFLW */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_small) ==
+	       ISO_TP_EVENT_NONE);
+
+	/* Unbound node is only listened to, no FC is sent */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, ff_huge) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* Occupy 1 + 2 blocks, then the last one */
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x701u, 8u, ff_big) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x702u, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+
+	/* Pool is exhausted now */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.data[0] == 0x32u);
+
+	/* Receptions complete independently */
+	assert(iso_tp_test_push(&tp, 0x702u, 8u, cf_small) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x702u) && (ind.len == 13u));
+	assert((ind.data[0] == 1u) && (ind.data[12] == 13u));
+
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, cf_small) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.id == 0x700u);
+
+	/* Freed blocks are reused, bound peer is accepted now */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_small) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+
+	/* Restarted reception frees blocks of its previous message, not of
+	 * the new one: 0x700 holds block 0, 0x701 holds block 1 */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x700u, 0x708u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x701u, 8u, ff_small) ==
+	       ISO_TP_EVENT_N_PDU);
+
+	/* No run of 4 blocks is free, block of 0x701 is not given away */
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, ff_4_blocks) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x708u) && (f.data[0] == 0x32u)); /* FC.OVFLW */
+
+	assert(iso_tp_test_push(&tp, 0x701u, 8u, cf_small) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x701u) && (ind.len == 13u));
+	assert((ind.data[0] == 1u) && (ind.data[12] == 13u));
+
+	/* The whole pool is free again */
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, ff_4_blocks) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* Message larger than fully free pool of 32 blocks is rejected */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool_max, sizeof(pool_max)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_over) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.data[0] == 0x32u); /* FC.OVFLW */
+}
+
+/** Segmented transmission must follow FlowControl of the receiver */
+void iso_tp_test_send(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata con;
+	struct iso_tp_can_frame f;
+	uint8_t msg[30];
+	uint8_t i;
+
+	const uint8_t fc_cts_bs2[8] = {0x30u, 2u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t fc_cts_st[8]  = {0x30u, 0u, 10u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t fc_wait[8]    = {0x31u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t fc_ovflw[8]   = {0x32u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	for (i = 0u; i < sizeof(msg); i++) {
+		msg[i] = i;
+	}
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+
+	/* Not configured yet */
+	assert(!iso_tp_send(&tp, 0x79Bu, msg, 2u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* SF, confirmed by the next step */
+	assert(iso_tp_send(&tp, 0x7DFu, msg, 2u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x7DFu) && (f.len == 3u) && (f.data[0] == 0x02u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &con));
+	assert((con.id == 0x7DFu) && (con.n_result == ISO_TP_N_RESULT_N_OK));
+
+	/* Multiframe needs bound peer */
+	assert(!iso_tp_send(&tp, 0x7DFu, msg, sizeof(msg)));
+
+	/* FF, then CF in blocks of 2 */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(!iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg))); /* Busy */
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x79Bu) && (f.data[0] == 0x10u) &&
+	       (f.data[1] == 30u) && (f.data[7] == 5u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_pop_frame(&tp, &f)); /* Waits for FC */
+
+	/* FC of other node is not ours */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, fc_cts_bs2) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* Wait does nothing */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_wait) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_cts_bs2) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x21u) && (f.data[1] == 6u) && (f.len == 8u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x22u) && (f.data[1] == 13u));
+	assert(!iso_tp_pop_frame(&tp, &f)); /* Block is over */
+
+	/* STmin 10ms for the rest */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_cts_st) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x23u) && (f.len == 8u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_step(&tp, 9u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_pop_frame(&tp, &f)); /* STmin has not passed */
+
+	/* Last CF carries the rest only: 30 - 6 - 7 * 3 = 3 */
+	assert(iso_tp_step(&tp, 1u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x24u) && (f.len == 4u) && (f.data[3] == 29u));
+	assert(iso_tp_get_n_usdata(&tp, &con));
+	assert((con.id == 0x79Bu) && (con.len == sizeof(msg)) &&
+	       (con.n_result == ISO_TP_N_RESULT_N_OK));
+
+	/* Receiver overflow aborts transmission */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_ovflw) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &con));
+	assert(con.n_result == ISO_TP_N_RESULT_N_BUFFER_OVFLW);
+	assert(!iso_tp_pop_frame(&tp, &f));
+}
+
+/** Timeouts must release sessions, STmin must be honoured in microseconds */
+void iso_tp_test_timers(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame f;
+	uint8_t msg[30] = {0u};
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE];
+
+	const uint8_t ff[8]     = {0x10u, 0x0Du, 1u, 2u, 3u, 4u, 5u, 6u};
+	const uint8_t cf[8]     = {0x21u, 7u, 8u, 9u, 10u, 11u, 12u, 13u};
+	const uint8_t fc_us[8]  = {0x30u, 0u, 0xF5u, 0u, 0u, 0u, 0u, 0u};
+
+	/* Listener only, session is dropped silently */
+	iso_tp_test_setup(&tp);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_step(&tp, 999u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf) == ISO_TP_EVENT_NONE);
+
+	/* Reassembly and transmission */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* N_Cr */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_step(&tp, 999u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_step(&tp, 1u) == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x7BCu) && (ind.len == 6u) && (ind.data == NULL));
+	assert(ind.n_result == ISO_TP_N_RESULT_N_TIMEOUT_CR);
+
+	/* Pool block is free again */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.n_result == ISO_TP_N_RESULT_N_OK);
+
+	/* N_Bs */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_step(&tp, 999u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_step(&tp, 1u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.n_result == ISO_TP_N_RESULT_N_TIMEOUT_BS);
+
+	/* STmin of 500us */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_us) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.data[0] == 0x21u);
+	assert(iso_tp_step_us(&tp, 499u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_step_us(&tp, 1u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.data[0] == 0x22u);
+}
+
+/** CAN FD: SF escape sequence, RX_DL deduced from FF, padding */
+void iso_tp_test_can_fd(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata usdata;
+	struct iso_tp_n_pdu pdu;
+	struct iso_tp_can_frame f;
+	const uint8_t *n_data;
+	uint8_t len_n_data;
+	uint8_t frame[64];
+	uint8_t msg[100];
+	uint8_t i;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE * 4u];
+
+	const uint8_t fc_cts[8] = {0x30u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	for (i = 0u; i < sizeof(msg); i++) {
+		msg[i] = i;
+	}
+
+	/* 10 is not a valid CAN FD data length */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 10u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_INVALID_CONFIG);
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 64u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	iso_tp_get_config(&tp, &cfg);
+	assert((cfg.rx_dl == 64u) && (cfg.min_ff_dl == 63u));
+
+	/* SF with escape sequence */
+	(void)memset(frame, 0u, sizeof(frame));
+	frame[1] = 10u;
+	for (i = 0u; i < 10u; i++) {
+		frame[2u + i] = i;
+	}
+
+	assert(iso_tp_test_push(&tp, 0x700u, 12u, frame) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &usdata));
+	assert((usdata.len == 10u) && (usdata.data[9] == 9u));
+
+	/* Overriden SF is padded up, N_Data still follows N_PCI */
+	(void)memset(&pdu, 0u, sizeof(pdu));
+	pdu.n_pci.n_pcitype = ISO_TP_N_PCITYPE_SF;
+	pdu.n_pci.sf_dl     = 9u;
+	pdu.len_n_data      = 9u;
+	(void)memcpy(pdu.n_data, &msg[20], 9u);
+	assert(iso_tp_override_n_pdu(&tp, &pdu));
+	assert(iso_tp_peek_n_pdu(&tp, NULL, &n_data, &len_n_data));
+	assert((len_n_data == 9u) && (n_data[0] == 20u) && (n_data[8] == 28u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 12u) && (f.data[1] == 9u) && (f.data[2] == 20u) &&
+	       (f.data[11] == 0u));
+
+	/* SF_DL in the first byte is not allowed with CAN_DL > 8 */
+	frame[0] = 0x0Au;
+	assert(iso_tp_test_push(&tp, 0x700u, 12u, frame) ==
+	       ISO_TP_EVENT_NONE);
+
+	/* FF_DL = 100, RX_DL = 64: FF carries 62 bytes, the last CF 38 */
+	frame[0] = 0x10u;
+	frame[1] = 100u;
+	for (i = 0u; i < 62u; i++) {
+		frame[2u + i] = i;
+	}
+
+	/* 10 is not a valid CAN_DL */
+	assert(iso_tp_test_push(&tp, 0x700u, 10u, frame) ==
+	       ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x700u, 64u, frame) ==
+	       ISO_TP_EVENT_N_PDU);
+
+	frame[0] = 0x21u;
+	for (i = 0u; i < 38u; i++) {
+		frame[1u + i] = 62u + i;
+	}
+
+	assert(iso_tp_test_push(&tp, 0x700u, 48u, frame) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &usdata));
+	assert((usdata.len == 100u) && (usdata.data[61] == 61u) &&
+	       (usdata.data[62] == 62u) && (usdata.data[99] == 99u));
+
+	/* SF up to 7 bytes is CAN2.0 compatible */
+	assert(iso_tp_send(&tp, 0x7DFu, msg, 7u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 8u) && (f.data[0] == 0x07u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+
+	/* Longer SF is padded: 2 + 20 bytes take 24 */
+	assert(iso_tp_send(&tp, 0x7DFu, msg, 20u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 24u) && (f.data[0] == 0x00u) && (f.data[1] == 20u) &&
+	       (f.data[21] == 19u) && (f.data[22] == 0u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+
+	/* FF takes TX_DL - 2 bytes, CF is padded to 48 */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 64u) && (f.data[0] == 0x10u) &&
+	       (f.data[1] == 100u) && (f.data[63] == 61u));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_cts) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 48u) && (f.data[0] == 0x21u) &&
+	       (f.data[1] == 62u) && (f.data[38] == 99u) &&
+	       (f.data[39] == 0u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &usdata));
+	assert((usdata.len == 100u) &&
+	       (usdata.n_result == ISO_TP_N_RESULT_N_OK));
+}
+
+#ifdef ISO_TP_FIXED_RX_DL
+/** Configuration pinned at build time (see makefile) */
+void iso_tp_test_fixed(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+
+	const uint8_t sf_fd[12] = {0x00u, 0x05u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t sf[12]    = {0x05u, 1u, 2u, 3u, 4u, 5u};
+
+	/* Pinned configuration is valid on its own */
+	iso_tp_init(&tp);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	iso_tp_get_config(&tp, &cfg);
+	assert((cfg.tx_dl == ISO_TP_FIXED_TX_DL) &&
+	       (cfg.rx_dl == ISO_TP_FIXED_RX_DL));
+
+	/* Frames longer than pinned RX_DL are rejected, whatever N_PCI */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 12u, sf_fd) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 12u, sf) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, sf) == ISO_TP_EVENT_N_PDU);
+}
+#endif
+
+/** Messages longer than 255 bytes and FF_DL escape sequence */
+void iso_tp_test_large(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_pdu n_pdu;
+	struct iso_tp_can_frame f;
+	uint8_t cf[8] = {0x20u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+	uint8_t i;
+
+	static uint8_t msg[5000];
+
+	/* FF_DL = 300: 6 bytes in FF, then 42 CFs of 7 bytes */
+	const uint8_t ff_300[8] = {0x11u, 0x2Cu, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	/* FF_DL = 4096 */
+	const uint8_t ff_esc[8] = {0x10u, 0u, 0u, 0u, 0x10u, 0x00u, 1u, 2u};
+
+	/* Escape sequence must not be used for FF_DL <= 4095 */
+	const uint8_t ff_esc_bad[8] = {0x10u, 0u, 0u, 0u, 0u, 100u, 1u, 2u};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, ff_300) ==
+	       ISO_TP_EVENT_N_PDU);
+
+	for (i = 1u; i <= 42u; i++) {
+		cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+		assert(iso_tp_test_push(&tp, 0x700u, 8u, cf) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(!iso_tp_has_cf_err(&tp));
+	}
+
+	/* Reception is over */
+	cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+	assert(iso_tp_test_push(&tp, 0x700u, 8u, cf) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x701u, 8u, ff_esc) ==
+	       ISO_TP_EVENT_N_PDU);
+	iso_tp_get_n_pdu(&tp, &n_pdu);
+	assert((n_pdu.n_pci.ff_dl == 4096u) && (n_pdu.len_n_data == 2u) &&
+	       (n_pdu.n_data[0] == 1u));
+
+	assert(iso_tp_test_push(&tp, 0x702u, 8u, ff_esc_bad) ==
+	       ISO_TP_EVENT_NONE);
+
+	/* Transmitted FF uses escape sequence */
+	msg[0] = 0xAAu;
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 8u) && (f.data[0] == 0x10u) && (f.data[1] == 0u) &&
+	       (f.data[2] == 0u) && (f.data[3] == 0u) &&
+	       (f.data[4] == 0x13u) && (f.data[5] == 0x88u) &&
+	       (f.data[6] == 0xAAu));
+}
+
+/** Receiver transmits FC by itself, BS follows free space of RX queue */
+void iso_tp_test_auto_fc(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame f;
+	uint8_t i;
+
+	/* FF_DL = 27: 6 bytes in FF and 3 CFs */
+	const uint8_t ff[8]  = {0x10u, 27u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t cf1[8] = {0x21u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t cf2[8] = {0x22u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t cf3[8] = {0x23u, 0u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t sf[2]  = {0x01u, 0xAAu};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl      = 8u;
+	cfg.fc_auto    = true;
+	cfg.fc_bs      = 2u;
+	cfg.fc_min_st  = 5u;
+	cfg.fc_wft_max = 2u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* Unbound sender gets no FC */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* FC.CTS right after FF and after each block of 2 CFs */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x79Bu) && (f.data[0] == 0x30u) &&
+	       (f.data[1] == 2u) && (f.data[2] == 5u));
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf1) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf2) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x30u) && (f.data[1] == 2u));
+
+	/* Last CF needs no FC */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf3) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* RX queue is full behind FF: wait, then allow what fits */
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	f.id  = 0x7BBu;
+	f.len = 8u;
+	(void)memcpy(f.data, ff, 8u);
+	assert(iso_tp_push_frame(&tp, &f));
+
+	f.id  = 0x100u;
+	f.len = 2u;
+	(void)memcpy(f.data, sf, 2u);
+	for (i = 1u; i < ISO_TP_QUEUE_LEN; i++) {
+		assert(iso_tp_push_frame(&tp, &f));
+	}
+
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x79Bu) && (f.data[0] == 0x31u));
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x30u) && (f.data[1] == 1u));
+
+	/* FC.WAIT is not used: busy sink has half of N_Cr, then sender is
+	 * told to abort before its N_Bs expires */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl        = 8u;
+	cfg.fc_auto      = true;
+	cfg.stream_ff_dl = 20u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	iso_tp_set_backpressure(&tp, 0u);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_step(&tp, 499u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_step(&tp, 1u) == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.data == NULL) &&
+	       (ind.n_result == ISO_TP_N_RESULT_N_BUFFER_OVFLW));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x79Bu) && (f.data[0] == 0x32u));
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_NONE);
+}
+
+/** Frame layout of some driver, for strided view */
+struct iso_tp_test_drv_frame {
+	uint32_t can_id; /* Bit 31 is a flag */
+	uint8_t  len;
+	uint8_t  pad[3];
+	uint8_t  data[8];
+};
+
+/** Batch of frames is decoded in place, events are described */
+void iso_tp_test_batch(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_frame_view view;
+	struct iso_tp_frame_desc desc[4];
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_test_drv_frame drv[3];
+	uint16_t n_desc;
+	uint8_t i;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE];
+
+	struct iso_tp_can_frame frames[4] = {
+		{0x100u, 2u, {0x01u, 0xAAu}},
+		{0x101u, 2u, {0x40u, 0x00u}}, /* Not ISO-TP */
+		{0x700u, 8u, {0x10u, 0x0Du, 1u, 2u, 3u, 4u, 5u, 6u}},
+		{0x700u, 8u, {0x21u, 7u, 8u, 9u, 10u, 11u, 12u, 13u}}
+	};
+
+	iso_tp_test_setup(&tp);
+
+	/* Ignored frame gets no descriptor */
+	iso_tp_frame_view_init(&view, frames, 4u);
+	assert(iso_tp_push_frames(&tp, &view, desc, &n_desc) == 4u);
+	assert(n_desc == 3u);
+	assert((desc[0].index == 0u) && (desc[0].ev == ISO_TP_EVENT_N_PDU) &&
+	       (desc[0].n_pcitype == ISO_TP_N_PCITYPE_SF) &&
+	       (desc[0].offset == 1u) && (desc[0].len == 1u));
+	assert((desc[1].index == 2u) &&
+	       (desc[1].n_pcitype == ISO_TP_N_PCITYPE_FF) &&
+	       (desc[1].offset == 2u) && (desc[1].len == 6u));
+	assert((desc[2].index == 3u) &&
+	       (desc[2].n_pcitype == ISO_TP_N_PCITYPE_CF) &&
+	       (desc[2].len == 7u) && !desc[2].cf_err);
+
+	/* Queued frames go first */
+	assert(iso_tp_push_frame(&tp, &frames[0]));
+	assert(iso_tp_push_frames(&tp, &view, desc, &n_desc) == 0u);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+
+	/* Driver's own layout, flag in CAN ID is masked out.
+	 * Reassembled message stops the batch */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	for (i = 0u; i < 3u; i++) {
+		drv[i].can_id = 0x80000700u;
+		drv[i].len    = frames[2u + (i & 1u)].len;
+		(void)memcpy(drv[i].data, frames[2u + (i & 1u)].data, 8u);
+	}
+
+	view.base        = (const uint8_t *)drv;
+	view.count       = 3u;
+	view.stride      = (uint16_t)sizeof(struct iso_tp_test_drv_frame);
+	view.id_offset   = 0u;
+	view.len_offset  = 4u;
+	view.data_offset = 8u;
+	view.id_mask     = 0x1FFFFFFFu;
+
+	assert(iso_tp_push_frames(&tp, &view, desc, &n_desc) == 2u);
+	assert((n_desc == 2u) && (desc[1].ev == ISO_TP_EVENT_N_USDATA_IND));
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x700u) && (ind.len == 13u) &&
+	       (ind.data[12] == 13u));
+
+	/* The rest of batch, next message begins */
+	view.base  = (const uint8_t *)&drv[2];
+	view.count = 1u;
+	assert(iso_tp_push_frames(&tp, &view, desc, &n_desc) == 1u);
+	assert((n_desc == 1u) && (desc[0].n_pcitype == ISO_TP_N_PCITYPE_FF));
+}
+
+/** Frames not matching acceptance filter are passed through undecoded */
+void iso_tp_test_filter(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	const struct iso_tp_can_frame *f;
+	uint32_t many[ISO_TP_FILTER_EXT_LEN + 1u];
+	uint32_t i;
+
+	const uint8_t sf[2] = {0x01u, 0x3Eu};
+
+	const uint32_t ids[2] = {0x7E8u, 0x18DAF100u};
+
+	const struct iso_tp_filter_rule rules[2] = {
+		{ISO_TP_FILTER_MASK,  0x700u,      0x7F0u},
+		{ISO_TP_FILTER_RANGE, 0x18DA00F1u, 0x18DA00FFu}
+	};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl          = 8u;
+	cfg.filter_ids     = ids;
+	cfg.filter_n_ids   = 2u;
+	cfg.filter_rules   = rules;
+	cfg.filter_n_rules = 2u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(!iso_tp_peek_frame(&tp, &f));
+
+	assert(iso_tp_test_push(&tp, 0x7E8u, 2u, sf) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x70Fu, 2u, sf) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x18DAF100u, 2u, sf) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x18DA00F5u, 2u, sf) ==
+	       ISO_TP_EVENT_N_PDU);
+
+	assert(iso_tp_test_push(&tp, 0x710u, 2u, sf) ==
+	       ISO_TP_EVENT_PASSTHROUGH);
+	assert(iso_tp_peek_frame(&tp, &f));
+	assert((f->id == 0x710u) && (f->data[1] == 0x3Eu));
+
+	assert(iso_tp_test_push(&tp, 0x18DA00F0u, 2u, sf) ==
+	       ISO_TP_EVENT_PASSTHROUGH);
+
+	/* Exact 29-bit CAN IDs must fit hash table */
+	for (i = 0u; i < (ISO_TP_FILTER_EXT_LEN + 1u); i++) {
+		many[i] = 0x18DA0000u + i;
+	}
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl        = 8u;
+	cfg.filter_ids   = many;
+	cfg.filter_n_ids = ISO_TP_FILTER_EXT_LEN;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	iso_tp_init(&tp);
+	cfg.filter_n_ids = ISO_TP_FILTER_EXT_LEN + 1u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_INVALID_CONFIG);
+}
+
+/** Message level patch is written into the frames holding its bytes */
+void iso_tp_test_patch(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame lent;
+	const struct iso_tp_can_frame *f;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE];
+
+	/* FF_DL = 20: bytes 0-5 in FF, 6-12 in CF1, 13-19 in CF2 */
+	const uint8_t ff[8]  = {0x10u, 20u, 0u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t cf1[8] = {0x21u, 6u, 7u, 8u, 9u, 10u, 11u, 12u};
+	const uint8_t cf2[8] = {0x22u, 13u, 14u, 15u, 16u, 17u, 18u, 19u};
+
+	const uint8_t patch[3] = {0xA5u, 0xA6u, 0xA7u};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl = 8u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* Bytes 5-7 span FF and CF1 */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_patch(&tp, 5u, patch, 3u) == 1u);
+	assert(iso_tp_peek_frame(&tp, &f));
+	assert((f->data[6] == 4u) && (f->data[7] == 0xA5u));
+
+	/* Driver's frame is patched in place */
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	lent.id  = 0x7BBu;
+	lent.len = 8u;
+	(void)memcpy(lent.data, cf1, 8u);
+	assert(iso_tp_lend_frame(&tp, &lent));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_patch(&tp, 5u, patch, 3u) == 2u);
+	assert((lent.data[1] == 0xA6u) && (lent.data[2] == 0xA7u) &&
+	       (lent.data[3] == 8u));
+
+	/* Not in this frame */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf2) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_patch(&tp, 5u, patch, 3u) == 0u);
+
+	/* Reassembled message is patched too */
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.data[4] == 4u) && (ind.data[5] == 0xA5u) &&
+	       (ind.data[7] == 0xA7u) && (ind.data[8] == 8u));
+
+	/* Patch may cover the tail of the last CF only */
+	assert(iso_tp_patch(&tp, 19u, patch, 3u) == 1u);
+	assert(iso_tp_peek_frame(&tp, &f));
+	assert(f->data[7] == 0xA5u);
+}
+
+/** Rewrite rule does what iso_tp_test_override does by hand */
+void iso_tp_test_rules(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	const struct iso_tp_can_frame *f;
+	size_t i;
+	uint8_t n_edited = 0u;
+
+	/* Bytes 13-17 of response (the 3rd frame of message),
+	 * bytes 13 and 14 are always 0xFF */
+	const struct iso_tp_edit edits[5] = {
+		{13u, ISO_TP_EDIT_XOR, 0u,    0xFFu},
+		{14u, ISO_TP_EDIT_ADD, 0u,    1u},
+		{15u, ISO_TP_EDIT_SET, 0xFFu, 0x12u},
+		{16u, ISO_TP_EDIT_SET, 0xFFu, 0x34u},
+		{17u, ISO_TP_EDIT_SET, 0xF0u, 0x56u}
+	};
+
+	const struct iso_tp_edit unsorted[2] = {
+		{16u, ISO_TP_EDIT_SET, 0xFFu, 0u},
+		{15u, ISO_TP_EDIT_SET, 0xFFu, 0u}
+	};
+
+	struct iso_tp_rule rule = {
+		0x79Bu, {0x21u, 0x01u}, 2u, 0x7BBu, NULL, 0u
+	};
+
+	rule.edits = unsorted;
+	rule.n_edits = 2u;
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl   = 8u;
+	cfg.rules   = &rule;
+	cfg.n_rules = 1u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_INVALID_CONFIG);
+
+	rule.edits   = edits;
+	rule.n_edits = 5u;
+
+	iso_tp_init(&tp);
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	for (i = 0; i < sizeof(example_log) / sizeof(struct example_can_frame);
+	     i++) {
+		assert(iso_tp_test_push(&tp, example_log[i].id,
+					example_log[i].dlc,
+					example_log[i].data) ==
+		       ISO_TP_EVENT_N_PDU);
+
+		if (iso_tp_is_edited(&tp)) {
+			assert(iso_tp_peek_frame(&tp, &f));
+			assert((f->id == 0x7BBu) && (f->data[0] == 0x22u) &&
+			       (f->data[1] == 0u) && (f->data[2] == 0u) &&
+			       (f->data[3] == 0x12u) && (f->data[4] == 0x34u) &&
+			       ((f->data[5] & 0xF0u) == 0x50u));
+
+			n_edited++;
+		}
+	}
+
+	/* Same as overrides of iso_tp_test_override */
+	assert(n_edited == 7u);
+}
+
+#ifdef ISO_TP_STATS
+/** Counters by PCI type and reason, session counters, trace ring */
+void iso_tp_test_stats(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_stats st;
+	struct iso_tp_session_stats ss;
+	struct iso_tp_trace_entry e;
+	struct iso_tp_can_frame f;
+	uint8_t i;
+
+	const uint8_t sf[8]       = {0x02u, 0x3Eu, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t sf_esc[8]   = {0x00u, 0x02u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t ff_short[8] = {0x10u, 0x07u, 1u, 2u, 3u, 4u, 5u, 6u};
+	const uint8_t ff[8]       = {0x10u, 0x20u, 1u, 2u, 3u, 4u, 5u, 6u};
+	const uint8_t cf1[8]      = {0x21u, 7u, 8u, 9u, 10u, 11u, 12u, 13u};
+	const uint8_t cf3[8]      = {0x23u, 7u, 8u, 9u, 10u, 11u, 12u, 13u};
+
+	iso_tp_test_setup(&tp);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, sf) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, sf_esc) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_short) ==
+	       ISO_TP_EVENT_NONE);
+
+	/* Transfer with SN error */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf1) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf3) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_get_session_stats(&tp, 0x7BBu, 0u, &ss));
+	assert((ss.n_cf == 2u) && (ss.n_fc == 0u));
+
+	/* N_Cr, session is gone */
+	assert(iso_tp_step(&tp, 2000u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_get_session_stats(&tp, 0x7BBu, 0u, &ss));
+
+	/* RX queue overflow */
+	f.id  = 0x7BBu;
+	f.len = 8u;
+	memcpy(f.data, sf, sizeof(sf));
+
+	for (i = 0u; i < ISO_TP_QUEUE_LEN; i++) {
+		assert(iso_tp_push_frame(&tp, &f));
+	}
+
+	assert(!iso_tp_push_frame(&tp, &f));
+
+	for (i = 0u; i < ISO_TP_QUEUE_LEN; i++) {
+		assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	}
+
+	iso_tp_get_stats(&tp, &st);
+	assert(st.frames[ISO_TP_N_PCITYPE_SF] == (1u + ISO_TP_QUEUE_LEN));
+	assert(st.frames[ISO_TP_N_PCITYPE_FF] == 1u);
+	assert(st.frames[ISO_TP_N_PCITYPE_CF] == 2u);
+	assert(st.frames[ISO_TP_N_PCITYPE_INVALID] == 2u);
+	assert(st.sf_rejects[ISO_TP_SF_REJECT_ESC] == 1u);
+	assert(st.ff_rejects[ISO_TP_FF_REJECT_FF_DL] == 1u);
+	assert((st.sn_errors == 1u) && (st.timeouts_cr == 1u));
+	assert((st.rx_drops == 1u) && (st.trace_lost == 0u));
+
+	/* One entry per step with frame, timer only step is not there */
+	assert(iso_tp_trace_pop(&tp, &e));
+	assert((e.time_us == 0u) && (e.id == 0x7BBu) &&
+	       (e.n_pcitype == ISO_TP_N_PCITYPE_SF) &&
+	       (e.ev == ISO_TP_EVENT_N_PDU));
+	assert(iso_tp_trace_pop(&tp, &e));
+	assert((e.n_pcitype == ISO_TP_N_PCITYPE_INVALID) &&
+	       (e.ev == ISO_TP_EVENT_NONE));
+
+	for (i = 0u; i < 4u; i++) {
+		assert(iso_tp_trace_pop(&tp, &e));
+	}
+
+	assert((e.n_pcitype == ISO_TP_N_PCITYPE_CF) && (e.time_us == 0u));
+	assert(iso_tp_trace_pop(&tp, &e));
+	assert(e.time_us == 2000000u);
+
+	for (i = 1u; i < ISO_TP_QUEUE_LEN; i++) {
+		assert(iso_tp_trace_pop(&tp, &e));
+	}
+
+	assert(!iso_tp_trace_pop(&tp, &e));
+
+	/* Ring keeps the newest entries */
+	for (i = 0u; i <= ISO_TP_TRACE_LEN; i++) {
+		assert(iso_tp_test_push(&tp, 0x7BBu + i, 8u, sf) ==
+		       ISO_TP_EVENT_N_PDU);
+	}
+
+	iso_tp_get_stats(&tp, &st);
+	assert(st.trace_lost == 1u);
+	assert(iso_tp_trace_pop(&tp, &e) && (e.id == 0x7BCu));
+
+	iso_tp_reset_stats(&tp);
+	iso_tp_get_stats(&tp, &st);
+	assert((st.frames[ISO_TP_N_PCITYPE_SF] == 0u) && (st.rx_drops == 0u));
+}
+#endif
+
+void iso_tp_test_addressing(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_pdu pdu;
+	struct iso_tp_n_usdata con;
+#ifdef ISO_TP_STATS
+	struct iso_tp_stats st;
+	struct iso_tp_session_stats ss;
+#endif
+	struct iso_tp_can_frame f;
+	uint8_t msg[14];
+	uint8_t i;
+
+	/* Extended addressing: N_TA precedes N_PCI */
+	const uint8_t sf[5]     = {0xF1u, 0x03u, 0x22u, 0xF1u, 0x90u};
+	const uint8_t sf_big[8] = {0xF1u, 0x07u, 1u, 2u, 3u, 4u, 5u, 6u};
+	const uint8_t ff_a[8]   = {0xF1u, 0x10u, 0x14u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t ff_b[8]   = {0xF2u, 0x10u, 0x14u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t ff_low[8] = {0xF1u, 0x10u, 0x06u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t cf_a[8]   = {0xF1u, 0x21u, 6u, 7u, 8u, 9u, 10u, 11u};
+	const uint8_t cf_b[8]   = {0xF2u, 0x21u, 6u, 7u, 8u, 9u, 10u, 11u};
+	const uint8_t fc[8]     = {0xF1u, 0x30u, 0u, 0u, 0u, 0u, 0u, 0u};
+	const uint8_t fc_mix[8] = {0x55u, 0x30u, 0u, 0u, 0u, 0u, 0u, 0u};
+
+	for (i = 0u; i < sizeof(msg); i++) {
+		msg[i] = i;
+	}
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl       = 8u;
+	cfg.addr_format = 3u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_INVALID_CONFIG);
+
+	cfg.addr_format = ISO_TP_ADDR_FORMAT_EXTENDED;
+	cfg.n_ae        = 0x10u;
+	cfg.n_ta        = 0xF1u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	iso_tp_get_config(&tp, &cfg);
+	assert(cfg.min_ff_dl == 7u);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 5u, sf) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_get_n_pdu(&tp, &pdu));
+	assert((pdu.n_pci.n_ae == 0xF1u) && (pdu.n_pci.sf_dl == 3u) &&
+	       (pdu.n_data[0] == 0x22u) && (pdu.n_data[2] == 0x90u));
+
+	/* Address byte leaves room for 6 bytes of SF, 6 bytes of FF */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, sf_big) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_low) == ISO_TP_EVENT_NONE);
+
+	/* Same CAN ID, different N_TA: separate sessions */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_a) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_b) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_get_n_pdu(&tp, &pdu));
+	assert((pdu.n_pci.ff_dl == 20u) && (pdu.len_n_data == 5u));
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_b) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_get_n_pdu(&tp, &pdu));
+	assert((pdu.n_pci.n_ae == 0xF2u) && (pdu.n_pci.sn == 1u) &&
+	       (pdu.len_n_data == 6u) && (pdu.n_data[5] == 11u));
+
+	/* The other one is still at SN 0 */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_a) == ISO_TP_EVENT_N_PDU);
+#ifdef ISO_TP_STATS
+	assert(iso_tp_get_session_stats(&tp, 0x7BBu, 0xF1u, &ss));
+	assert(ss.n_cf == 1u);
+
+	iso_tp_get_stats(&tp, &st);
+	assert(st.sn_errors == 0u);
+#endif
+	assert(iso_tp_step(&tp, 2000u) == ISO_TP_EVENT_NONE);
+
+	/* Peer N_TA goes first, SF takes up to 6 bytes */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, 6u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 8u) && (f.data[0] == 0x10u) &&
+	       (f.data[1] == 0x06u) && (f.data[7] == 5u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+
+	/* FF takes 5 bytes, CF 6 bytes. FC carries own N_TA */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x10u) && (f.data[1] == 0x10u) &&
+	       (f.data[2] == 14u) && (f.data[7] == 4u));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 8u) && (f.data[0] == 0x10u) &&
+	       (f.data[1] == 0x21u) && (f.data[2] == 5u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.len == 5u) && (f.data[1] == 0x22u) && (f.data[4] == 13u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &con));
+	assert((con.n_ae == 0x10u) && (con.n_result == ISO_TP_N_RESULT_N_OK));
+
+	/* Mixed addressing: FC echoes N_AE of message */
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl       = 8u;
+	cfg.addr_format = ISO_TP_ADDR_FORMAT_MIXED;
+	cfg.fc_auto     = true;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_b) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x79Bu) && (f.data[0] == 0xF2u) &&
+	       (f.data[1] == 0x30u));
+
+	/* Transmission of N_AE 0x55 waits for FC of the same N_AE */
+	assert(iso_tp_send_n_ae(&tp, 0x79Bu, 0x55u, msg, sizeof(msg)));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x55u) && (f.data[1] == 0x10u));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, fc_mix) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x55u) && (f.data[1] == 0x21u));
+}
+
+void iso_tp_test_gateway(void)
+{
+	static struct iso_tp_gw gw;
+	struct iso_tp_gw_stats st;
+	struct iso_tp_config cfg;
+	struct iso_tp_can_frame f;
+	struct iso_tp_can_frame batch[2];
+	struct iso_tp_frame_view view;
+	struct iso_tp_frame_desc desc[2];
+	struct iso_tp *tp;
+	uint16_t n_desc;
+	uint8_t i;
+
+	/* Everything goes 0 -> 1, only 0x7BB goes back */
+	const struct iso_tp_gw_route routes[2] = {
+		{0u, 0x02u, {ISO_TP_FILTER_MASK, 0u, 0u}},
+		{1u, 0x01u, {ISO_TP_FILTER_RANGE, 0x7BBu, 0x7BBu}}
+	};
+	const struct iso_tp_gw_route bad[1] = {
+		{2u, 0x01u, {ISO_TP_FILTER_MASK, 0u, 0u}}
+	};
+
+	const uint8_t sf[8] = {0x03u, 0x22u, 0xF1u, 0x90u, 0u, 0u, 0u, 0u};
+	const uint8_t vin   = 0x55u;
+
+	iso_tp_gw_init(&gw, 2u);
+	assert(!iso_tp_gw_set_routes(&gw, bad, 1u));
+	assert(iso_tp_gw_set_routes(&gw, routes, 2u));
+
+	for (i = 0u; i < 2u; i++) {
+		tp = iso_tp_gw_bus(&gw, i);
+		iso_tp_get_config(tp, &cfg);
+		cfg.tx_dl = 8u;
+		iso_tp_set_config(tp, &cfg);
+		assert(iso_tp_gw_step(&gw, i, 0u) == ISO_TP_EVENT_NONE);
+	}
+
+	/* Frame is patched, then forwarded by the next step */
+	f.id  = 0x7DFu;
+	f.len = 8u;
+	(void)memcpy(f.data, sf, 8u);
+	assert(iso_tp_push_frame(iso_tp_gw_bus(&gw, 0u), &f));
+	assert(iso_tp_gw_step(&gw, 0u, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_patch(iso_tp_gw_bus(&gw, 0u), 2u, &vin, 1u) == 1u);
+	assert(!iso_tp_gw_pop_frame(&gw, 1u, &f));
+
+	assert(iso_tp_gw_step(&gw, 0u, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_gw_pop_frame(&gw, 0u, &f));
+	assert(iso_tp_gw_pop_frame(&gw, 1u, &f));
+	assert((f.id == 0x7DFu) && (f.data[3] == 0x55u));
+	assert(!iso_tp_gw_pop_frame(&gw, 1u, &f));
+
+	/* Not routed back */
+	f.id = 0x123u;
+	assert(iso_tp_push_frame(iso_tp_gw_bus(&gw, 1u), &f));
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_gw_pop_frame(&gw, 0u, &f));
+
+	/* Dropped one isn't forwarded */
+	f.id = 0x7BBu;
+	assert(iso_tp_push_frame(iso_tp_gw_bus(&gw, 1u), &f));
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_N_PDU);
+	iso_tp_gw_drop(&gw, 1u);
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_gw_pop_frame(&gw, 0u, &f));
+
+	assert(iso_tp_push_frame(iso_tp_gw_bus(&gw, 1u), &f));
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_gw_pop_frame(&gw, 0u, &f) && (f.id == 0x7BBu));
+
+	/* Link is full, bus 1 doesn't pop */
+	f.id = 0x7DFu;
+	for (i = 0u; i <= ISO_TP_QUEUE_LEN; i++) {
+		assert(iso_tp_push_frame(iso_tp_gw_bus(&gw, 0u), &f));
+		assert(iso_tp_gw_step(&gw, 0u, 0u) == ISO_TP_EVENT_N_PDU);
+	}
+
+	assert(iso_tp_gw_step(&gw, 0u, 0u) == ISO_TP_EVENT_NONE);
+
+	iso_tp_gw_get_stats(&gw, 0u, &st);
+	assert((st.forwarded == (1u + ISO_TP_QUEUE_LEN)) &&
+	       (st.fwd_drops == 1u) && (st.dropped == 0u));
+
+	iso_tp_gw_get_stats(&gw, 1u, &st);
+	assert((st.forwarded == 1u) && (st.dropped == 1u) &&
+	       (st.received == 1u));
+
+	/* Batch is forwarded as it's pushed, only once */
+	for (i = 0u; i < 2u; i++) {
+		batch[i].id  = (i == 0u) ? 0x7BBu : 0x123u;
+		batch[i].len = 8u;
+		(void)memcpy(batch[i].data, sf, 8u);
+	}
+
+	iso_tp_frame_view_init(&view, batch, 2u);
+	assert(iso_tp_gw_push_frames(&gw, 1u, &view, desc, &n_desc) == 2u);
+	assert(iso_tp_gw_pop_frame(&gw, 0u, &f));
+	assert((f.id == 0x7BBu) && (f.len == 8u) && (f.data[1] == 0x22u));
+	assert(!iso_tp_gw_pop_frame(&gw, 0u, &f));
+	assert(iso_tp_gw_step(&gw, 1u, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_gw_pop_frame(&gw, 0u, &f));
+}
+
+void iso_tp_test_stream(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame f;
+	const uint8_t *chunk;
+	uint32_t offset;
+	uint32_t next;
+#ifdef ISO_TP_CRC32
+	uint32_t crc;
+#endif
+	uint8_t len;
+	uint8_t i;
+
+	/* Pool can't take any of the streams below */
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE];
+
+	const uint8_t ff_huge[8] = {0x1Fu, 0xFFu, 0u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t ff[8]      = {0x11u, 0x00u, 0u, 1u, 2u, 3u, 4u, 5u};
+	uint8_t cf[8]            = {0x21u, 6u, 7u, 8u, 9u, 10u, 11u, 12u};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl        = 8u;
+	cfg.fc_auto      = true;
+	cfg.fc_wft_max   = 2u;
+	cfg.stream_ff_dl = 0x100u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* Sink takes 2 frames at a time */
+	iso_tp_set_backpressure(&tp, 2u);
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff_huge) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+	assert((offset == 0u) && (len == 6u) && (chunk[5] == 5u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x30u) && (f.data[1] == 2u));
+
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+	assert((offset == 6u) && (len == 7u) && (chunk[0] == 6u));
+
+	/* Sink is busy at the end of block */
+	iso_tp_set_backpressure(&tp, 0u);
+
+	cf[0] = 0x22u;
+	assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+	assert((offset == 13u) && (len == 7u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(f.data[0] == 0x31u);
+
+	/* Sink has room again */
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	assert(!iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	iso_tp_set_backpressure(&tp, ISO_TP_BACKPRESSURE_OFF);
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.data[0] == 0x30u) && (f.data[1] > 2u));
+
+	/* Abandoned stream is indicated as well */
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.data == NULL) &&
+	       (ind.n_result == ISO_TP_N_RESULT_N_TIMEOUT_CR));
+
+	/* 256 bytes: FF and 36 CFs, no gaps */
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+#ifdef ISO_TP_CRC32
+	crc  = iso_tp_crc32(0u, chunk, len);
+#endif
+	next = 6u;
+
+	for (i = 1u; i < 36u; i++) {
+		cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+		assert(iso_tp_test_push(&tp, 0x7BCu, 8u, cf) ==
+		       ISO_TP_EVENT_N_USDATA_CHUNK);
+		assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+		assert(offset == next);
+#ifdef ISO_TP_CRC32
+		crc   = iso_tp_crc32(crc, chunk, len);
+#endif
+		next += len;
+	}
+
+	cf[0] = (uint8_t)(0x20u | (36u & 0x0Fu));
+	assert(iso_tp_test_push(&tp, 0x7BCu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_read_chunk(&tp, &chunk, &len, &offset));
+	assert((offset == next) && ((offset + len) == 0x100u));
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x7BCu) && (ind.data == NULL) &&
+	       (ind.len == 0x100u) && (ind.n_result == ISO_TP_N_RESULT_N_OK));
+
+#ifdef ISO_TP_CRC32
+	/* Streamed message is hashed as well, no buffer needed */
+	assert(ind.crc == iso_tp_crc32(crc, chunk, len));
+#endif
+
+	/* Broken stream is indicated once, its tail is not N_OK */
+	assert(iso_tp_test_push(&tp, 0x7BDu, 8u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	cf[0] = 0x22u;
+	assert(iso_tp_test_push(&tp, 0x7BDu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.id == 0x7BDu) &&
+	       (ind.n_result == ISO_TP_N_RESULT_N_WRONG_SN));
+
+	for (i = 3u; i <= 37u; i++) {
+		cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+		assert(iso_tp_test_push(&tp, 0x7BDu, 8u, cf) !=
+		       ISO_TP_EVENT_N_USDATA_IND);
+	}
+
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_NONE);
+
+	/* Wrong SN of the last CF is not overriden by N_OK */
+	assert(iso_tp_test_push(&tp, 0x7BEu, 8u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+
+	for (i = 1u; i < 36u; i++) {
+		cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+		assert(iso_tp_test_push(&tp, 0x7BEu, 8u, cf) ==
+		       ISO_TP_EVENT_N_USDATA_CHUNK);
+	}
+
+	cf[0] = 0x20u;
+	assert(iso_tp_test_push(&tp, 0x7BEu, 8u, cf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.n_result == ISO_TP_N_RESULT_N_WRONG_SN);
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_NONE);
+
+	/* So is broken FF in the middle of stream */
+	assert(iso_tp_test_push(&tp, 0x7BEu, 8u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_CHUNK);
+	assert(iso_tp_test_push(&tp, 0x7BEu, 4u, ff) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.n_result == ISO_TP_N_RESULT_N_UNEXP_PDU);
+
+	for (i = 1u; i <= 37u; i++) {
+		cf[0] = (uint8_t)(0x20u | (i & 0x0Fu));
+		assert(iso_tp_test_push(&tp, 0x7BEu, 8u, cf) !=
+		       ISO_TP_EVENT_N_USDATA_IND);
+	}
+
+	assert(iso_tp_step(&tp, 1000u) == ISO_TP_EVENT_NONE);
+}
+
+void iso_tp_test_capture(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_cap_rec rec;
+	struct iso_tp_cap_replay rp;
+	struct iso_tp_can_frame f;
+	enum iso_tp_event ev;
+	const uint8_t *cap;
+	uint32_t cap_len;
+	uint32_t delta;
+	uint32_t t;
+	uint32_t last = 0u;
+	size_t n = sizeof(example_log) / sizeof(struct example_can_frame);
+	size_t i;
+
+	static uint8_t buf[4096];
+
+	iso_tp_test_setup(&tp);
+	assert(iso_tp_cap_rec_init(&rec, buf, sizeof(buf)));
+
+	for (i = 0; i < n; i++) {
+		f.id  = example_log[i].id;
+		f.len = example_log[i].dlc;
+		memcpy(&f.data, example_log[i].data, f.len);
+
+		t = (uint32_t)(example_log[i].time_us * 1e6);
+		assert(iso_tp_cap_push_frame(&rec, &tp, &f, t));
+		assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_PDU);
+	}
+
+	cap = iso_tp_cap_rec_take(&rec, &cap_len);
+	assert((cap == buf) && (rec.frames == n) && (rec.lost == 0u));
+	assert(iso_tp_cap_rec_take(&rec, &delta) == NULL);
+
+	/* Head, dictionary index and delta of up to 2 s (3 bytes) per frame,
+	 * plus the literal CAN IDs, instead of 24+ bytes of example_log */
+	assert(cap_len <= (ISO_TP_CAP_HEADER_LEN + (n * (8u + 1u + 1u + 3u))));
+
+	/* Frames and deltas come back exactly */
+	assert(iso_tp_cap_replay_init(&rp, cap, cap_len,
+				      ISO_TP_CAP_FULL_SPEED));
+	for (i = 0; i < n; i++) {
+		t = (uint32_t)(example_log[i].time_us * 1e6);
+
+		assert(iso_tp_cap_read(&rp, &f, &delta));
+		assert((f.id == example_log[i].id) &&
+		       (f.len == example_log[i].dlc) &&
+		       (memcmp(f.data, example_log[i].data, f.len) == 0));
+		assert(delta == ((i > 0u) ? (t - last) : 0u));
+
+		last = t;
+	}
+	assert(!iso_tp_cap_read(&rp, &f, &delta) && !rp.error);
+
+	/* Full speed replay: every step gets its frame */
+	iso_tp_test_setup(&tp);
+	assert(iso_tp_cap_replay_init(&rp, cap, cap_len,
+				      ISO_TP_CAP_FULL_SPEED));
+	for (i = 0; i < n; i++) {
+		assert(iso_tp_cap_replay_step(&rp, &tp, 0u, &ev));
+		assert(ev == ISO_TP_EVENT_N_PDU);
+	}
+	assert(!iso_tp_cap_replay_step(&rp, &tp, 0u, &ev));
+
+	/* Real time replay: frame waits until due */
+	iso_tp_test_setup(&tp);
+	assert(iso_tp_cap_replay_init(&rp, cap, cap_len,
+				      ISO_TP_CAP_REAL_TIME));
+	assert(iso_tp_cap_replay_step(&rp, &tp, 0u, &ev));
+	assert(ev == ISO_TP_EVENT_N_PDU);
+
+	t = (uint32_t)(example_log[1].time_us * 1e6) -
+	    (uint32_t)(example_log[0].time_us * 1e6);
+	assert(iso_tp_cap_replay_step(&rp, &tp, t - 1u, &ev));
+	assert(ev == ISO_TP_EVENT_NONE);
+	assert(iso_tp_cap_replay_step(&rp, &tp, 1u, &ev));
+	assert(ev == ISO_TP_EVENT_N_PDU);
+
+	/* Truncated capture ends with error at the last frame */
+	assert(iso_tp_cap_replay_init(&rp, cap, cap_len - 1u,
+				      ISO_TP_CAP_FULL_SPEED));
+	for (i = 1u; i < n; i++) {
+		assert(iso_tp_cap_read(&rp, &f, &delta));
+	}
+	assert(!iso_tp_cap_read(&rp, &f, &delta) && rp.error);
+
+	/* Not a capture */
+	assert(!iso_tp_cap_replay_init(&rp, example_log[0].data, 8u,
+				       ISO_TP_CAP_FULL_SPEED));
+
+	/* CAN_DL which is not valid is padded up with zeros */
+	assert(iso_tp_cap_rec_init(&rec, buf, sizeof(buf)));
+	f.id  = 0x7BBu;
+	f.len = 10u;
+	(void)memset(f.data, 0xAA, sizeof(f.data));
+	assert(iso_tp_cap_rec_frame(&rec, &f, 0u));
+	cap = iso_tp_cap_rec_take(&rec, &cap_len);
+	assert(iso_tp_cap_replay_init(&rp, cap, cap_len,
+				      ISO_TP_CAP_FULL_SPEED));
+	assert(iso_tp_cap_read(&rp, &f, &delta));
+	assert((f.len == 12u) && (f.data[9] == 0xAAu) &&
+	       (f.data[10] == 0u) && (f.data[11] == 0u));
+}
+
+void iso_tp_test_corr(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_corr corr;
+	struct iso_tp_can_frame f;
+	const struct iso_tp_corr_hist *h;
+	uint32_t t;
+	uint32_t last = 0u;
+	uint32_t first_us = 0u;
+	size_t n = sizeof(example_log) / sizeof(struct example_can_frame);
+	size_t i;
+
+	const uint8_t req[8]     = {0x03u, 0x22u, 0xF1u, 0x90u, 0u, 0u, 0u, 0u};
+	const uint8_t pending[8] = {0x03u, 0x7Fu, 0x22u, 0x78u, 0u, 0u, 0u, 0u};
+	const uint8_t pos[8]     = {0x04u, 0x62u, 0xF1u, 0x90u, 1u, 0u, 0u, 0u};
+	const uint8_t neg[8]     = {0x03u, 0x7Fu, 0x22u, 0x31u, 0u, 0u, 0u, 0u};
+
+	/* Requests of 0x79B, responses of 0x7BB in example log */
+	iso_tp_test_setup(&tp);
+	iso_tp_corr_init(&corr, 5000u);
+	assert(iso_tp_corr_add_pair(&corr, 0x79Bu, 0x7BBu));
+
+	for (i = 0; i < n; i++) {
+		f.id  = example_log[i].id;
+		f.len = example_log[i].dlc;
+		memcpy(&f.data, example_log[i].data, f.len);
+
+		t = (uint32_t)(example_log[i].time_us * 1e6);
+		assert(iso_tp_push_frame(&tp, &f));
+		(void)iso_tp_step_us(&tp, t - last);
+		(void)iso_tp_corr_step(&corr, &tp, t - last);
+
+		if (i == 1u) {
+			first_us = t - last;
+		}
+
+		last = t;
+	}
+
+	/* "21 61" is answered by FF "61 61 ..." */
+	h = iso_tp_corr_find(&corr, 0x7BBu, 0x21u, 0x61u);
+	assert((h != NULL) && (h == iso_tp_corr_at(&corr, 0u)));
+	assert((h->count >= 1u) && (h->negative == 0u) &&
+	       (h->timeouts == 0u));
+	assert(h->buckets[11] >= 1u); /* 2201 us */
+	assert((h->count > 1u) || (h->max_us == first_us));
+	assert(iso_tp_corr_percentile(h, 100u) >= 2048u);
+
+	h = iso_tp_corr_find(&corr, 0x7BBu, 0x21u, 0x01u);
+	assert((h != NULL) && (h->count > 0u) && (h->timeouts == 0u));
+	assert(iso_tp_corr_find(&corr, 0x79Bu, 0x21u, 0x01u) == NULL);
+	assert(corr.untracked == 0u);
+
+	/* Response pending keeps request alive, latency is of final one */
+	iso_tp_test_setup(&tp);
+	iso_tp_corr_init(&corr, 50u);
+	assert(iso_tp_corr_add_pair(&corr, 0x7E0u, 0x7E8u));
+
+	assert(iso_tp_test_push(&tp, 0x7E0u, 8u, req) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_corr_step(&corr, &tp, 0u));
+	assert(iso_tp_test_push(&tp, 0x7E8u, 8u, pending) ==
+	       ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_corr_step(&corr, &tp, 40000u));
+	assert(iso_tp_test_push(&tp, 0x7E8u, 8u, pos) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_corr_step(&corr, &tp, 40000u));
+
+	h = iso_tp_corr_find(&corr, 0x7E8u, 0x22u, 0xF190u);
+	assert((h != NULL) && (h->count == 1u) && (h->pending == 1u));
+	assert((h->max_us == 80000u) && (h->buckets[16] == 1u));
+	assert(iso_tp_corr_percentile(h, 50u) == 131071u);
+
+	/* Negative response ends request as well */
+	assert(iso_tp_test_push(&tp, 0x7E0u, 8u, req) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_corr_step(&corr, &tp, 0u));
+	assert(iso_tp_test_push(&tp, 0x7E8u, 8u, neg) == ISO_TP_EVENT_N_PDU);
+	assert(iso_tp_corr_step(&corr, &tp, 10u));
+	assert((h->count == 2u) && (h->negative == 1u) &&
+	       (h->buckets[3] == 1u));
+
+	/* No response within timeout, late one is not counted */
+	assert(iso_tp_test_push(&tp, 0x7E0u, 8u, req) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_corr_step(&corr, &tp, 0u));
+	assert(iso_tp_test_push(&tp, 0x7E8u, 8u, pos) == ISO_TP_EVENT_N_PDU);
+	assert(!iso_tp_corr_step(&corr, &tp, 50001u));
+	assert((h->count == 2u) && (h->timeouts == 1u));
+}
+
+void iso_tp_test_sched(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_corr corr;
+	struct iso_tp_sched sched;
+	struct iso_tp_sched_stats st;
+	struct iso_tp_can_frame f;
+	enum iso_tp_event ev;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE * 4u];
+
+	static const uint8_t req_a[3] = {0x22u, 0xF1u, 0x90u};
+	static const uint8_t req_b[3] = {0x22u, 0xF1u, 0x91u};
+	static const uint8_t req_c[2] = {0x21u, 0x01u};
+
+	const uint8_t neg_b[8] = {0x03u, 0x7Fu, 0x22u, 0x78u, 0u, 0u, 0u, 0u};
+	const uint8_t pos_a[8] = {0x04u, 0x62u, 0xF1u, 0x90u, 1u, 0u, 0u, 0u};
+	const uint8_t pos_b[8] = {0x04u, 0x62u, 0xF1u, 0x91u, 1u, 0u, 0u, 0u};
+	const uint8_t ff_c[8]  = {0x10u, 0x0Au, 0x61u, 0x01u, 1u, 2u, 3u, 4u};
+	const uint8_t cf_c[8]  = {0x21u, 5u, 6u, 7u, 8u, 0u, 0u, 0u};
+
+	/* Two jobs of ECU 0x7E0, one of ECU 0x7E1 */
+	static const struct iso_tp_sched_job jobs[3] = {
+		{0x7E0u, 0x7E8u, req_a, 3u, 100u},
+		{0x7E0u, 0x7E8u, req_b, 3u, 100u},
+		{0x7E1u, 0x7E9u, req_c, 2u, 50u}
+	};
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl   = 8u;
+	cfg.fc_auto = true;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7E8u, 0x7E0u));
+	assert(iso_tp_bind_n_ai(&tp, 0x7E9u, 0x7E1u));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	iso_tp_corr_init(&corr, 1000u);
+	assert(iso_tp_corr_add_pair(&corr, 0x7E0u, 0x7E8u));
+	assert(iso_tp_corr_add_pair(&corr, 0x7E1u, 0x7E9u));
+
+	/* Job b alone is learned to take 30 ms, request sent by scheduler
+	 * is told to correlation, 0x78 keeps it outstanding */
+	iso_tp_sched_init(&sched, &corr, 1000u);
+	assert(iso_tp_sched_set_jobs(&sched, &jobs[1], 1u));
+	assert(iso_tp_sched_step(&sched, &tp, ISO_TP_EVENT_NONE, 0u) == 1u);
+	assert(iso_tp_pop_frame(&tp, &f) && (f.data[3] == 0x91u));
+	ev = iso_tp_step(&tp, 0u);
+	assert(ev == ISO_TP_EVENT_N_USDATA_CON);
+	assert(!iso_tp_corr_step(&corr, &tp, 0u));
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+	ev = iso_tp_test_push(&tp, 0x7E8u, 8u, neg_b);
+	assert(!iso_tp_corr_step(&corr, &tp, 10000u));
+	assert(iso_tp_sched_step(&sched, &tp, ev, 10000u) == 0u);
+	iso_tp_sched_get_stats(&sched, 0u, &st);
+	assert((st.sent == 1u) && (st.done == 0u));
+	ev = iso_tp_test_push(&tp, 0x7E8u, 8u, pos_b);
+	assert(iso_tp_corr_step(&corr, &tp, 20000u));
+	assert(iso_tp_sched_step(&sched, &tp, ev, 20000u) == 0u);
+	iso_tp_sched_get_stats(&sched, 0u, &st);
+	assert((st.done == 1u) && (st.last_us == 30000u));
+	assert(iso_tp_corr_latency(&corr, 0x7E8u, req_b, 3u, 100u) >= 30000u);
+
+	iso_tp_sched_init(&sched, &corr, 1000u);
+	assert(!iso_tp_sched_set_jobs(&sched, jobs,
+				      ISO_TP_SCHED_MAX_JOBS + 1u));
+	assert(iso_tp_sched_set_jobs(&sched, jobs, 3u));
+
+	/* One request per ECU at once, least slack first */
+	assert(iso_tp_sched_step(&sched, &tp, ISO_TP_EVENT_NONE, 0u) == 2u);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x7E1u) && (f.data[1] == 0x21u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x7E0u) && (f.data[3] == 0x91u));
+	assert(!iso_tp_pop_frame(&tp, &f));
+
+	/* Confirmations only */
+	ev = iso_tp_step(&tp, 0u);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+	ev = iso_tp_step(&tp, 0u);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+
+	/* Multiframe response of 0x7E1 is paced by our FC, then done */
+	ev = iso_tp_test_push(&tp, 0x7E9u, 8u, ff_c);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 5000u) == 0u);
+	assert(iso_tp_pop_frame(&tp, &f) && (f.data[0] == 0x30u));
+	ev = iso_tp_test_push(&tp, 0x7E9u, 8u, cf_c);
+	assert(ev == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 1000u) == 0u);
+	iso_tp_sched_get_stats(&sched, 2u, &st);
+	assert((st.sent == 1u) && (st.done == 1u) && (st.last_us == 6000u));
+
+	/* ECU is still busy with job b */
+	ev = iso_tp_test_push(&tp, 0x7E8u, 8u, neg_b);
+	assert(ev == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+
+	/* Response of job b frees target for job a */
+	ev = iso_tp_test_push(&tp, 0x7E8u, 8u, pos_b);
+	assert(ev == ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 1u);
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x7E0u) && (f.data[3] == 0x90u));
+	ev = iso_tp_step(&tp, 0u);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+
+	/* Job c is released again at 50 ms */
+	assert(iso_tp_sched_step(&sched, &tp, ISO_TP_EVENT_NONE, 43999u) ==
+	       0u);
+	assert(iso_tp_sched_step(&sched, &tp, ISO_TP_EVENT_NONE, 1u) == 1u);
+	assert(iso_tp_pop_frame(&tp, &f) && (f.id == 0x7E1u));
+
+	/* Job a is answered past its deadline, both jobs of 0x7E0 are
+	 * released again, job b goes first as it takes longer */
+	ev = iso_tp_test_push(&tp, 0x7E8u, 8u, pos_a);
+	assert(iso_tp_sched_step(&sched, &tp, ev, 51000u) == 1u);
+	iso_tp_sched_get_stats(&sched, 0u, &st);
+	assert((st.done == 1u) && (st.late == 1u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert((f.id == 0x7E0u) && (f.data[3] == 0x91u));
+
+	/* Confirmations only */
+	for (ev = iso_tp_step(&tp, 0u); ev != ISO_TP_EVENT_NONE;
+	     ev = iso_tp_step(&tp, 0u)) {
+		assert(ev == ISO_TP_EVENT_N_USDATA_CON);
+		assert(iso_tp_sched_step(&sched, &tp, ev, 0u) == 0u);
+	}
+
+	/* Job c got no response within timeout */
+	assert(iso_tp_sched_step(&sched, &tp, ISO_TP_EVENT_NONE, 950001u) >=
+	       1u);
+	iso_tp_sched_get_stats(&sched, 2u, &st);
+	assert((st.sent == 3u) && (st.failed == 1u) && (st.skipped > 0u));
+}
+
+void iso_tp_test_simd(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_frame_view view;
+	struct iso_tp_frame_desc desc[40];
+	uint16_t n_desc;
+
+	static struct iso_tp_can_frame frames[40];
+
+	uint8_t  types[40];
+	uint8_t  ref[40];
+	uint16_t index[40];
+	uint16_t first[ISO_TP_SIMD_GROUPS + 1u];
+	uint16_t n;
+	uint16_t i;
+	uint8_t  fmt;
+
+	/* Every type and length, two vectors and tail */
+	for (i = 0u; i < 40u; i++) {
+		frames[i].id      = 0x7BBu;
+		frames[i].len     = (uint8_t)(i % 5u);
+		frames[i].data[0] = (uint8_t)((i * 0x1Du) & 0x5Fu);
+		frames[i].data[1] = (uint8_t)((i * 0x17u) & 0x5Fu);
+		frames[i].data[2] = 0u;
+	}
+
+	frames[5].len = ISO_TP_MAX_CAN_DL + 1u; /* Too long */
+	frames[6].len = 8u;
+	(void)memcpy(frames[6].data, "\x10\x29\x61\x01\x01\x02\x03\x04", 8u);
+
+	iso_tp_frame_view_init(&view, frames, 40u);
+
+	for (fmt = 0u; fmt < 2u; fmt++) {
+		iso_tp_init(&tp);
+		iso_tp_get_config(&tp, &cfg);
+		cfg.tx_dl       = 8u;
+		cfg.addr_format = (fmt == 0u) ? ISO_TP_ADDR_FORMAT_NORMAL :
+				  ISO_TP_ADDR_FORMAT_EXTENDED;
+		iso_tp_set_config(&tp, &cfg);
+		assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+		/* Vector path agrees with scalar one (pinned addressing
+		 * overrides configured one) */
+		n = iso_tp_simd_classify(&tp, &view, types);
+		assert(_iso_tp_simd_classify_scalar(_ISO_TP_PCI_OFFSET(&tp),
+						    &view, 0u, 40u, ref) == n);
+		assert(memcmp(types, ref, sizeof(types)) == 0);
+		assert((n > 0u) && (n < 40u));
+		assert(types[0] == (uint8_t)ISO_TP_N_PCITYPE_INVALID);
+		assert(types[5] == (uint8_t)ISO_TP_N_PCITYPE_INVALID);
+
+		/* Frames decoded are never classified invalid */
+		for (i = 0u; i < 40u; i += n) {
+			view.base  = (const uint8_t *)&frames[i];
+			view.count = (uint16_t)(40u - i);
+			n = iso_tp_push_frames(&tp, &view, desc, &n_desc);
+			assert(n > 0u);
+
+			while (n_desc > 0u) {
+				n_desc--;
+				assert(types[i + desc[n_desc].index] ==
+				       desc[n_desc].n_pcitype);
+			}
+
+			(void)iso_tp_step(&tp, 0u);
+		}
+
+		iso_tp_frame_view_init(&view, frames, 40u);
+	}
+
+	/* Address byte of the last format comes first */
+	assert(types[6] == ((_ISO_TP_PCI_OFFSET(&tp) > 0u) ?
+			    (uint8_t)ISO_TP_N_PCITYPE_CF :
+			    (uint8_t)ISO_TP_N_PCITYPE_FF));
+
+	/* Groups keep order */
+	iso_tp_simd_group(types, 40u, index, first);
+	assert(first[0] == 0u);
+	assert(first[ISO_TP_SIMD_GROUPS] == 40u);
+
+	for (i = 0u; i < 40u; i++) {
+		uint8_t t = types[index[i]];
+
+		assert((i >= first[t]) && (i < first[t + 1u]));
+		assert((i == first[t]) || (index[i - 1u] < index[i]));
+	}
+}
+
+#ifdef ISO_TP_CRC32
+void iso_tp_test_crc(void)
+{
+	struct iso_tp tp;
+	struct iso_tp_config cfg;
+	struct iso_tp_n_usdata ind;
+	struct iso_tp_can_frame f;
+	uint32_t crc;
+	uint8_t msg[20];
+	uint8_t i;
+
+	static uint8_t pool[ISO_TP_POOL_BLOCK_SIZE];
+
+	const uint8_t sf[4]   = {0x03u, 0x22u, 0xF1u, 0x90u};
+	const uint8_t ff[8]   = {0x10u, 0x14u, 0u, 1u, 2u, 3u, 4u, 5u};
+	const uint8_t resp[4] = {0x03u, 0x62u, 0xF1u, 0x90u};
+
+	const struct iso_tp_edit edit = {1u, ISO_TP_EDIT_SET, 0xFFu, 0x55u};
+
+	struct iso_tp_rule rule = {
+		0x79Bu, {0x22u, 0xF1u}, 2u, 0x7BBu, NULL, 0u
+	};
+
+	/* Check value of CRC-32, same if resumed at any point */
+	assert(iso_tp_crc32(0u, (const uint8_t *)"123456789", 9u) ==
+	       0xCBF43926u);
+	assert(iso_tp_crc32(iso_tp_crc32(0u, (const uint8_t *)"1234", 4u),
+			    (const uint8_t *)"56789", 5u) == 0xCBF43926u);
+	assert(iso_tp_crc32(0u, NULL, 0u) == 0u);
+
+	for (i = 0u; i < sizeof(msg); i++) {
+		msg[i] = i;
+	}
+
+	crc = iso_tp_crc32(0u, msg, sizeof(msg));
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl   = 8u;
+	cfg.fc_auto = true;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_bind_n_ai(&tp, 0x7BBu, 0x79Bu));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	/* SF is hashed as a whole */
+	assert(iso_tp_test_push(&tp, 0x7BBu, 4u, sf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.crc == iso_tp_crc32(0u, &sf[1], 3u));
+
+	/* Segments are hashed as accepted, identical responses match */
+	for (i = 0u; i < 3u; i++) {
+		static const uint8_t cf_1[8] = {0x21u, 6u, 7u, 8u, 9u, 10u,
+						11u, 12u};
+
+		uint8_t cf_2[8] = {0x22u, 13u, 14u, 15u, 16u, 17u, 18u, 19u};
+
+		/* The last response differs by its last byte */
+		if (i == 2u) {
+			cf_2[7] = 0u;
+		}
+
+		assert(iso_tp_test_push(&tp, 0x7BBu, 8u, ff) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(iso_tp_pop_frame(&tp, &f));
+		assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_1) ==
+		       ISO_TP_EVENT_N_PDU);
+		assert(iso_tp_test_push(&tp, 0x7BBu, 8u, cf_2) ==
+		       ISO_TP_EVENT_N_USDATA_IND);
+		assert(iso_tp_get_n_usdata(&tp, &ind));
+		assert(ind.len == sizeof(msg));
+		assert(ind.crc == iso_tp_crc32(0u, ind.data, ind.len));
+		assert((ind.crc == crc) == (i < 2u));
+	}
+
+	/* Transmitted message is not hashed */
+	assert(iso_tp_send(&tp, 0x79Bu, msg, 3u));
+	assert(iso_tp_pop_frame(&tp, &f));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_N_USDATA_CON);
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert(ind.crc == 0u);
+
+	/* Edited message is hashed as received, not as forwarded */
+	rule.edits   = &edit;
+	rule.n_edits = 1u;
+
+	iso_tp_init(&tp);
+	iso_tp_get_config(&tp, &cfg);
+	cfg.tx_dl   = 8u;
+	cfg.rules   = &rule;
+	cfg.n_rules = 1u;
+	iso_tp_set_config(&tp, &cfg);
+	assert(iso_tp_set_rx_buffer(&tp, pool, sizeof(pool)));
+	assert(iso_tp_step(&tp, 0u) == ISO_TP_EVENT_NONE);
+
+	assert(iso_tp_test_push(&tp, 0x79Bu, 4u, sf) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_test_push(&tp, 0x7BBu, 4u, resp) ==
+	       ISO_TP_EVENT_N_USDATA_IND);
+	assert(iso_tp_is_edited(&tp));
+	assert(iso_tp_get_n_usdata(&tp, &ind));
+	assert((ind.len == 3u) && (ind.data[1] == 0x55u));
+	assert(ind.crc == iso_tp_crc32(0u, &resp[1], 3u));
+	assert(ind.crc != iso_tp_crc32(0u, ind.data, ind.len));
+}
+#endif
+
+int main ()
+{
+	struct iso_tp tp;
+
+	iso_tp_test_init(&tp);
+	/* iso_tp_test_example_log(&tp); */
+	iso_tp_test_override(&tp);
+
+	iso_tp_test_sessions();
+	iso_tp_test_queues();
+	iso_tp_test_zero_copy();
+	iso_tp_test_reassembly();
+	iso_tp_test_pool();
+	iso_tp_test_send();
+	iso_tp_test_timers();
+#ifndef ISO_TP_FIXED_RX_DL
+	iso_tp_test_can_fd();
+#else
+	iso_tp_test_fixed(); /* CAN FD can't be received by pinned CAN2.0 */
+#endif
+	iso_tp_test_large();
+	iso_tp_test_auto_fc();
+	iso_tp_test_batch();
+	iso_tp_test_filter();
+	iso_tp_test_patch();
+	iso_tp_test_rules();
+#ifdef ISO_TP_STATS
+	iso_tp_test_stats();
+#endif
+#ifndef ISO_TP_FIXED_ADDRESSING
+	iso_tp_test_addressing();
+#endif
+	iso_tp_test_gateway();
+	iso_tp_test_stream();
+	iso_tp_test_capture();
+	iso_tp_test_corr();
+	iso_tp_test_sched();
+	iso_tp_test_simd();
+#ifdef ISO_TP_CRC32
+	iso_tp_test_crc();
+#endif
 
 	return 0;
 }
@@ -0,0 +1,498 @@
+/**
+ * @file iso_tp_capture.h
+ * @brief Compact bus capture recorder and replay engine on top of iso_tp.h
+ *	  (Hardware-Agnostic)
+ *
+ * Capture is a byte stream: file header and then one record per frame.
+ * Typical record of classic CAN frame is 2-3 bytes plus payload.
+ *
+ * File header (ISO_TP_CAP_HEADER_LEN bytes):
+ * ```
+ * 'I' 'T' 'P' 'C' version 0 0 0
+ * ```
+ *
+ * Record:
+ * ```
+ * head  | bits 0-3: DLC (CAN_DL code, payload length)
+ *       | bit 4:    CAN ID is literal, otherwise dictionary index
+ *       | bit 5:    literal CAN ID is appended to dictionary
+ *       | bits 6-7: reserved, 0
+ * delta | microseconds since previous frame, LEB128 (1-5 bytes)
+ * id    | dictionary index (1 byte) or literal CAN ID (4 bytes, LE)
+ * data  | payload, exactly as many bytes as DLC says
+ * ```
+ *
+ * Dictionary holds up to ISO_TP_CAP_DICT_LEN CAN IDs, each is defined by
+ * the first record of its CAN ID, so capture is decoded from the beginning
+ * with no index. CAN IDs beyond dictionary are always literal.
+ *
+ * Recorder writes into user buffer and never allocates. Replay reads
+ * capture in place, so buffer may be a memory mapped file. Sizes and
+ * positions are 32-bit, so capture takes at most ISO_TP_CAP_SIZE_MAX
+ * bytes (4 GiB). Longer recordings must be split into separate captures,
+ * each one started by iso_tp_cap_rec_init (file header, new dictionary).
+ *
+ * Recording, push frames through recorder instead of iso_tp_push_frame:
+ * ```
+ * iso_tp_cap_push_frame(&rec, &tp, &rx, time_us);
+ * if (iso_tp_cap_rec_take(&rec, &len) != NULL) { write len bytes out }
+ * ```
+ *
+ * Replay, full speed (capture time) or real time (user time):
+ * ```
+ * iso_tp_cap_replay_init(&rp, map, map_size, ISO_TP_CAP_FULL_SPEED);
+ * while (iso_tp_cap_replay_step(&rp, &tp, delta_time_us, &ev)) { ... }
+ * ```
+ *
+ * **Conventions:**
+ * Same as iso_tp.h
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#include "iso_tp.h"
+
+/******************************************************************************
+ * CAPTURE DEFINITIONS
+ *****************************************************************************/
+#define ISO_TP_CAP_VERSION    1u /**< Format version @note Not standard */
+#define ISO_TP_CAP_HEADER_LEN 8u /**< File header length @note Not standard */
+
+#define ISO_TP_CAP_DICT_LEN 255u /**< CAN IDs in dictionary (1 byte index)
+				      @note Not standard */
+
+/** Largest capture, sizes and positions are 32-bit @note Not standard */
+#define ISO_TP_CAP_SIZE_MAX 0xFFFFFFFFu
+
+/** Longest record: head, delta, literal CAN ID and payload */
+#define ISO_TP_CAP_RECORD_MAX (1u + 5u + 4u + ISO_TP_MAX_CAN_DL)
+
+/* Record head bits */
+#define _ISO_TP_CAP_DLC_MASK 0x0Fu
+#define _ISO_TP_CAP_LITERAL  0x10u
+#define _ISO_TP_CAP_DEFINE   0x20u
+#define _ISO_TP_CAP_RESERVED 0xC0u
+
+/* CAN ID lookup of recorder (open addressing, never full) */
+#define _ISO_TP_CAP_HASH_LOG2 9u
+#define _ISO_TP_CAP_HASH_LEN  (1u << _ISO_TP_CAP_HASH_LOG2)
+#define _ISO_TP_CAP_HASH_FREE 0xFFu
+
+/** Replay speed @note Not standard */
+enum iso_tp_cap_speed {
+	/** Frames follow each other immediately, instance time is advanced
+	 *  by capture deltas (delta_time_us of replay step is ignored) */
+	ISO_TP_CAP_FULL_SPEED,
+
+	/** Frames are pushed when due by user time (delta_time_us of replay
+	 *  step), at most one frame per step */
+	ISO_TP_CAP_REAL_TIME
+};
+
+/******************************************************************************
+ * CAPTURE COMMON
+ *****************************************************************************/
+/** CAN_DL of DLC, see Table 2 (ISO 11898-1) */
+uint8_t _iso_tp_cap_dlc_len(uint8_t dlc)
+{
+	const uint8_t lut[16] = {
+		0u, 1u, 2u, 3u, 4u, 5u, 6u, 7u,
+		8u, 12u, 16u, 20u, 24u, 32u, 48u, 64u
+	};
+
+	return lut[dlc & _ISO_TP_CAP_DLC_MASK];
+}
+
+/** DLC of CAN_DL, CAN_DL must be valid (see _iso_tp_can_dl_pad) */
+uint8_t _iso_tp_cap_len_dlc(uint8_t len)
+{
+	uint8_t result = len;
+
+	if (len > 24u) {
+		result = (uint8_t)(13u + ((len > 32u) ? 1u : 0u) +
+					 ((len > 48u) ? 1u : 0u));
+	} else if (len > 8u) {
+		result = (uint8_t)(6u + (len / 4u));
+	} else {}
+
+	return result;
+}
+
+/******************************************************************************
+ * CAPTURE RECORDER
+ *****************************************************************************/
+/** Capture recorder @note Not standard */
+struct iso_tp_cap_rec {
+	uint8_t  *_buf;  /**< User buffer */
+	uint32_t  _size;
+	uint32_t  _pos;
+
+	uint32_t _last_us; /**< Time of the last recorded frame */
+	bool     _started; /**< Any frame is recorded */
+
+	/* Dictionary: CAN ID lookup, index by order of definition */
+	uint32_t _hash_id[_ISO_TP_CAP_HASH_LEN];
+	uint8_t  _hash_idx[_ISO_TP_CAP_HASH_LEN];
+	uint16_t _dict_len;
+
+	uint32_t frames; /**< Frames recorded */
+	uint32_t lost;   /**< Frames not recorded, buffer was full */
+};
+
+/** Hash slot of CAN ID */
+uint16_t _iso_tp_cap_hash(uint32_t id)
+{
+	return (uint16_t)((id * 2654435761u) >> (32u - _ISO_TP_CAP_HASH_LOG2));
+}
+
+/** Initialize recorder over buffer and write file header into it.
+ *  Returns false if buffer can't take file header and a single record */
+bool iso_tp_cap_rec_init(struct iso_tp_cap_rec *self, uint8_t *buf,
+			 uint32_t size)
+{
+	bool result = false;
+
+	self->_buf  = buf;
+	self->_size = 0u;
+	self->_pos  = 0u;
+
+	self->_last_us = 0u;
+	self->_started = false;
+
+	(void)memset(self->_hash_idx, (int)_ISO_TP_CAP_HASH_FREE,
+		     sizeof(self->_hash_idx));
+	self->_dict_len = 0u;
+
+	self->frames = 0u;
+	self->lost   = 0u;
+
+	if (size >= (ISO_TP_CAP_HEADER_LEN + ISO_TP_CAP_RECORD_MAX)) {
+		buf[0] = (uint8_t)'I';
+		buf[1] = (uint8_t)'T';
+		buf[2] = (uint8_t)'P';
+		buf[3] = (uint8_t)'C';
+		buf[4] = ISO_TP_CAP_VERSION;
+		buf[5] = 0u;
+		buf[6] = 0u;
+		buf[7] = 0u;
+
+		self->_size = size;
+		self->_pos  = ISO_TP_CAP_HEADER_LEN;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Record frame received at time_us (any monotonic microsecond clock,
+ *  may wrap). CAN_DL which is not valid is padded up with zeros, as on
+ *  the bus.
+ *  Returns false if buffer is full (frame is lost, see iso_tp_cap_rec_take)
+ */
+bool iso_tp_cap_rec_frame(struct iso_tp_cap_rec *self,
+			  const struct iso_tp_can_frame *f, uint32_t time_us)
+{
+	bool result = false;
+
+	uint8_t  *p = &self->_buf[self->_pos];
+	uint8_t   len = _iso_tp_can_dl_pad(f->len);
+	uint8_t   copy = f->len;
+	uint32_t  delta = self->_started ? (time_us - self->_last_us) : 0u;
+	uint16_t  slot = _iso_tp_cap_hash(f->id);
+	uint8_t   n = 1u;
+	uint8_t   i;
+
+	/* Bounded by free slots, dictionary never fills the table */
+	for (i = 0u; i < ISO_TP_CAP_DICT_LEN; i++) {
+		if ((self->_hash_idx[slot] == _ISO_TP_CAP_HASH_FREE) ||
+		    (self->_hash_id[slot] == f->id)) {
+			break;
+		}
+
+		slot = (uint16_t)((slot + 1u) & (_ISO_TP_CAP_HASH_LEN - 1u));
+	}
+
+	if (len > ISO_TP_MAX_CAN_DL) {
+		len = ISO_TP_MAX_CAN_DL;
+	}
+
+	if (copy > len) {
+		copy = len;
+	}
+
+	if ((self->_size - self->_pos) < ISO_TP_CAP_RECORD_MAX) {
+		self->lost++;
+	} else {
+		p[0] = _iso_tp_cap_len_dlc(len);
+
+		do {
+			p[n] = (uint8_t)(delta & 0x7Fu);
+			delta >>= 7u;
+
+			if (delta != 0u) {
+				p[n] |= 0x80u;
+			}
+
+			n++;
+		} while (delta != 0u);
+
+		if (self->_hash_idx[slot] != _ISO_TP_CAP_HASH_FREE) {
+			p[n] = self->_hash_idx[slot];
+			n++;
+		} else {
+			p[0] |= _ISO_TP_CAP_LITERAL;
+
+			/* Lookup is full of IDs once dictionary is */
+			if (self->_dict_len < ISO_TP_CAP_DICT_LEN) {
+				p[0] |= _ISO_TP_CAP_DEFINE;
+
+				self->_hash_id[slot]  = f->id;
+				self->_hash_idx[slot] =
+					(uint8_t)self->_dict_len;
+				self->_dict_len++;
+			}
+
+			for (i = 0u; i < 4u; i++) {
+				p[n] = (uint8_t)(f->id >> (8u * i));
+				n++;
+			}
+		}
+
+		/* Bytes past frame length are padding, not stale data */
+		(void)memcpy(&p[n], f->data, copy);
+		(void)memset(&p[n + copy], 0u, (size_t)len - copy);
+
+		self->_pos    += (uint32_t)n + len;
+		self->_last_us = time_us;
+		self->_started = true;
+		self->frames++;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Record frame, then push it for processing (see iso_tp_push_frame).
+ *  Frame is recorded even if RX queue is full, as it was on the bus.
+ *  Returns result of iso_tp_push_frame */
+bool iso_tp_cap_push_frame(struct iso_tp_cap_rec *self, struct iso_tp *tp,
+			   struct iso_tp_can_frame *f, uint32_t time_us)
+{
+	(void)iso_tp_cap_rec_frame(self, f, time_us);
+
+	return iso_tp_push_frame(tp, f);
+}
+
+/** Take recorded bytes, so they can be written out, and restart at the
+ *  beginning of buffer. Dictionary and time are kept, so chunks taken
+ *  one after another form a single capture (up to ISO_TP_CAP_SIZE_MAX
+ *  in total, see iso_tp_cap_rec_init).
+ *  Returns NULL if there's nothing recorded since last take. */
+const uint8_t *iso_tp_cap_rec_take(struct iso_tp_cap_rec *self,
+				   uint32_t *len)
+{
+	const uint8_t *result = NULL;
+
+	*len = self->_pos;
+
+	if (self->_pos > 0u) {
+		result = self->_buf;
+	}
+
+	self->_pos = 0u;
+
+	return result;
+}
+
+/******************************************************************************
+ * CAPTURE REPLAY
+ *****************************************************************************/
+/** Capture replay @note Not standard */
+struct iso_tp_cap_replay {
+	const uint8_t *_data; /**< Capture, read in place */
+	uint32_t       _size;
+	uint32_t       _pos;
+
+	uint32_t _dict[ISO_TP_CAP_DICT_LEN];
+	uint16_t _dict_len;
+
+	enum iso_tp_cap_speed _speed;
+
+	/* Frame read ahead, waiting to be due (real time) */
+	struct iso_tp_can_frame _next;
+	uint32_t                _next_delta;
+	bool                    _has_next;
+	uint32_t                _elapsed_us; /**< User time since last frame */
+
+	bool error; /**< Capture is malformed or truncated */
+};
+
+/** Initialize replay over capture (file header included).
+ *  Returns false if file header is not valid */
+bool iso_tp_cap_replay_init(struct iso_tp_cap_replay *self,
+			    const uint8_t *data, uint32_t size,
+			    enum iso_tp_cap_speed speed)
+{
+	bool result = false;
+
+	self->_data     = data;
+	self->_size     = 0u;
+	self->_pos      = 0u;
+	self->_dict_len = 0u;
+	self->_speed    = speed;
+
+	self->_next_delta = 0u;
+	self->_has_next   = false;
+	self->_elapsed_us = 0u;
+
+	self->error = true;
+
+	if ((size >= ISO_TP_CAP_HEADER_LEN) &&
+	    (data[0] == (uint8_t)'I') && (data[1] == (uint8_t)'T') &&
+	    (data[2] == (uint8_t)'P') && (data[3] == (uint8_t)'C') &&
+	    (data[4] == ISO_TP_CAP_VERSION)) {
+		self->_size = size;
+		self->_pos  = ISO_TP_CAP_HEADER_LEN;
+		self->error = false;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Read next frame and its delta to previous one (microseconds).
+ *  Returns false at the end of capture, or if capture is malformed, then
+ *  error is set and nothing is read anymore. */
+bool iso_tp_cap_read(struct iso_tp_cap_replay *self,
+		     struct iso_tp_can_frame *f, uint32_t *delta_us)
+{
+	bool result = false;
+
+	const uint8_t *p     = &self->_data[self->_pos];
+	uint32_t       avail = self->_size - self->_pos;
+	uint32_t       n     = 1u;
+	uint32_t       delta = 0u;
+	uint8_t        shift = 0u;
+	uint8_t        head  = 0u;
+	uint8_t        len   = 0u;
+	bool           more  = true; /**< Delta continues */
+	uint8_t        i;
+
+	if (avail > 0u) {
+		head = p[0];
+		len  = _iso_tp_cap_dlc_len(head);
+
+		self->error = ((head & _ISO_TP_CAP_RESERVED) != 0u) ||
+			      (len > ISO_TP_MAX_CAN_DL);
+	}
+
+	/* Delta, 5 bytes at most */
+	for (i = 0u; (i < 5u) && (n < avail) && more; i++) {
+		delta |= (uint32_t)(p[n] & 0x7Fu) << shift;
+		more   = ((p[n] & 0x80u) != 0u);
+		shift += 7u;
+		n++;
+	}
+
+	if ((avail == 0u) || self->error) {
+		/* End of capture */
+	} else if (more) {
+		self->error = true;
+	} else if ((head & _ISO_TP_CAP_LITERAL) == 0u) {
+		if (((avail - n) < (1u + (uint32_t)len)) ||
+		    (p[n] >= self->_dict_len)) {
+			self->error = true;
+		} else {
+			f->id = self->_dict[p[n]];
+			n++;
+		}
+	} else if ((avail - n) < (4u + (uint32_t)len)) {
+		self->error = true;
+	} else {
+		f->id = (uint32_t)p[n] | ((uint32_t)p[n + 1u] << 8u) |
+			((uint32_t)p[n + 2u] << 16u) |
+			((uint32_t)p[n + 3u] << 24u);
+		n += 4u;
+
+		if ((head & _ISO_TP_CAP_DEFINE) == 0u) {
+			/* Dictionary was full */
+		} else if (self->_dict_len < ISO_TP_CAP_DICT_LEN) {
+			self->_dict[self->_dict_len] = f->id;
+			self->_dict_len++;
+		} else {
+			self->error = true;
+		}
+	}
+
+	if ((avail > 0u) && !self->error) {
+		f->len = len;
+		(void)memcpy(f->data, &p[n], len);
+		*delta_us = delta;
+
+		self->_pos += n + len;
+
+		result = true;
+	}
+
+	if (self->error) {
+		self->_pos = self->_size;
+	}
+
+	return result;
+}
+
+/** Replay step: push next frame of capture (see iso_tp_cap_speed) and step
+ *  instance (see iso_tp_step_us), event is returned through ev.
+ *  Returns false once capture is over, instance is not stepped then. */
+bool iso_tp_cap_replay_step(struct iso_tp_cap_replay *self,
+			    struct iso_tp *tp, uint32_t delta_time_us,
+			    enum iso_tp_event *ev)
+{
+	bool     result = false;
+	uint32_t step_us = delta_time_us;
+
+	if (!self->_has_next) {
+		self->_has_next = iso_tp_cap_read(self, &self->_next,
+						  &self->_next_delta);
+	}
+
+	if (self->_speed == ISO_TP_CAP_FULL_SPEED) {
+		self->_elapsed_us = self->_next_delta;
+		step_us           = self->_next_delta;
+	} else {
+		self->_elapsed_us += delta_time_us;
+	}
+
+	if (!self->_has_next) {
+		/* End of capture */
+	} else if (self->_elapsed_us >= self->_next_delta) {
+		/* Late frame keeps its lag, so next ones catch up */
+		self->_elapsed_us -= self->_next_delta;
+		self->_has_next    = false;
+
+		(void)iso_tp_push_frame(tp, &self->_next);
+
+		result = true;
+	} else {
+		/* Timers only, frame isn't due */
+		result = true;
+	}
+
+	if (result) {
+		*ev = iso_tp_step_us(tp, step_us);
+	}
+
+	return result;
+}
@@ -0,0 +1,475 @@
+/**
+ * @file iso_tp_corr.h
+ * @brief Request/response correlation and latency histograms on top of
+ *	  iso_tp.h (Hardware-Agnostic)
+ *
+ * Pairs requests (SF or FF) of tester CAN ID with responses (SF or FF) of
+ * ECU CAN ID and measures response time, from the first frame of request
+ * to the first frame of final response. Negative response 0x78
+ * (requestCorrectlyReceived-ResponsePending) doesn't end request, it only
+ * keeps it alive.
+ *
+ * Latencies are kept by key: ECU CAN ID, service (SID) and up to
+ * ISO_TP_CORR_SUB_LEN bytes after SID (sub-function, local identifier or
+ * DID). Every key has histogram of log2 buckets of microseconds.
+ *
+ * Everything lives inside struct iso_tp_corr, cost per step is one frame
+ * peek and a scan of pairs, so it may run always-on next to
+ * iso_tp_step (or iso_tp_gw_step, one struct iso_tp_corr per bus):
+ * ```
+ * ev = iso_tp_step_us(&tp, delta_time_us);
+ * iso_tp_corr_step(&corr, &tp, delta_time_us);
+ * ```
+ * Only received frames are seen by step. Requests the instance sends
+ * itself (iso_tp_send) are told by iso_tp_corr_request.
+ *
+ * **Conventions:**
+ * Same as iso_tp.h
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#include "iso_tp.h"
+
+/******************************************************************************
+ * CORRELATION DEFINITIONS
+ *****************************************************************************/
+#ifndef ISO_TP_CORR_MAX_PAIRS
+#define ISO_TP_CORR_MAX_PAIRS 4u /**< Tester/ECU pairs, one outstanding
+				      request each. May be overriden before
+				      include. @note Not standard */
+#endif
+
+#ifndef ISO_TP_CORR_HIST_LOG2
+#define ISO_TP_CORR_HIST_LOG2 5u /**< log2 of histogram table capacity.
+				      May be overriden before include.
+				      @note Not standard */
+#endif
+
+/** Maximum number of keys (histograms) @note Not standard */
+#define ISO_TP_CORR_MAX_HIST (1u << ISO_TP_CORR_HIST_LOG2)
+
+#ifndef ISO_TP_CORR_SUB_LEN
+#define ISO_TP_CORR_SUB_LEN 2u /**< Request bytes after SID in key (0-2).
+				    May be overriden before include.
+				    @note Not standard */
+#endif
+
+/** Number of log2 buckets, bucket N counts latencies of [2^N, 2^(N+1)) us
+ *  (bucket 0 also takes 0 us), the last one takes everything above.
+ *  @note Not standard */
+#define ISO_TP_CORR_BUCKETS 24u
+
+/** Empty slot of histogram table */
+#define _ISO_TP_CORR_FREE 0xFFu
+
+/* Key of histogram table is hashed like session key */
+ISO_TP_STATIC_ASSERT(_iso_tp_corr_assert_hist_log2,
+		     (ISO_TP_CORR_HIST_LOG2 >= 1u) &&
+		     (ISO_TP_CORR_HIST_LOG2 <= 7u));
+
+ISO_TP_STATIC_ASSERT(_iso_tp_corr_assert_sub_len,
+		     ISO_TP_CORR_SUB_LEN <= 2u);
+
+/* Pair index is kept in 8 bits */
+ISO_TP_STATIC_ASSERT(_iso_tp_corr_assert_max_pairs,
+		     (ISO_TP_CORR_MAX_PAIRS >= 1u) &&
+		     (ISO_TP_CORR_MAX_PAIRS <= 255u));
+
+/******************************************************************************
+ * CORRELATION TYPE AND DATA DEFINITIONS AND IMPLEMENTATION
+ *****************************************************************************/
+/** Latency histogram of key @note Not standard */
+struct iso_tp_corr_hist {
+	/* Key */
+	uint32_t ecu_id; /**< CAN ID of responses */
+	uint8_t  sid;    /**< Service identifier of request */
+	uint16_t sub;    /**< Request bytes after SID, big endian */
+
+	uint32_t count;    /**< Responses, positive or negative */
+	uint32_t negative; /**< Negative responses (but 0x78) */
+	uint32_t pending;  /**< Negative responses 0x78 */
+	uint32_t timeouts; /**< Requests with no response */
+	uint32_t max_us;   /**< Longest response time */
+
+	uint32_t buckets[ISO_TP_CORR_BUCKETS];
+};
+
+/** Outstanding request of pair */
+struct _iso_tp_corr_pair {
+	uint32_t tester_id;
+	uint32_t ecu_id;
+
+	bool     active;   /**< Request is waiting for response */
+	uint8_t  hist;     /**< Histogram of request */
+	uint32_t req_us;   /**< Time of request */
+	uint32_t alive_us; /**< Time of request or the last 0x78 */
+};
+
+/** Main correlation instance @note Not standard */
+struct iso_tp_corr {
+	struct _iso_tp_corr_pair _pairs[ISO_TP_CORR_MAX_PAIRS];
+	uint8_t                  _n_pairs;
+
+	struct iso_tp_corr_hist _hist[ISO_TP_CORR_MAX_HIST];
+	uint8_t                 _hist_idx[ISO_TP_CORR_MAX_HIST * 2u];
+	uint8_t                 _n_hist;
+
+	uint32_t _now_us;
+	uint32_t _timeout_us; /**< P2*max of ECUs, request is lost after */
+
+	uint32_t untracked; /**< Requests not tracked, histograms are full */
+};
+
+/** Initialize instance, request with no response within timeout_ms is
+ *  counted as timeout (P2*max, 5000 ms by ISO 14229-2). */
+void iso_tp_corr_init(struct iso_tp_corr *self, uint32_t timeout_ms)
+{
+	self->_n_pairs = 0u;
+	self->_n_hist  = 0u;
+
+	(void)memset(self->_hist_idx, (int)_ISO_TP_CORR_FREE,
+		     sizeof(self->_hist_idx));
+
+	self->_now_us     = 0u;
+	self->_timeout_us = timeout_ms * 1000u;
+
+	self->untracked = 0u;
+}
+
+/** Add tester and ECU pair. Functionally addressed tester CAN ID may be
+ *  paired with every ECU, request is then outstanding for all of them.
+ *  Returns false if there's no room (see ISO_TP_CORR_MAX_PAIRS) */
+bool iso_tp_corr_add_pair(struct iso_tp_corr *self, uint32_t tester_id,
+			  uint32_t ecu_id)
+{
+	bool result = false;
+
+	struct _iso_tp_corr_pair *p;
+
+	if (self->_n_pairs < ISO_TP_CORR_MAX_PAIRS) {
+		p = &self->_pairs[self->_n_pairs];
+
+		p->tester_id = tester_id;
+		p->ecu_id    = ecu_id;
+		p->active    = false;
+		p->hist      = 0u;
+		p->req_us    = 0u;
+		p->alive_us  = 0u;
+
+		self->_n_pairs++;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Bucket of latency: floor(log2(us)), binary search of 5 steps */
+uint8_t _iso_tp_corr_bucket(uint32_t us)
+{
+	uint8_t  result = 0u;
+	uint32_t v      = us;
+	uint8_t  shift  = 16u;
+
+	while (shift > 0u) {
+		if ((v >> shift) != 0u) {
+			v >>= shift;
+			result += shift;
+		}
+
+		shift >>= 1u;
+	}
+
+	return (result < ISO_TP_CORR_BUCKETS) ?
+	       result : (uint8_t)(ISO_TP_CORR_BUCKETS - 1u);
+}
+
+/** Histogram slot of key, hashed like session key */
+uint8_t _iso_tp_corr_hash(uint32_t ecu_id, uint8_t sid, uint16_t sub)
+{
+	return (uint8_t)(((ecu_id ^ ((uint32_t)sid << 24u) ^
+			   ((uint32_t)sub << 8u)) * 2654435761u) >>
+			 (32u - (ISO_TP_CORR_HIST_LOG2 + 1u)));
+}
+
+/** Find or add histogram of key. Returns _ISO_TP_CORR_FREE if table is
+ *  full. Probing is bounded, table is twice as big as histograms. */
+uint8_t _iso_tp_corr_hist(struct iso_tp_corr *self, uint32_t ecu_id,
+			  uint8_t sid, uint16_t sub)
+{
+	uint8_t result = _ISO_TP_CORR_FREE;
+
+	uint8_t  mask = (uint8_t)((ISO_TP_CORR_MAX_HIST * 2u) - 1u);
+	uint8_t  slot = _iso_tp_corr_hash(ecu_id, sid, sub);
+	uint16_t i;
+
+	for (i = 0u; i < (ISO_TP_CORR_MAX_HIST * 2u); i++) {
+		uint8_t idx = self->_hist_idx[slot];
+
+		if (idx == _ISO_TP_CORR_FREE) {
+			break;
+		}
+
+		if ((self->_hist[idx].ecu_id == ecu_id) &&
+		    (self->_hist[idx].sid == sid) &&
+		    (self->_hist[idx].sub == sub)) {
+			result = idx;
+			break;
+		}
+
+		slot = (uint8_t)((slot + 1u) & mask);
+	}
+
+	if ((result == _ISO_TP_CORR_FREE) &&
+	    (self->_n_hist < ISO_TP_CORR_MAX_HIST) &&
+	    (self->_hist_idx[slot] == _ISO_TP_CORR_FREE)) {
+		struct iso_tp_corr_hist *h = &self->_hist[self->_n_hist];
+
+		(void)memset(h, 0u, sizeof(struct iso_tp_corr_hist));
+		h->ecu_id = ecu_id;
+		h->sid    = sid;
+		h->sub    = sub;
+
+		result = self->_n_hist;
+		self->_hist_idx[slot] = result;
+		self->_n_hist++;
+	}
+
+	return result;
+}
+
+/** Key bytes of request after SID */
+uint16_t _iso_tp_corr_sub(const uint8_t *n_data, uint32_t len)
+{
+	uint16_t result = 0u;
+
+	uint8_t i;
+
+	for (i = 1u; (i <= ISO_TP_CORR_SUB_LEN) && (i < len); i++) {
+		result = (uint16_t)((result << 8u) | n_data[i]);
+	}
+
+	return result;
+}
+
+/** Request of tester, outstanding for every pair of tester */
+void _iso_tp_corr_request(struct iso_tp_corr *self, uint32_t id,
+			  const uint8_t *n_data, uint8_t len)
+{
+	uint16_t sub = _iso_tp_corr_sub(n_data, len);
+	uint8_t  i;
+
+	for (i = 0u; i < self->_n_pairs; i++) {
+		struct _iso_tp_corr_pair *p = &self->_pairs[i];
+
+		if (p->tester_id != id) {
+			continue;
+		}
+
+		/* Previous request is overtaken, it got no response */
+		if (p->active) {
+			self->_hist[p->hist].timeouts++;
+		}
+
+		p->hist     = _iso_tp_corr_hist(self, p->ecu_id, n_data[0],
+						sub);
+		p->active   = (p->hist != _ISO_TP_CORR_FREE);
+		p->req_us   = self->_now_us;
+		p->alive_us = self->_now_us;
+
+		if (!p->active) {
+			self->untracked++;
+		}
+	}
+}
+
+/** Response of ECU, ends outstanding request of its pair. Returns true if
+ *  it does */
+bool _iso_tp_corr_response(struct iso_tp_corr *self, uint32_t id,
+			   const uint8_t *n_data, uint8_t len)
+{
+	bool result = false;
+
+	uint32_t latency;
+	uint8_t  i;
+
+	for (i = 0u; i < self->_n_pairs; i++) {
+		struct _iso_tp_corr_pair *p = &self->_pairs[i];
+		struct iso_tp_corr_hist  *h;
+
+		bool neg;
+
+		if ((p->ecu_id != id) || !p->active) {
+			continue;
+		}
+
+		h   = &self->_hist[p->hist];
+		neg = (n_data[0] == 0x7Fu) && (len >= 3u) &&
+		      (n_data[1] == h->sid);
+
+		if (neg && (n_data[2] == 0x78u)) {
+			p->alive_us = self->_now_us;
+			h->pending++;
+		} else if (neg || (n_data[0] == (uint8_t)(h->sid + 0x40u))) {
+			latency = self->_now_us - p->req_us;
+
+			h->count++;
+			h->negative += neg ? 1u : 0u;
+			h->buckets[_iso_tp_corr_bucket(latency)]++;
+
+			if (latency > h->max_us) {
+				h->max_us = latency;
+			}
+
+			p->active = false;
+
+			result = true;
+		} else {
+			/* Not a response to request */
+		}
+	}
+
+	return result;
+}
+
+/** Tell request sent by this node on tester_id (see iso_tp_send), it's
+ *  outstanding for every pair of tester from now on */
+void iso_tp_corr_request(struct iso_tp_corr *self, uint32_t tester_id,
+			 const uint8_t *data, uint32_t len)
+{
+	/* Only SID and key bytes are looked at */
+	if (len > 0u) {
+		_iso_tp_corr_request(self, tester_id, data,
+				     (len > 0xFFu) ? 0xFFu : (uint8_t)len);
+	}
+}
+
+/** Correlate frame processed by the last step of instance, call after
+ *  every step with the same delta. Returns true if response had ended
+ *  request. */
+bool iso_tp_corr_step(struct iso_tp_corr *self, struct iso_tp *tp,
+		      uint32_t delta_time_us)
+{
+	bool result = false;
+
+	const struct iso_tp_can_frame *f     = NULL;
+	const struct iso_tp_n_pci     *n_pci = NULL;
+	const uint8_t                 *n_data = NULL;
+	uint8_t                        len    = 0u;
+
+	uint8_t i;
+
+	self->_now_us += delta_time_us;
+
+	for (i = 0u; i < self->_n_pairs; i++) {
+		struct _iso_tp_corr_pair *p = &self->_pairs[i];
+
+		if (p->active &&
+		    ((self->_now_us - p->alive_us) > self->_timeout_us)) {
+			self->_hist[p->hist].timeouts++;
+			p->active = false;
+		}
+	}
+
+	if (!iso_tp_peek_frame(tp, &f) ||
+	    !iso_tp_peek_n_pdu(tp, &n_pci, &n_data, &len) || (len == 0u)) {
+		/* Nothing to correlate */
+	} else if ((n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_SF) &&
+		   (n_pci->n_pcitype != (uint8_t)ISO_TP_N_PCITYPE_FF)) {
+		/* Only the first frame of message tells */
+	} else {
+		/* Node may be tester of one pair and ECU of another */
+		result = _iso_tp_corr_response(self, f->id, n_data, len);
+		_iso_tp_corr_request(self, f->id, n_data, len);
+	}
+
+	return result;
+}
+
+/** Find histogram of key. Key sub holds up to ISO_TP_CORR_SUB_LEN request
+ *  bytes after SID, as many as request had. Returns NULL if there's none */
+const struct iso_tp_corr_hist *iso_tp_corr_find(struct iso_tp_corr *self,
+						uint32_t ecu_id, uint8_t sid,
+						uint16_t sub)
+{
+	const struct iso_tp_corr_hist *result = NULL;
+
+	uint8_t i;
+
+	for (i = 0u; i < self->_n_hist; i++) {
+		const struct iso_tp_corr_hist *h = &self->_hist[i];
+
+		if ((h->ecu_id == ecu_id) && (h->sid == sid) &&
+		    (h->sub == sub)) {
+			result = h;
+		}
+	}
+
+	return result;
+}
+
+/** Get histogram by index, to walk all of them (index < number of
+ *  histograms). Returns NULL past the last one */
+const struct iso_tp_corr_hist *iso_tp_corr_at(struct iso_tp_corr *self,
+					      uint8_t index)
+{
+	return (index < self->_n_hist) ? &self->_hist[index] : NULL;
+}
+
+/** Upper bound of latency (us) under which percent of responses of
+ *  histogram are (bucket resolution). Returns 0 if there are none */
+uint32_t iso_tp_corr_percentile(const struct iso_tp_corr_hist *h,
+				uint8_t percent)
+{
+	uint32_t result = 0u;
+
+	/* Rounded up, with no overflow */
+	uint32_t need = ((h->count / 100u) * percent) +
+			((((h->count % 100u) * percent) + 99u) / 100u);
+	uint32_t sum  = 0u;
+	uint8_t  i;
+
+	for (i = 0u; (i < ISO_TP_CORR_BUCKETS) && (h->count > 0u); i++) {
+		sum += h->buckets[i];
+
+		if (sum >= need) {
+			result = (i < (ISO_TP_CORR_BUCKETS - 1u)) ?
+				 ((2u << i) - 1u) : h->max_us;
+			break;
+		}
+	}
+
+	return result;
+}
+
+/** Expected response time (us) of request data to ECU, percentile of its
+ *  histogram (see iso_tp_corr_percentile). Returns 0 if it's not known */
+uint32_t iso_tp_corr_latency(struct iso_tp_corr *self, uint32_t ecu_id,
+			     const uint8_t *data, uint32_t len,
+			     uint8_t percent)
+{
+	uint32_t result = 0u;
+
+	const struct iso_tp_corr_hist *h = NULL;
+
+	if (len > 0u) {
+		h = iso_tp_corr_find(self, ecu_id, data[0],
+				     _iso_tp_corr_sub(data, len));
+	}
+
+	if (h != NULL) {
+		result = iso_tp_corr_percentile(h, percent);
+	}
+
+	return result;
+}
@@ -0,0 +1,399 @@
+/**
+ * @file iso_tp_gateway.h
+ * @brief Multi-bus ISO-TP gateway on top of iso_tp.h (Hardware-Agnostic)
+ *
+ * One struct iso_tp per CAN bus, so every bus may be served by its own
+ * core (or thread) with no locks. Frames received on a bus are forwarded
+ * to other buses by route table through lock-free single producer,
+ * single consumer links: link[from][to] is written only by context of bus
+ * `from` and read only by context of bus `to`. Sessions, queues and
+ * counters of bus are touched by its own context only, route table is
+ * read-only once buses run. Nothing is shared otherwise.
+ *
+ * Each bus context runs (see iso_tp_gw_step, iso_tp_gw_pop_frame):
+ * ```
+ * iso_tp_push_frame(iso_tp_gw_bus(gw, bus), &rx);  (or CAN ISR)
+ * ev = iso_tp_gw_step(gw, bus, delta_time_ms);
+ * while (iso_tp_gw_pop_frame(gw, bus, &tx)) { transmit tx on bus }
+ * ```
+ *
+ * Frame of a step is forwarded at the beginning of the next step of its
+ * bus, so the user may patch it meanwhile (iso_tp_patch) or drop it
+ * (iso_tp_gw_drop). Frames generated by instance itself (FC, iso_tp_send,
+ * iso_tp_override_n_pdu) are transmitted on the bus of instance.
+ * Batches must be pushed by iso_tp_gw_push_frames (not iso_tp_push_frames
+ * of instance), their frames can't be patched and are forwarded at once.
+ *
+ * Include this header instead of iso_tp.h: links cross cores, so
+ * ISO_TP_SPSC_BARRIER defaults to a full memory fence here, and head and
+ * tail of queues are kept on different cache lines.
+ *
+ * **Conventions:**
+ * Same as iso_tp.h
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#ifndef ISO_TP_SPSC_BARRIER
+#ifdef __GNUC__
+/** Producer and consumer of gateway links run on different cores */
+#define ISO_TP_SPSC_BARRIER() __sync_synchronize()
+#endif
+#endif
+
+#ifndef ISO_TP_GW_CACHE_LINE
+#define ISO_TP_GW_CACHE_LINE 64u /**< Padding between data of different
+				      contexts, against false sharing.
+				      @note Not standard */
+#endif
+
+#ifndef ISO_TP_QUEUE_CACHE_LINE
+/** Head and tail of link are written by different cores */
+#define ISO_TP_QUEUE_CACHE_LINE ISO_TP_GW_CACHE_LINE
+#endif
+
+#include "iso_tp.h"
+
+/******************************************************************************
+ * GATEWAY DEFINITIONS
+ *****************************************************************************/
+#ifndef ISO_TP_GW_MAX_BUSES
+#define ISO_TP_GW_MAX_BUSES 2u /**< Number of buses. May be overriden before
+				    include. @note Not standard */
+#endif
+
+/* Head and tail are apart only if this header is included first */
+ISO_TP_STATIC_ASSERT(_iso_tp_gw_assert_queue_pad,
+		     (offsetof(struct iso_tp_frame_queue, tail) -
+		      offsetof(struct iso_tp_frame_queue, head)) >=
+		     ISO_TP_GW_CACHE_LINE);
+
+/* Destination buses of route are bitmask */
+ISO_TP_STATIC_ASSERT(_iso_tp_gw_assert_max_buses,
+		     (ISO_TP_GW_MAX_BUSES >= 1u) &&
+		     (ISO_TP_GW_MAX_BUSES <= 8u));
+
+/******************************************************************************
+ * GATEWAY TYPE AND DATA DEFINITIONS AND IMPLEMENTATION
+ *****************************************************************************/
+/** Route: frames of bus `from` matching rule go to buses of `to_mask`
+ *  (bit per bus, bus `from` itself is skipped). @note Not standard */
+struct iso_tp_gw_route {
+	uint8_t from;    /**< Source bus */
+	uint8_t to_mask; /**< Destination buses */
+
+	struct iso_tp_filter_rule match; /**< CAN IDs of route */
+};
+
+/** Counters of bus, written by its context only. @note Not standard */
+struct iso_tp_gw_stats {
+	uint32_t forwarded; /**< Frames put into links to other buses */
+	uint32_t fwd_drops; /**< Frames lost, link to other bus was full */
+	uint32_t dropped;   /**< Frames dropped by user (see iso_tp_gw_drop) */
+	uint32_t received;  /**< Frames received from other buses */
+};
+
+/** Link between two buses (SPSC queue) @note Not standard */
+struct _iso_tp_gw_link {
+	struct iso_tp_frame_queue q;
+
+	uint8_t _pad[ISO_TP_GW_CACHE_LINE]; /**< Next link is not ours */
+};
+
+/** Bus of gateway: its instance and forwarding state @note Not standard */
+struct _iso_tp_gw_bus {
+	struct iso_tp tp; /**< Instance of bus */
+
+	bool    fwd_pending; /**< Frame of the last step is to be forwarded */
+	bool    fwd_drop;    /**< User dropped frame of the last step */
+	uint8_t rr;          /**< Next inbound link to pop (round robin) */
+
+	struct iso_tp_gw_stats stats;
+
+	uint8_t _pad[ISO_TP_GW_CACHE_LINE]; /**< Next bus is not ours */
+};
+
+/** Main gateway instance @note Not standard */
+struct iso_tp_gw {
+	struct _iso_tp_gw_bus  _buses[ISO_TP_GW_MAX_BUSES];
+	struct _iso_tp_gw_link _links[ISO_TP_GW_MAX_BUSES]
+				     [ISO_TP_GW_MAX_BUSES]; /**< [from][to] */
+
+	uint8_t _n_buses;
+
+	/* Route table, read-only while buses run */
+	const struct iso_tp_gw_route *_routes;
+	uint8_t                       _n_routes;
+
+	/** Destinations of 11-bit CAN IDs by source bus */
+	uint8_t _route_std[ISO_TP_GW_MAX_BUSES][0x800u];
+};
+
+/** Initialize gateway of n_buses (up to ISO_TP_GW_MAX_BUSES) and all of
+ *  its instances. Instances must be configured afterwards (see
+ *  iso_tp_gw_bus). No routes are set, so nothing is forwarded. */
+void iso_tp_gw_init(struct iso_tp_gw *self, uint8_t n_buses)
+{
+	uint8_t i;
+	uint8_t j;
+
+	self->_n_buses = (n_buses > ISO_TP_GW_MAX_BUSES) ?
+			 ISO_TP_GW_MAX_BUSES : n_buses;
+
+	for (i = 0u; i < ISO_TP_GW_MAX_BUSES; i++) {
+		struct _iso_tp_gw_bus *bus = &self->_buses[i];
+
+		iso_tp_init(&bus->tp);
+
+		bus->fwd_pending = false;
+		bus->fwd_drop    = false;
+		bus->rr          = 0u;
+
+		(void)memset(&bus->stats, 0u, sizeof(struct iso_tp_gw_stats));
+
+		for (j = 0u; j < ISO_TP_GW_MAX_BUSES; j++) {
+			_iso_tp_queue_init(&self->_links[i][j].q);
+		}
+	}
+
+	self->_routes   = NULL;
+	self->_n_routes = 0u;
+
+	(void)memset(self->_route_std, 0u, sizeof(self->_route_std));
+}
+
+/** Get instance of bus, to configure it, push received frames, send
+ *  messages, etc. Must be used from the context of that bus only. */
+struct iso_tp *iso_tp_gw_bus(struct iso_tp_gw *self, uint8_t bus)
+{
+	return &self->_buses[bus].tp;
+}
+
+/** Set route table. Routes of 11-bit CAN IDs are compiled into lookup
+ *  table, 29-bit ones are matched by rules directly. Table is not copied
+ *  and must stay valid. Must be called before buses run.
+ *  Returns false if route refers to nonexistent bus (routes are cleared) */
+bool iso_tp_gw_set_routes(struct iso_tp_gw *self,
+			  const struct iso_tp_gw_route *routes,
+			  uint8_t n_routes)
+{
+	bool result = true;
+
+	uint32_t id;
+	uint8_t  i;
+
+	for (i = 0u; i < n_routes; i++) {
+		if (routes[i].from >= self->_n_buses) {
+			result = false;
+		}
+	}
+
+	self->_routes   = result ? routes : NULL;
+	self->_n_routes = result ? n_routes : 0u;
+
+	(void)memset(self->_route_std, 0u, sizeof(self->_route_std));
+
+	for (i = 0u; i < self->_n_routes; i++) {
+		const struct iso_tp_gw_route *r = &routes[i];
+
+		for (id = 0u; id <= 0x7FFu; id++) {
+			if (_iso_tp_filter_rule_match(&r->match, id)) {
+				self->_route_std[r->from][id] |= r->to_mask;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Destination buses of frame of CAN ID received on bus */
+uint8_t _iso_tp_gw_route_mask(struct iso_tp_gw *self, uint8_t bus,
+			      uint32_t id)
+{
+	uint8_t result = 0u;
+
+	uint8_t i;
+
+	if (id <= 0x7FFu) {
+		result = self->_route_std[bus][id];
+	} else {
+		for (i = 0u; i < self->_n_routes; i++) {
+			const struct iso_tp_gw_route *r = &self->_routes[i];
+
+			if ((r->from == bus) &&
+			    _iso_tp_filter_rule_match(&r->match, id)) {
+				result |= r->to_mask;
+			}
+		}
+	}
+
+	/* Never back to its own bus */
+	return result & (uint8_t)~(1u << bus);
+}
+
+/** Put frame received on bus into links to its destination buses.
+ *  Producer side of links [bus][*] */
+void _iso_tp_gw_forward(struct iso_tp_gw *self, uint8_t bus,
+			const struct iso_tp_can_frame *f)
+{
+	struct _iso_tp_gw_bus *b = &self->_buses[bus];
+
+	uint8_t mask = _iso_tp_gw_route_mask(self, bus, f->id);
+	uint8_t i;
+
+	for (i = 0u; (i < self->_n_buses) && (mask != 0u); i++) {
+		struct iso_tp_frame_queue *q = &self->_links[bus][i].q;
+		struct iso_tp_can_frame   *slot;
+
+		if (((mask >> i) & 1u) == 0u) {
+			continue;
+		}
+
+		slot = _iso_tp_queue_back(q);
+
+		if (slot != NULL) {
+			*slot = *f;
+			_iso_tp_queue_commit(q);
+
+			b->stats.forwarded++;
+		} else {
+			b->stats.fwd_drops++;
+		}
+	}
+}
+
+/** Step instance of bus (see iso_tp_step). Frame processed by the previous
+ *  step of bus (received, passed through or patched) is forwarded first,
+ *  unless dropped. Must be called from the context of that bus only. */
+enum iso_tp_event iso_tp_gw_step(struct iso_tp_gw *self, uint8_t bus,
+				 uint32_t delta_time_ms)
+{
+	struct _iso_tp_gw_bus *b = &self->_buses[bus];
+
+	const struct iso_tp_can_frame *f = NULL;
+
+	enum iso_tp_event ev;
+
+	/* Frame is still valid, the next step releases it */
+	if (b->fwd_pending && !b->fwd_drop && iso_tp_peek_frame(&b->tp, &f)) {
+		_iso_tp_gw_forward(self, bus, f);
+	}
+
+	ev = iso_tp_step(&b->tp, delta_time_ms);
+
+	b->fwd_pending = iso_tp_peek_frame(&b->tp, &f);
+	b->fwd_drop    = false;
+
+	return ev;
+}
+
+/** Push batch received on bus (see iso_tp_push_frames). Frame of the
+ *  previous step goes first, then every frame processed is forwarded at
+ *  once (batch frames can't be patched or dropped). Must be called from
+ *  the context of that bus only. Returns number of frames processed */
+uint16_t iso_tp_gw_push_frames(struct iso_tp_gw *self, uint8_t bus,
+			       const struct iso_tp_frame_view *view,
+			       struct iso_tp_frame_desc *desc,
+			       uint16_t *n_desc)
+{
+	struct _iso_tp_gw_bus *b = &self->_buses[bus];
+
+	const struct iso_tp_can_frame *f = NULL;
+
+	struct iso_tp_can_frame fwd;
+
+	uint16_t result;
+	uint16_t i;
+
+	/* Slot of frame is released by batch */
+	if (b->fwd_pending && !b->fwd_drop && iso_tp_peek_frame(&b->tp, &f)) {
+		_iso_tp_gw_forward(self, bus, f);
+	}
+
+	b->fwd_pending = false;
+	b->fwd_drop    = false;
+
+	result = iso_tp_push_frames(&b->tp, view, desc, n_desc);
+
+	for (i = 0u; i < result; i++) {
+		const uint8_t *frame = &view->base[(uint32_t)i * view->stride];
+
+		fwd.len = frame[view->len_offset];
+
+		/* Longer one is not a CAN frame of instance */
+		if (fwd.len <= ISO_TP_MAX_CAN_DL) {
+			(void)memcpy(&fwd.id, &frame[view->id_offset],
+				     sizeof(uint32_t));
+			(void)memcpy(fwd.data, &frame[view->data_offset],
+				     fwd.len);
+
+			fwd.id &= view->id_mask;
+
+			_iso_tp_gw_forward(self, bus, &fwd);
+		}
+	}
+
+	return result;
+}
+
+/** Don't forward frame processed by the last step of bus (filtering).
+ *  Must be called from the context of that bus only. */
+void iso_tp_gw_drop(struct iso_tp_gw *self, uint8_t bus)
+{
+	struct _iso_tp_gw_bus *b = &self->_buses[bus];
+
+	if (b->fwd_pending && !b->fwd_drop) {
+		b->fwd_drop = true;
+
+		b->stats.dropped++;
+	}
+}
+
+/** Pop frame to transmit on bus: frames of its instance go first, then
+ *  frames forwarded from other buses, one link after another.
+ *  Consumer side of links [*][bus]. Returns false if there's nothing to
+ *  transmit. Must be called from the context of that bus only. */
+bool iso_tp_gw_pop_frame(struct iso_tp_gw *self, uint8_t bus,
+			 struct iso_tp_can_frame *f)
+{
+	struct _iso_tp_gw_bus *b = &self->_buses[bus];
+
+	bool result = iso_tp_pop_frame(&b->tp, f);
+
+	uint8_t i;
+
+	for (i = 0u; (i < self->_n_buses) && !result; i++) {
+		struct iso_tp_frame_queue *q    = &self->_links[b->rr][bus].q;
+		struct iso_tp_can_frame   *slot = _iso_tp_queue_front(q);
+
+		if (slot != NULL) {
+			*f = *slot;
+			_iso_tp_queue_release(q);
+
+			b->stats.received++;
+
+			result = true;
+		}
+
+		b->rr = (uint8_t)((b->rr + 1u) % self->_n_buses);
+	}
+
+	return result;
+}
+
+/** Copy counters of bus. Must be called from the context of that bus,
+ *  otherwise counters may be torn. */
+void iso_tp_gw_get_stats(struct iso_tp_gw *self, uint8_t bus,
+			 struct iso_tp_gw_stats *stats)
+{
+	*stats = self->_buses[bus].stats;
+}
@@ -0,0 +1,365 @@
+/**
+ * @file iso_tp_sched.h
+ * @brief Polling scheduler on top of iso_tp.h and iso_tp_corr.h
+ *	  (Hardware-Agnostic)
+ *
+ * Sends periodic requests (jobs), keeping one outstanding request per
+ * target (request CAN ID), so requests to different ECUs are pipelined:
+ * while one ECU prepares its response, others are already asked. Frames of
+ * each transfer are paced by FlowControl of its peer (BS, STmin) as usual,
+ * see iso_tp_send.
+ *
+ * Job is released every period and is due by the end of period. Of
+ * released jobs with free target, the one with least slack goes first:
+ * deadline minus expected response time, measured by correlation
+ * instance (if any), which is told about every request sent (see
+ * iso_tp_corr_request). Request is outstanding until the whole response is
+ * received (ISO_TP_EVENT_N_USDATA_IND), transfer fails or timeout passes.
+ * Negative response 0x78 (ResponsePending) keeps request outstanding and
+ * restarts its timeout, as ECU is still busy.
+ *
+ * Peers must be bound (see iso_tp_bind_n_ai), RX buffer must be set to
+ * receive multiframe responses (see iso_tp_set_rx_buffer). Run after each
+ * step with its event:
+ * ```
+ * ev = iso_tp_step_us(&tp, delta_time_us);
+ * iso_tp_corr_step(&corr, &tp, delta_time_us);
+ * iso_tp_sched_step(&sched, &tp, ev, delta_time_us);
+ * ```
+ *
+ * **Conventions:**
+ * Same as iso_tp.h
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#include "iso_tp_corr.h"
+
+/******************************************************************************
+ * SCHEDULER DEFINITIONS
+ *****************************************************************************/
+#ifndef ISO_TP_SCHED_MAX_JOBS
+#define ISO_TP_SCHED_MAX_JOBS 16u /**< Maximum number of jobs. May be
+				       overriden before include.
+				       @note Not standard */
+#endif
+
+#ifndef ISO_TP_SCHED_PERCENTILE
+#define ISO_TP_SCHED_PERCENTILE 90u /**< Percentile of measured response
+					 time taken as expected one.
+					 May be overriden before include.
+					 @note Not standard */
+#endif
+
+/* Job index is kept in 8 bits */
+ISO_TP_STATIC_ASSERT(_iso_tp_sched_assert_max_jobs,
+		     (ISO_TP_SCHED_MAX_JOBS >= 1u) &&
+		     (ISO_TP_SCHED_MAX_JOBS <= 255u));
+
+/******************************************************************************
+ * SCHEDULER TYPE AND DATA DEFINITIONS AND IMPLEMENTATION
+ *****************************************************************************/
+/** Periodic request @note Not standard */
+struct iso_tp_sched_job {
+	uint32_t tx_id; /**< Target, CAN ID of request */
+	uint32_t rx_id; /**< CAN ID of response */
+
+	const uint8_t *data; /**< Request */
+	uint32_t       len;
+
+	uint32_t period_ms; /**< Release period, also relative deadline */
+};
+
+/** Counters of job @note Not standard */
+struct iso_tp_sched_stats {
+	uint32_t sent;    /**< Requests sent */
+	uint32_t done;    /**< Responses received */
+	uint32_t failed;  /**< Transfer failed or timeout passed */
+	uint32_t late;    /**< Responses received after deadline */
+	uint32_t skipped; /**< Periods missed entirely, job was behind */
+	uint32_t last_us; /**< Time of the last request to its response */
+};
+
+/** State of job */
+struct _iso_tp_sched_job_state {
+	bool     busy;       /**< Request is outstanding */
+	uint32_t release_us; /**< Time of current release */
+	uint32_t sent_us;    /**< Time of request */
+	uint32_t alive_us;   /**< Time of request or the last 0x78 */
+
+	struct iso_tp_sched_stats stats;
+};
+
+/** Main scheduler instance @note Not standard */
+struct iso_tp_sched {
+	const struct iso_tp_sched_job  *_jobs; /**< Not copied */
+	uint8_t                         _n_jobs;
+	struct _iso_tp_sched_job_state  _state[ISO_TP_SCHED_MAX_JOBS];
+
+	struct iso_tp_corr *_corr; /**< Measured response times, optional */
+
+	uint32_t _now_us;
+	uint32_t _timeout_us;
+};
+
+/** Initialize scheduler. Response times are taken from corr (may be NULL,
+ *  jobs are ordered by deadline only then). Request with no response
+ *  within timeout_ms fails and its target is free again. */
+void iso_tp_sched_init(struct iso_tp_sched *self, struct iso_tp_corr *corr,
+		       uint32_t timeout_ms)
+{
+	self->_jobs   = NULL;
+	self->_n_jobs = 0u;
+
+	self->_corr = corr;
+
+	self->_now_us     = 0u;
+	self->_timeout_us = timeout_ms * 1000u;
+}
+
+/** Set job table, every job is released at once. Table is not copied and
+ *  must stay valid. Returns false if there are too many jobs (see
+ *  ISO_TP_SCHED_MAX_JOBS), jobs are cleared then */
+bool iso_tp_sched_set_jobs(struct iso_tp_sched *self,
+			   const struct iso_tp_sched_job *jobs,
+			   uint8_t n_jobs)
+{
+	bool result = (n_jobs <= ISO_TP_SCHED_MAX_JOBS);
+
+	uint8_t i;
+
+	self->_jobs   = result ? jobs : NULL;
+	self->_n_jobs = result ? n_jobs : 0u;
+
+	for (i = 0u; i < self->_n_jobs; i++) {
+		struct _iso_tp_sched_job_state *st = &self->_state[i];
+
+		st->busy       = false;
+		st->release_us = self->_now_us;
+		st->sent_us    = 0u;
+		st->alive_us   = 0u;
+
+		(void)memset(&st->stats, 0u, sizeof(struct iso_tp_sched_stats));
+	}
+
+	return result;
+}
+
+/** Check if target has outstanding request */
+bool _iso_tp_sched_target_busy(struct iso_tp_sched *self, uint32_t tx_id)
+{
+	bool result = false;
+
+	uint8_t i;
+
+	for (i = 0u; i < self->_n_jobs; i++) {
+		if (self->_state[i].busy && (self->_jobs[i].tx_id == tx_id)) {
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+/** End outstanding request of job, ok if response is received */
+void _iso_tp_sched_done(struct iso_tp_sched *self, uint8_t i, bool ok)
+{
+	struct _iso_tp_sched_job_state *st  = &self->_state[i];
+	const struct iso_tp_sched_job  *job = &self->_jobs[i];
+
+	uint32_t period_us = job->period_ms * 1000u;
+
+	st->busy          = false;
+	st->stats.last_us = self->_now_us - st->sent_us;
+
+	if (ok) {
+		st->stats.done++;
+	} else {
+		st->stats.failed++;
+	}
+
+	if (ok && ((self->_now_us - st->release_us) > period_us)) {
+		st->stats.late++;
+	}
+
+	/* Next release, periods which are already over are skipped */
+	st->release_us += period_us;
+
+	if ((self->_now_us - st->release_us) < 0x80000000u) {
+		if ((self->_now_us - st->release_us) >= period_us) {
+			st->stats.skipped++;
+			st->release_us = self->_now_us;
+		}
+	}
+}
+
+/** Check if message is negative response 0x78 (ResponsePending) to
+ *  request of job */
+bool _iso_tp_sched_pending(const struct iso_tp_sched_job *job,
+			   const struct iso_tp_n_usdata *ind)
+{
+	return (ind->data != NULL) && (ind->len >= 3u) && (job->len > 0u) &&
+	       (ind->data[0] == 0x7Fu) && (ind->data[1] == job->data[0]) &&
+	       (ind->data[2] == 0x78u);
+}
+
+/** Account event of the last step */
+void _iso_tp_sched_event(struct iso_tp_sched *self, struct iso_tp *tp,
+			 enum iso_tp_event ev)
+{
+	struct iso_tp_n_usdata ind;
+
+	uint8_t i;
+
+	if (((ev != ISO_TP_EVENT_N_USDATA_IND) &&
+	     (ev != ISO_TP_EVENT_N_USDATA_CON)) ||
+	    !iso_tp_get_n_usdata(tp, &ind)) {
+		/* Nothing to account */
+	} else {
+		bool ok = (ind.n_result == (uint8_t)ISO_TP_N_RESULT_N_OK);
+
+		for (i = 0u; i < self->_n_jobs; i++) {
+			const struct iso_tp_sched_job  *job = &self->_jobs[i];
+			struct _iso_tp_sched_job_state *st  = &self->_state[i];
+
+			if (!st->busy) {
+				/* Not waiting */
+			} else if (ev == ISO_TP_EVENT_N_USDATA_IND) {
+				if (ind.id != job->rx_id) {
+					/* Not a response of target */
+				} else if (ok &&
+					   _iso_tp_sched_pending(job, &ind)) {
+					/* ECU is still busy, keep waiting */
+					st->alive_us = self->_now_us;
+				} else {
+					_iso_tp_sched_done(self, i, ok);
+				}
+			} else if ((ind.id == job->tx_id) && !ok) {
+				/* Request is not delivered */
+				_iso_tp_sched_done(self, i, false);
+			} else {}
+		}
+	}
+}
+
+/** Slack of released job: time left until deadline minus expected
+ *  response time. Negative slack is clamped to 0. */
+uint32_t _iso_tp_sched_slack(struct iso_tp_sched *self, uint8_t i)
+{
+	const struct iso_tp_sched_job  *job = &self->_jobs[i];
+	struct _iso_tp_sched_job_state *st  = &self->_state[i];
+
+	uint32_t elapsed  = self->_now_us - st->release_us;
+	uint32_t period   = job->period_ms * 1000u;
+	uint32_t left     = (elapsed < period) ? (period - elapsed) : 0u;
+	uint32_t expected = 0u;
+
+	if (self->_corr != NULL) {
+		expected = iso_tp_corr_latency(self->_corr, job->rx_id,
+					       job->data, job->len,
+					       ISO_TP_SCHED_PERCENTILE);
+	}
+
+	return (left > expected) ? (left - expected) : 0u;
+}
+
+/** Account the last step of instance (call with its event and delta),
+ *  then send released jobs with free targets, least slack first. Job
+ *  the instance doesn't take (TX queue is full, etc) is tried again by
+ *  the next step. Returns number of requests sent */
+uint8_t iso_tp_sched_step(struct iso_tp_sched *self, struct iso_tp *tp,
+			  enum iso_tp_event ev, uint32_t delta_time_us)
+{
+	uint8_t result = 0u;
+
+	bool    tried[ISO_TP_SCHED_MAX_JOBS]; /**< Send failed this step */
+	uint8_t i;
+	uint8_t n;
+
+	const struct iso_tp_sched_job *job;
+
+	(void)memset(tried, 0, sizeof(tried));
+
+	self->_now_us += delta_time_us;
+
+	_iso_tp_sched_event(self, tp, ev);
+
+	for (i = 0u; i < self->_n_jobs; i++) {
+		struct _iso_tp_sched_job_state *st = &self->_state[i];
+
+		if (st->busy &&
+		    ((self->_now_us - st->alive_us) > self->_timeout_us)) {
+			_iso_tp_sched_done(self, i, false);
+		}
+	}
+
+	/* Each round sends a job or ends, bounded by jobs */
+	for (n = 0u; n < self->_n_jobs; n++) {
+		uint8_t  best       = 0xFFu;
+		uint32_t best_slack = 0xFFFFFFFFu;
+
+		for (i = 0u; i < self->_n_jobs; i++) {
+			struct _iso_tp_sched_job_state *st = &self->_state[i];
+
+			uint32_t slack;
+
+			job = &self->_jobs[i];
+
+			/* Released jobs only (release is not in future) */
+			if (st->busy || tried[i] ||
+			    ((self->_now_us - st->release_us) >= 0x80000000u) ||
+			    _iso_tp_sched_target_busy(self, job->tx_id)) {
+				continue;
+			}
+
+			slack = _iso_tp_sched_slack(self, i);
+
+			if ((best == 0xFFu) || (slack < best_slack)) {
+				best       = i;
+				best_slack = slack;
+			}
+		}
+
+		if (best == 0xFFu) {
+			break;
+		}
+
+		job = &self->_jobs[best];
+
+		if (iso_tp_send(tp, job->tx_id, job->data, job->len)) {
+			self->_state[best].busy     = true;
+			self->_state[best].sent_us  = self->_now_us;
+			self->_state[best].alive_us = self->_now_us;
+			self->_state[best].stats.sent++;
+
+			/* Own requests are not seen by correlation */
+			if (self->_corr != NULL) {
+				iso_tp_corr_request(self->_corr, job->tx_id,
+						    job->data, job->len);
+			}
+
+			result++;
+		} else {
+			/* Instance can't take it now, others may go */
+			tried[best] = true;
+		}
+	}
+
+	return result;
+}
+
+/** Copy counters of job */
+void iso_tp_sched_get_stats(struct iso_tp_sched *self, uint8_t job,
+			    struct iso_tp_sched_stats *stats)
+{
+	*stats = self->_state[job].stats;
+}
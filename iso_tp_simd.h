@@ -0,0 +1,296 @@
+/**
+ * @file iso_tp_simd.h
+ * @brief Vectorized N_PCItype classification of frame batches for iso_tp.h
+ *	  (host side, optional)
+ *
+ * Host tools (analyzer, gateway) get frames in batches of hundreds. This
+ * header classifies whole batch described by struct iso_tp_frame_view
+ * (see iso_tp_push_frames) at once: first N_PCI byte and CAN_DL of
+ * ISO_TP_SIMD_LANES frames are gathered, then N_PCItype and validity of
+ * all of them are computed by vector compares (SSE2 or NEON), instead of
+ * nibble switch per frame. Frames are then grouped by type.
+ *
+ * Classification is the first stage of the decoder of iso_tp.h:
+ * N_PCItype nibble is known and frame is long enough for its N_PCI.
+ * Frame classified as ISO_TP_N_PCITYPE_INVALID is always ignored by the
+ * decoder, other frames still may be rejected by checks of their type
+ * (SF_DL, FS, etc). Decoding is stateful (CF follow their FF), so frames
+ * of groups must still be pushed in order, groups serve to skip batches
+ * with nothing to decode and for per-type work which doesn't need state:
+ * ```
+ * n = iso_tp_simd_classify(&tp, &view, types);
+ * iso_tp_simd_group(types, view.count, index, first);
+ * for (i = first[ISO_TP_N_PCITYPE_FC]; i < first[ISO_TP_N_PCITYPE_FC + 1u];
+ *      i++) { (frame index[i] is FC) }
+ * if (n > 0u) { iso_tp_push_frames(&tp, &view, desc, &n_desc); }
+ * ```
+ *
+ * Vector path is chosen by compiler flags (__SSE2__, __ARM_NEON on little
+ * endian), scalar fallback is used otherwise or if ISO_TP_SIMD_SCALAR is
+ * defined before include. Vector path reads N_PCI byte of every frame, even
+ * of too short one, so storage of frame data must hold it. It's not a part
+ * of the hardware-agnostic (MISRA) core, which stays C89.
+ *
+ * **Conventions:**
+ * Same as iso_tp.h
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#include "iso_tp.h"
+
+#if defined(ISO_TP_SIMD_SCALAR)
+#define ISO_TP_SIMD_PATH "scalar"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ISO_TP_SIMD_PATH "sse2"
+#elif defined(__ARM_NEON) && defined(__ORDER_LITTLE_ENDIAN__) && \
+      (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define ISO_TP_SIMD_PATH "neon"
+#else
+#define ISO_TP_SIMD_SCALAR
+#define ISO_TP_SIMD_PATH "scalar"
+#endif
+
+/******************************************************************************
+ * SIMD DEFINITIONS
+ *****************************************************************************/
+/** Frames classified at once (one 128-bit vector) @note Not standard */
+#define ISO_TP_SIMD_LANES 16u
+
+/** Number of groups: every N_PCItype and ISO_TP_N_PCITYPE_INVALID
+ *  @note Not standard */
+#define ISO_TP_SIMD_GROUPS ((uint8_t)ISO_TP_N_PCITYPE_INVALID + 1u)
+
+/******************************************************************************
+ * SIMD IMPLEMENTATION
+ *****************************************************************************/
+/** Classify frames [from, to) of view one by one, the same way the
+ *  decoder does (see _iso_tp_decode). Returns number of valid ones */
+uint16_t _iso_tp_simd_classify_scalar(uint8_t off,
+				      const struct iso_tp_frame_view *view,
+				      uint16_t from, uint16_t to,
+				      uint8_t *types)
+{
+	/* Min length of N_PCI of every type (see Table 9) */
+	static const uint8_t min_dl[4] = {1u, 2u, 2u, 3u};
+
+	uint16_t result = 0u;
+	uint16_t i;
+
+	for (i = from; i < to; i++) {
+		const uint8_t *frame = &view->base[(uint32_t)i * view->stride];
+
+		uint8_t can_dl = frame[view->len_offset];
+		uint8_t dl     = (can_dl > off) ? (uint8_t)(can_dl - off) : 0u;
+		uint8_t type   = (uint8_t)ISO_TP_N_PCITYPE_INVALID;
+
+		if ((dl > 0u) && (can_dl <= ISO_TP_MAX_CAN_DL)) {
+			type = (uint8_t)(frame[view->data_offset + off] >> 4u);
+		}
+
+		if ((type < 4u) && (dl >= min_dl[type])) {
+			result++;
+		} else {
+			type = (uint8_t)ISO_TP_N_PCITYPE_INVALID;
+		}
+
+		types[i] = type;
+	}
+
+	return result;
+}
+
+#ifndef ISO_TP_SIMD_SCALAR
+/** Word of bytes of 4 frames at stride, the first one is the low byte */
+uint32_t _iso_tp_simd_gather(const uint8_t *p, uint16_t stride)
+{
+	return (uint32_t)p[0] |
+	       ((uint32_t)p[stride] << 8u) |
+	       ((uint32_t)p[2u * stride] << 16u) |
+	       ((uint32_t)p[3u * stride] << 24u);
+}
+
+/** Classify ISO_TP_SIMD_LANES frames from the first one. Returns number
+ *  of valid ones */
+uint16_t _iso_tp_simd_classify_block(uint8_t off,
+				     const struct iso_tp_frame_view *view,
+				     uint16_t first, uint8_t *types)
+{
+	const uint8_t *frame = &view->base[(uint32_t)first * view->stride];
+	const uint8_t *len   = &frame[view->len_offset];
+	const uint8_t *data  = &frame[view->data_offset + off];
+
+	uint16_t s = view->stride;
+
+	/* Gather, frames are strided. Lanes are packed into words in
+	 * registers, not stored byte by byte, so vector loads don't stall on
+	 * the stores. N_PCI byte is read even if frame is too short (storage
+	 * of CAN frame data is never shorter), such frame fails length check
+	 * anyway */
+	uint32_t can_dl[ISO_TP_SIMD_LANES / 4u];
+	uint32_t pci[ISO_TP_SIMD_LANES / 4u];
+
+	uint16_t result = 0u;
+
+	can_dl[0] = _iso_tp_simd_gather(len, s);
+	can_dl[1] = _iso_tp_simd_gather(&len[4u * s], s);
+	can_dl[2] = _iso_tp_simd_gather(&len[8u * s], s);
+	can_dl[3] = _iso_tp_simd_gather(&len[12u * s], s);
+
+	pci[0] = _iso_tp_simd_gather(data, s);
+	pci[1] = _iso_tp_simd_gather(&data[4u * s], s);
+	pci[2] = _iso_tp_simd_gather(&data[8u * s], s);
+	pci[3] = _iso_tp_simd_gather(&data[12u * s], s);
+
+#if defined(__SSE2__)
+	{
+		__m128i vdl  = _mm_set_epi32((int)can_dl[3], (int)can_dl[2],
+					     (int)can_dl[1], (int)can_dl[0]);
+		__m128i vpci = _mm_set_epi32((int)pci[3], (int)pci[2],
+					     (int)pci[1], (int)pci[0]);
+
+		/* No 8-bit shift, bits of neighbour lane are masked out */
+		__m128i type = _mm_and_si128(_mm_srli_epi16(vpci, 4),
+					     _mm_set1_epi8(0x0F));
+
+		/* Min length of N_PCI: 2, minus 1 for SF, plus 1 for FC
+		 * (compare gives all ones, which is -1) */
+		__m128i min = _mm_sub_epi8(
+			_mm_add_epi8(_mm_set1_epi8(2),
+				     _mm_cmpeq_epi8(type, _mm_setzero_si128())),
+			_mm_cmpeq_epi8(type, _mm_set1_epi8(3)));
+
+		/* Length of N_PCI and N_Data, 0 if frame is too short */
+		__m128i dl = _mm_subs_epu8(vdl, _mm_set1_epi8((char)off));
+
+		/* Unsigned a >= b is max(a, b) == a */
+		__m128i ok = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_max_epu8(dl, min), dl),
+			_mm_cmpeq_epi8(_mm_min_epu8(vdl,
+				_mm_set1_epi8((char)ISO_TP_MAX_CAN_DL)), vdl));
+
+		uint32_t mask;
+
+		ok = _mm_and_si128(ok, _mm_cmpeq_epi8(
+			_mm_min_epu8(type, _mm_set1_epi8(3)), type));
+
+		_mm_storeu_si128((__m128i *)&types[first], _mm_or_si128(
+			_mm_and_si128(ok, type),
+			_mm_andnot_si128(ok, _mm_set1_epi8(
+				(char)ISO_TP_N_PCITYPE_INVALID))));
+
+		/* Bit per valid lane, counted in parallel (no branches) */
+		mask = (uint32_t)_mm_movemask_epi8(ok);
+		mask = mask - ((mask >> 1u) & 0x5555u);
+		mask = (mask & 0x3333u) + ((mask >> 2u) & 0x3333u);
+		mask = (mask + (mask >> 4u)) & 0x0F0Fu;
+
+		result = (uint16_t)((mask + (mask >> 8u)) & 0x1Fu);
+	}
+#elif defined(__ARM_NEON)
+	{
+		uint8x16_t vdl  = vreinterpretq_u8_u32(vld1q_u32(can_dl));
+		uint8x16_t type = vshrq_n_u8(vreinterpretq_u8_u32(
+						vld1q_u32(pci)), 4);
+
+		/* Min length of N_PCI: 2, minus 1 for SF, plus 1 for FC
+		 * (compare gives all ones, which is -1) */
+		uint8x16_t sf  = vceqq_u8(type, vdupq_n_u8(0u));
+		uint8x16_t fc  = vceqq_u8(type, vdupq_n_u8(3u));
+		uint8x16_t min = vsubq_u8(vaddq_u8(vdupq_n_u8(2u), sf), fc);
+
+		/* Length of N_PCI and N_Data, 0 if frame is too short */
+		uint8x16_t dl = vqsubq_u8(vdl, vdupq_n_u8(off));
+
+		uint8x16_t ok = vandq_u8(
+			vandq_u8(vcgeq_u8(dl, min),
+				 vcleq_u8(vdl, vdupq_n_u8(ISO_TP_MAX_CAN_DL))),
+			vcltq_u8(type, vdupq_n_u8(4u)));
+
+		uint8_t valid[ISO_TP_SIMD_LANES];
+		uint8_t i;
+
+		vst1q_u8(&types[first], vbslq_u8(ok, type,
+			 vdupq_n_u8((uint8_t)ISO_TP_N_PCITYPE_INVALID)));
+		vst1q_u8(valid, vandq_u8(ok, vdupq_n_u8(1u)));
+
+		for (i = 0u; i < ISO_TP_SIMD_LANES; i++) {
+			result += valid[i];
+		}
+	}
+#endif
+
+	return result;
+}
+#endif
+
+/** Classify every frame of view: types[i] is enum iso_tp_n_pcitype of
+ *  frame i, ISO_TP_N_PCITYPE_INVALID if the decoder of instance ignores
+ *  it anyway (see file description). types must have room for
+ *  view->count entries. Returns number of frames which are not invalid
+ *  @note Not standard */
+uint16_t iso_tp_simd_classify(const struct iso_tp *tp,
+			      const struct iso_tp_frame_view *view,
+			      uint8_t *types)
+{
+	uint8_t  off    = _ISO_TP_PCI_OFFSET(tp);
+	uint16_t result = 0u;
+	uint16_t i      = 0u;
+
+#ifndef ISO_TP_SIMD_SCALAR
+	for (; (uint32_t)(view->count - i) >= ISO_TP_SIMD_LANES;
+	     i += ISO_TP_SIMD_LANES) {
+		result += _iso_tp_simd_classify_block(off, view, i, types);
+	}
+#endif
+
+	/* Tail (or everything, if there's no vector path) */
+	result += _iso_tp_simd_classify_scalar(off, view, i, view->count,
+					       types);
+
+	(void)tp;
+
+	return result;
+}
+
+/** Group frames by type: index gets frame indices, of type t they are
+ *  index[first[t]] .. index[first[t + 1] - 1], in original order. index
+ *  must have room for count entries, first for ISO_TP_SIMD_GROUPS + 1
+ *  @note Not standard */
+void iso_tp_simd_group(const uint8_t *types, uint16_t count, uint16_t *index,
+		       uint16_t *first)
+{
+	uint16_t at[ISO_TP_SIMD_GROUPS];
+	uint16_t i;
+	uint8_t  t;
+
+	(void)memset(at, 0, sizeof(at));
+
+	/* Count, then turn counts into offsets of groups */
+	for (i = 0u; i < count; i++) {
+		at[types[i]]++;
+	}
+
+	first[0] = 0u;
+
+	for (t = 0u; t < ISO_TP_SIMD_GROUPS; t++) {
+		first[t + 1u] = (uint16_t)(first[t] + at[t]);
+		at[t]         = first[t];
+	}
+
+	for (i = 0u; i < count; i++) {
+		index[at[types[i]]] = i;
+		at[types[i]]++;
+	}
+}
@@ -0,0 +1,441 @@
+/**
+ * @file iso_tp_socketcan.h
+ * @brief Linux SocketCAN adaptation layer for iso_tp.h (optional)
+ *
+ * Reference adapter between CAN_RAW socket and struct iso_tp. It is Linux
+ * specific, so it's not a part of the hardware-agnostic (MISRA) core.
+ *
+ * RX frames are read in batches by recvmmsg straight into array of
+ * struct canfd_frame, which is described as struct iso_tp_frame_view, so
+ * iso_tp_push_frames decodes them in place with no copy (struct can_frame
+ * has the same layout up to its data). TX frames are sent in batches by
+ * sendmmsg. Each RX frame carries kernel timestamp and, if NIC supports
+ * it, hardware one (SO_TIMESTAMPING).
+ *
+ * Typical loop. iso_tp_push_frames stops after each complete message
+ * (ISO_TP_EVENT_N_USDATA_IND), so the rest of batch is pushed again until
+ * the whole batch is processed:
+ * ```
+ * n = iso_tp_sc_recv(&sc, timeout_ms);
+ * ev = iso_tp_step_us(&tp, iso_tp_sc_elapsed_us(&sc));  (handle ev)
+ * for (done = 0u; done < n; done += pushed) {
+ *         iso_tp_sc_view_from(&sc, &view, done);
+ *         pushed = iso_tp_push_frames(&tp, &view, desc, &n_desc);
+ *         (handle desc, index is relative to done)
+ *         ev = iso_tp_step(&tp, 0u);  (handle ev)
+ *         iso_tp_sc_flush(&sc, &tp);
+ * }
+ * ```
+ *
+ * Define _GNU_SOURCE (recvmmsg, sendmmsg) or include this header before
+ * any system header.
+ *
+ * ```LICENSE
+ * Copyright (c) 2025 furdog <https://github.com/furdog>
+ *
+ * SPDX-License-Identifier: 0BSD
+ * ```
+ *
+ * Be free, be wise and take care of yourself!
+ * With best wishes and respect, furdog
+ */
+
+#pragma once
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "iso_tp.h"
+
+/******************************************************************************
+ * SOCKETCAN DEFINITIONS
+ *****************************************************************************/
+#ifndef ISO_TP_SC_BATCH
+#define ISO_TP_SC_BATCH 32u /**< Frames per recvmmsg/sendmmsg call */
+#endif
+
+#ifndef ISO_TP_SC_BUSY_POLL_US
+#define ISO_TP_SC_BUSY_POLL_US 50u /**< SO_BUSY_POLL of busy poll mode */
+#endif
+
+/* Descriptors of iso_tp_push_frames are indexed by uint16_t */
+ISO_TP_STATIC_ASSERT(_iso_tp_sc_assert_batch,
+		     (ISO_TP_SC_BATCH >= 1u) && (ISO_TP_SC_BATCH <= 1024u));
+
+/******************************************************************************
+ * SOCKETCAN TYPE AND DATA DEFINITIONS AND IMPLEMENTATION
+ *****************************************************************************/
+/** How iso_tp_sc_recv waits for frames */
+enum iso_tp_sc_mode {
+	/** Sleep in epoll_wait: lowest CPU usage */
+	ISO_TP_SC_MODE_EPOLL,
+
+	/** Spin on nonblocking recvmmsg (and SO_BUSY_POLL of driver):
+	 *  lowest latency, one core is fully loaded */
+	ISO_TP_SC_MODE_BUSY_POLL
+};
+
+/** Adapter instance */
+struct iso_tp_sc {
+	int     _fd;     /**< CAN_RAW socket */
+	int     _epfd;   /**< epoll instance (ISO_TP_SC_MODE_EPOLL) */
+	uint8_t _mode;   /**< enum iso_tp_sc_mode */
+	bool    _fd_mode; /**< CAN FD frames are enabled */
+
+	/* RX batch, frames are decoded right here */
+	struct canfd_frame _rx[ISO_TP_SC_BATCH];
+	struct mmsghdr     _rx_msg[ISO_TP_SC_BATCH];
+	struct iovec       _rx_iov[ISO_TP_SC_BATCH];
+	uint8_t            _rx_ctl[ISO_TP_SC_BATCH]
+			      [CMSG_SPACE(sizeof(struct scm_timestamping))];
+	uint16_t           _rx_count;
+
+	/* Timestamps of RX batch, nanoseconds (0 if not available) */
+	uint64_t _rx_sw_ns[ISO_TP_SC_BATCH]; /**< Kernel, CLOCK_REALTIME */
+	uint64_t _rx_hw_ns[ISO_TP_SC_BATCH]; /**< NIC clock */
+
+	/* TX batch */
+	struct canfd_frame _tx[ISO_TP_SC_BATCH];
+	struct mmsghdr     _tx_msg[ISO_TP_SC_BATCH];
+	struct iovec       _tx_iov[ISO_TP_SC_BATCH];
+	uint16_t           _tx_count;
+
+	uint64_t _last_ns; /**< Time of the last iso_tp_sc_elapsed_us */
+};
+
+/** Current time, same clock as kernel RX timestamps */
+uint64_t _iso_tp_sc_now_ns(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/** Open CAN_RAW socket bound to interface ifname (like "can0").
+ *  fd_mode enables CAN FD frames (ISO_TP_MAX_CAN_DL > 8).
+ *  Returns 0 on success, -errno otherwise */
+int iso_tp_sc_open(struct iso_tp_sc *self, const char *ifname, bool fd_mode,
+		   enum iso_tp_sc_mode mode)
+{
+	int result = 0;
+
+	/* Remote frames have no ISO-TP payload */
+	struct can_filter filter = {0u, CAN_RTR_FLAG};
+
+	struct ifreq       ifr;
+	struct sockaddr_can addr;
+	struct epoll_event ev;
+
+	int on    = 1;
+	int busy  = (int)ISO_TP_SC_BUSY_POLL_US;
+	int flags = SOF_TIMESTAMPING_RX_HARDWARE |
+		    SOF_TIMESTAMPING_RAW_HARDWARE |
+		    SOF_TIMESTAMPING_RX_SOFTWARE |
+		    SOF_TIMESTAMPING_SOFTWARE;
+	uint16_t i;
+
+	(void)memset(self, 0, sizeof(struct iso_tp_sc));
+	(void)memset(&ifr, 0, sizeof(ifr));
+	(void)memset(&addr, 0, sizeof(addr));
+	(void)memset(&ev, 0, sizeof(ev));
+
+	self->_epfd    = -1;
+	self->_mode    = (uint8_t)mode;
+	self->_fd_mode = fd_mode;
+	self->_fd      = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+
+	if (self->_fd < 0) {
+		result = -errno;
+	} else if (fd_mode &&
+		   (setsockopt(self->_fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+			       &on, sizeof(on)) < 0)) {
+		result = -errno;
+	} else if (setsockopt(self->_fd, SOL_CAN_RAW, CAN_RAW_FILTER,
+			      &filter, sizeof(filter)) < 0) {
+		result = -errno;
+	} else if (setsockopt(self->_fd, SOL_SOCKET, SO_TIMESTAMPING,
+			      &flags, sizeof(flags)) < 0) {
+		result = -errno;
+	} else {
+		(void)strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1u);
+
+		if (ioctl(self->_fd, SIOCGIFINDEX, &ifr) < 0) {
+			result = -errno;
+		}
+	}
+
+	if (result == 0) {
+		addr.can_family  = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+
+		if (bind(self->_fd, (struct sockaddr *)&addr,
+			 sizeof(addr)) < 0) {
+			result = -errno;
+		}
+	}
+
+	if ((result == 0) && (mode == ISO_TP_SC_MODE_BUSY_POLL)) {
+		/* Not fatal, driver may not support it */
+		(void)setsockopt(self->_fd, SOL_SOCKET, SO_BUSY_POLL,
+				 &busy, sizeof(busy));
+	} else if (result == 0) {
+		ev.events  = EPOLLIN;
+		ev.data.fd = self->_fd;
+
+		self->_epfd = epoll_create1(0);
+
+		if ((self->_epfd < 0) ||
+		    (epoll_ctl(self->_epfd, EPOLL_CTL_ADD, self->_fd,
+			       &ev) < 0)) {
+			result = -errno;
+		}
+	} else {}
+
+	/* Batch descriptors point at fixed buffers, set them once */
+	for (i = 0u; i < ISO_TP_SC_BATCH; i++) {
+		self->_rx_iov[i].iov_base = &self->_rx[i];
+		self->_rx_iov[i].iov_len  = sizeof(struct canfd_frame);
+
+		self->_rx_msg[i].msg_hdr.msg_iov    = &self->_rx_iov[i];
+		self->_rx_msg[i].msg_hdr.msg_iovlen = 1u;
+
+		self->_tx_iov[i].iov_base = &self->_tx[i];
+
+		self->_tx_msg[i].msg_hdr.msg_iov    = &self->_tx_iov[i];
+		self->_tx_msg[i].msg_hdr.msg_iovlen = 1u;
+	}
+
+	self->_last_ns = _iso_tp_sc_now_ns();
+
+	return result;
+}
+
+/** Close socket (and epoll instance) */
+void iso_tp_sc_close(struct iso_tp_sc *self)
+{
+	if (self->_epfd >= 0) {
+		(void)close(self->_epfd);
+		self->_epfd = -1;
+	}
+
+	if (self->_fd >= 0) {
+		(void)close(self->_fd);
+		self->_fd = -1;
+	}
+}
+
+/** Read timestamps of RX frame i from its control messages */
+void _iso_tp_sc_rx_ts(struct iso_tp_sc *self, uint16_t i)
+{
+	struct msghdr  *msg = &self->_rx_msg[i].msg_hdr;
+	struct cmsghdr *c;
+
+	self->_rx_sw_ns[i] = 0u;
+	self->_rx_hw_ns[i] = 0u;
+
+	for (c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+		struct scm_timestamping ts;
+
+		if ((c->cmsg_level != SOL_SOCKET) ||
+		    (c->cmsg_type != SCM_TIMESTAMPING)) {
+			continue;
+		}
+
+		(void)memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+
+		/* ts[0] is software, ts[2] is raw hardware timestamp */
+		self->_rx_sw_ns[i] = ((uint64_t)ts.ts[0].tv_sec * 1000000000u) +
+				     (uint64_t)ts.ts[0].tv_nsec;
+		self->_rx_hw_ns[i] = ((uint64_t)ts.ts[2].tv_sec * 1000000000u) +
+				     (uint64_t)ts.ts[2].tv_nsec;
+	}
+}
+
+/** Receive batch of up to ISO_TP_SC_BATCH frames, waiting up to timeout_ms
+ *  (-1 - forever) for the first one. Previous batch is overwritten, so it
+ *  must be processed already, all of it (see iso_tp_sc_view_from).
+ *  Returns number of frames, 0 on timeout, -errno on error */
+int iso_tp_sc_recv(struct iso_tp_sc *self, int timeout_ms)
+{
+	int result = 0;
+
+	uint64_t until = _iso_tp_sc_now_ns() +
+			 ((uint64_t)((timeout_ms > 0) ? timeout_ms : 0) *
+			  1000000u);
+	struct epoll_event ev;
+	uint16_t i;
+
+	self->_rx_count = 0u;
+
+	for (i = 0u; i < ISO_TP_SC_BATCH; i++) {
+		struct msghdr *msg = &self->_rx_msg[i].msg_hdr;
+
+		msg->msg_control    = self->_rx_ctl[i];
+		msg->msg_controllen = sizeof(self->_rx_ctl[i]);
+		msg->msg_flags      = 0;
+	}
+
+	if ((self->_mode == (uint8_t)ISO_TP_SC_MODE_EPOLL) &&
+	    (epoll_wait(self->_epfd, &ev, 1, timeout_ms) < 0) &&
+	    (errno != EINTR)) {
+		result = -errno;
+	}
+
+	while (result == 0) {
+		result = recvmmsg(self->_fd, self->_rx_msg, ISO_TP_SC_BATCH,
+				  MSG_DONTWAIT, NULL);
+
+		if ((result < 0) && (errno != EAGAIN) &&
+		    (errno != EWOULDBLOCK)) {
+			result = -errno;
+		} else if (result < 0) {
+			result = 0;
+		} else {}
+
+		/* Epoll has already waited, busy poll spins till timeout */
+		if ((self->_mode == (uint8_t)ISO_TP_SC_MODE_EPOLL) ||
+		    ((timeout_ms >= 0) && (_iso_tp_sc_now_ns() >= until))) {
+			break;
+		}
+	}
+
+	if (result > 0) {
+		self->_rx_count = (uint16_t)result;
+
+		for (i = 0u; i < self->_rx_count; i++) {
+			_iso_tp_sc_rx_ts(self, i);
+		}
+	}
+
+	return result;
+}
+
+/** Describe frames of received batch from the first one on as frame view
+ *  (see iso_tp_push_frames), so the rest of batch is pushed after the push
+ *  stopped at indication. Indices of frame descriptors are relative to
+ *  first then, unlike index of iso_tp_sc_timestamp.
+ *  CAN_EFF_FLAG is stripped from CAN ID */
+void iso_tp_sc_view_from(struct iso_tp_sc *self,
+			 struct iso_tp_frame_view *view, uint16_t first)
+{
+	if (first > self->_rx_count) {
+		first = self->_rx_count;
+	}
+
+	view->base   = (const uint8_t *)&self->_rx[first];
+	view->count  = (uint16_t)(self->_rx_count - first);
+	view->stride = (uint16_t)sizeof(struct canfd_frame);
+
+	view->id_offset   = (uint16_t)offsetof(struct canfd_frame, can_id);
+	view->len_offset  = (uint16_t)offsetof(struct canfd_frame, len);
+	view->data_offset = (uint16_t)offsetof(struct canfd_frame, data);
+
+	view->id_mask = CAN_EFF_MASK;
+}
+
+/** Describe the whole received batch as frame view */
+void iso_tp_sc_view(struct iso_tp_sc *self, struct iso_tp_frame_view *view)
+{
+	iso_tp_sc_view_from(self, view, 0u);
+}
+
+/** Kernel (software) and hardware timestamps of RX frame of the last
+ *  batch, nanoseconds. 0 if not available */
+void iso_tp_sc_timestamp(struct iso_tp_sc *self, uint16_t index,
+			 uint64_t *sw_ns, uint64_t *hw_ns)
+{
+	*sw_ns = self->_rx_sw_ns[index];
+	*hw_ns = self->_rx_hw_ns[index];
+}
+
+/** Time passed since the previous call, microseconds (for iso_tp_step_us).
+ *  Time of the last received frame is its RX timestamp, so timers count
+ *  from the moment frame hit the bus, not from the moment it was read.
+ *  NIC clock is not host clock, so hardware timestamps are not used
+ *  here (see iso_tp_sc_timestamp) */
+uint32_t iso_tp_sc_elapsed_us(struct iso_tp_sc *self)
+{
+	uint64_t now = _iso_tp_sc_now_ns();
+	uint64_t dt;
+
+	if ((self->_rx_count > 0u) &&
+	    (self->_rx_sw_ns[self->_rx_count - 1u] != 0u)) {
+		now = self->_rx_sw_ns[self->_rx_count - 1u];
+	}
+
+	/* Clock may jump back, time doesn't */
+	dt = (now > self->_last_ns) ? ((now - self->_last_ns) / 1000u) : 0u;
+
+	if (now > self->_last_ns) {
+		self->_last_ns = now;
+	}
+
+	return (dt > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)dt;
+}
+
+/** Pop all TX frames of instance and send them in batches.
+ *  Frames which can't be sent (TX buffer of socket is full) are lost.
+ *  Returns number of frames sent, -errno on error */
+int iso_tp_sc_flush(struct iso_tp_sc *self, struct iso_tp *tp)
+{
+	int result = 0;
+
+	struct iso_tp_can_frame f;
+	bool more = true;
+
+	while (more && (result >= 0)) {
+		int sent;
+
+		self->_tx_count = 0u;
+
+		while ((self->_tx_count < ISO_TP_SC_BATCH) &&
+		       iso_tp_pop_frame(tp, &f)) {
+			struct canfd_frame *c = &self->_tx[self->_tx_count];
+			bool fd = (f.len > 8u);
+
+			(void)memset(c, 0, offsetof(struct canfd_frame, data));
+
+			c->can_id = (f.id > CAN_SFF_MASK) ?
+				    (f.id | CAN_EFF_FLAG) : f.id;
+			c->len    = f.len;
+			(void)memcpy(c->data, f.data, f.len);
+
+			/* Classic frames go as struct can_frame */
+			self->_tx_iov[self->_tx_count].iov_len =
+				(self->_fd_mode && fd) ? CANFD_MTU : CAN_MTU;
+
+			self->_tx_count++;
+		}
+
+		more = (self->_tx_count == ISO_TP_SC_BATCH);
+
+		sent = (self->_tx_count > 0u) ?
+		       sendmmsg(self->_fd, self->_tx_msg, self->_tx_count,
+				MSG_DONTWAIT) : 0;
+
+		if ((sent < 0) && (errno != EAGAIN) &&
+		    (errno != EWOULDBLOCK)) {
+			result = -errno;
+		} else if (sent > 0) {
+			result += sent;
+		} else {}
+	}
+
+	return result;
+}